@@ -0,0 +1,377 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Offline media analyzer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE   /* for SCHED_IDLE */
+#include "analyzer.h"
+#include "media_index.h"
+#include "loudness.h"
+#include "silence.h"
+#include "utils.h"
+#include <gst/app/gstappsink.h>
+#include <pthread.h>  /* for pthread_setschedparam */
+#include <sched.h>    /* for SCHED_IDLE */
+#include <stdlib.h>   /* for free */
+
+/* how long to wait for decoded data before checking the bus for errors */
+#define ANALYZER_PULL_TIMEOUT (100 * GST_MSECOND)
+/* give up on files that stop producing data without posting an error */
+#define ANALYZER_STALL_TIMEOUT (30 * GST_SECOND)
+
+void
+analyzer_lower_thread_priority (void)
+{
+  struct sched_param param = { 0 };
+
+  /* offline work must never compete with the playback pipeline;
+   * SCHED_IDLE threads only run when nothing else wants the cpu */
+  if (pthread_setschedparam (pthread_self (), SCHED_IDLE, &param) != 0)
+    utils_dbg (ANL, "failed to switch thread to SCHED_IDLE\n");
+}
+
+static GstBusSyncReply
+analyzer_bus_sync_handler (GstBus * bus, GstMessage * msg, gpointer data)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_STREAM_STATUS:
+      /* this is posted from within the new streaming thread itself */
+      gst_message_parse_stream_status (msg, &type, &owner);
+      if (type == GST_STREAM_STATUS_TYPE_ENTER)
+        analyzer_lower_thread_priority ();
+      return GST_BUS_DROP;
+
+    case GST_MESSAGE_ERROR:
+      return GST_BUS_PASS;
+
+    default:
+      /* nobody is going to read the rest, don't let them pile up */
+      return GST_BUS_DROP;
+  }
+}
+
+static void
+decodebin_pad_added (GstElement * decodebin, GstPad * src, GstPad * sink)
+{
+  gst_pad_link (src, sink);
+}
+
+static GstElement *
+analyzer_pipeline_new (const gchar * uri, GstElement ** appsink,
+    GstPad ** native_pad)
+{
+  GstElement *pipeline;
+  GstElement *decodebin, *convert, *sink;
+  GstPad *convert_sink;
+  GstCaps *caps;
+  GstBus *bus;
+
+  decodebin = gst_element_factory_make ("uridecodebin", NULL);
+  convert = gst_element_factory_make ("audioconvert", NULL);
+  sink = gst_element_factory_make ("appsink", NULL);
+
+  if (!decodebin || !convert || !sink) {
+    utils_err (ANL, "Your GStreamer installation is missing required "
+        "elements\n");
+    g_clear_object (&decodebin);
+    g_clear_object (&convert);
+    g_clear_object (&sink);
+    return NULL;
+  }
+
+  gst_util_set_object_arg (G_OBJECT (decodebin), "caps", "audio/x-raw");
+  g_object_set (decodebin, "uri", uri, NULL);
+
+  /* measure what we are going to play; the player mixes in stereo */
+  caps = gst_caps_from_string ("audio/x-raw, format=F32LE, "
+      "layout=interleaved, channels=2");
+  g_object_set (sink,
+      "caps", caps,
+      "sync", FALSE,
+      "max-buffers", 16,
+      NULL);
+  gst_caps_unref (caps);
+
+  pipeline = gst_pipeline_new (NULL);
+  gst_bin_add_many (GST_BIN (pipeline), decodebin, convert, sink, NULL);
+  gst_element_link (convert, sink);
+
+  convert_sink = gst_element_get_static_pad (convert, "sink");
+  g_signal_connect_object (decodebin, "pad-added",
+      (GCallback) decodebin_pad_added, convert_sink, 0);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_set_sync_handler (bus, analyzer_bus_sync_handler, NULL, NULL);
+  gst_object_unref (bus);
+
+  *appsink = sink;
+  *native_pad = convert_sink;
+  return pipeline;
+}
+
+/* the decoder is free to pick its preferred format here, since
+ * audioconvert accepts anything; remember it for the player */
+static void
+analyzer_get_native_format (GstPad * pad, struct midx_info * info)
+{
+  GstCaps *caps;
+  GstStructure *s;
+  const gchar *format, *layout;
+  gint rate = 0, channels = 0;
+
+  g_strlcpy (info->native_format, "-", sizeof (info->native_format));
+
+  caps = gst_pad_get_current_caps (pad);
+  if (!caps)
+    return;
+
+  s = gst_caps_get_structure (caps, 0);
+  gst_structure_get_int (s, "rate", &rate);
+  gst_structure_get_int (s, "channels", &channels);
+  format = gst_structure_get_string (s, "format");
+  layout = gst_structure_get_string (s, "layout");
+
+  info->native_rate = rate;
+  info->native_channels = channels;
+
+  /* the mixer only takes interleaved samples, planar output
+   * always needs conversion; "-" makes sure it won't match */
+  if (format && !g_strcmp0 (layout, "interleaved"))
+    g_strlcpy (info->native_format, format, sizeof (info->native_format));
+
+  gst_caps_unref (caps);
+}
+
+static void
+analyzer_process_file (struct analyzer * self, const gchar * file)
+{
+  struct loudness_meter *lm = NULL;
+  struct silence_detector *sd = NULL;
+  struct midx_info info = { 0 };
+  GstElement *pipeline, *sink;
+  GstPad *native_pad;
+  GstStructure *s;
+  GstSample *sample;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  GstMessage *msg;
+  GstBus *bus;
+  GError *error = NULL;
+  gchar *uri;
+  time_t mtime;
+  GstClockTime stalled = 0;
+  gint rate = 0, channels = 0;
+  guint64 cue_in, cue_out, total;
+  gsize num_frames;
+  gboolean failed = FALSE, bad = FALSE;
+  gint64 start = g_get_monotonic_time ();
+
+  utils_dbg (ANL, "analyzing '%s'\n", file);
+
+  mtime = utils_get_mtime ((char *) file);
+  if (!mtime) {
+    midx_store_failure (file);
+    return;
+  }
+
+  uri = gst_filename_to_uri (file, &error);
+  if (error) {
+    utils_wrn (ANL, "Failed to convert filename '%s' to URI: %s\n", file,
+        error->message);
+    g_clear_error (&error);
+    midx_store_failure (file);
+    return;
+  }
+
+  pipeline = analyzer_pipeline_new (uri, &sink, &native_pad);
+  g_free (uri);
+  if (!pipeline) {
+    midx_store_failure (file);
+    return;
+  }
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  while (!g_atomic_int_get (&self->stopping)) {
+    sample = gst_app_sink_try_pull_sample (GST_APP_SINK (sink),
+        ANALYZER_PULL_TIMEOUT);
+
+    if (!sample) {
+      if (gst_app_sink_is_eos (GST_APP_SINK (sink)))
+        break;
+
+      msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+      if (msg) {
+        gchar *debug = NULL;
+
+        gst_message_parse_error (msg, &error, &debug);
+        utils_wrn (ANL, "failed to analyze '%s': %s\n", file, error->message);
+        utils_dbg (ANL, "ERROR debug message: %s\n", debug);
+        g_clear_error (&error);
+        g_free (debug);
+        gst_message_unref (msg);
+        failed = bad = TRUE;
+        break;
+      }
+
+      /* we run at SCHED_IDLE, on a busy host (or a slow mount) a
+       * good file can get no CPU or I/O for a while, so this is not
+       * a reason to quarantine it, it'll be retried later */
+      stalled += ANALYZER_PULL_TIMEOUT;
+      if (stalled >= ANALYZER_STALL_TIMEOUT) {
+        utils_wrn (ANL, "failed to analyze '%s': no data\n", file);
+        failed = TRUE;
+        break;
+      }
+      continue;
+    }
+    stalled = 0;
+
+    if (G_UNLIKELY (!lm)) {
+      s = gst_caps_get_structure (gst_sample_get_caps (sample), 0);
+      gst_structure_get_int (s, "rate", &rate);
+      gst_structure_get_int (s, "channels", &channels);
+
+      analyzer_get_native_format (native_pad, &info);
+
+      lm = loudness_meter_new (rate, channels);
+      sd = silence_detector_new (rate, channels, self->lead_silence_db,
+          self->trail_silence_db);
+      if (!lm || !sd) {
+        gst_sample_unref (sample);
+        failed = TRUE;
+        break;
+      }
+    }
+
+    buffer = gst_sample_get_buffer (sample);
+    if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+      num_frames = map.size / (channels * sizeof (float));
+      if (loudness_meter_process (lm, (const float *) map.data,
+              num_frames) < 0)
+        failed = TRUE;
+      silence_detector_process (sd, (const float *) map.data, num_frames);
+      gst_buffer_unmap (buffer, &map);
+    }
+    gst_sample_unref (sample);
+
+    if (failed)
+      break;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (native_pad);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+
+  /* cancelled, or the file had no audio at all */
+  if (g_atomic_int_get (&self->stopping))
+    failed = TRUE;
+  else if (!failed && !lm)
+    failed = bad = TRUE;
+  else if (!lm || !sd)
+    failed = TRUE;
+
+  if (!failed) {
+    info.integrated_lufs = loudness_meter_get_integrated (lm);
+    info.true_peak_dbtp = loudness_meter_get_true_peak (lm);
+
+    silence_detector_get_cue_points (sd, &cue_in, &cue_out, &total);
+    info.duration_ns = gst_util_uint64_scale_int (total, GST_SECOND, rate);
+    info.cue_in_ns = gst_util_uint64_scale_int (cue_in, GST_SECOND, rate);
+    info.cue_out_ns = gst_util_uint64_scale_int (cue_out, GST_SECOND, rate);
+    midx_store_info (file, mtime, &info);
+
+    utils_dbg (ANL, "'%s': %.2f LUFS, %.2f dBTP, audio %.2lfs - %.2lfs "
+        "of %.2lfs, took %.2lfs\n", file,
+        info.integrated_lufs, info.true_peak_dbtp,
+        info.cue_in_ns / (gdouble) GST_SECOND,
+        info.cue_out_ns / (gdouble) GST_SECOND,
+        info.duration_ns / (gdouble) GST_SECOND,
+        (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC);
+  } else if (bad) {
+    /* the player would fail on it too, keep it off the air */
+    midx_quarantine (file, mtime);
+  } else {
+    midx_store_failure (file);
+  }
+
+  loudness_meter_free (lm);
+  silence_detector_free (sd);
+}
+
+static gpointer
+analyzer_worker (struct analyzer * self)
+{
+  char *file;
+
+  analyzer_lower_thread_priority ();
+
+  while ((file = midx_wait_pending ()) != NULL) {
+    analyzer_process_file (self, file);
+    free (file);
+  }
+
+  return NULL;
+}
+
+int
+analyzer_init (struct analyzer * self, gint num_workers)
+{
+  gint i;
+
+  self->stopping = 0;
+  self->num_workers = 0;
+
+  if (num_workers <= 0) {
+    utils_info (ANL, "Media analysis disabled\n");
+    midx_disable_analysis ();
+    return 0;
+  }
+
+  self->workers = g_new0 (GThread *, num_workers);
+  for (i = 0; i < num_workers; i++)
+    self->workers[i] = g_thread_new ("analyzer",
+        (GThreadFunc) analyzer_worker, self);
+  self->num_workers = num_workers;
+
+  utils_dbg (ANL, "started %i analysis workers\n", num_workers);
+
+  return 0;
+}
+
+void
+analyzer_cleanup (struct analyzer * self)
+{
+  gint i;
+
+  g_atomic_int_set (&self->stopping, 1);
+  midx_cancel_wait ();
+
+  for (i = 0; i < self->num_workers; i++)
+    g_thread_join (self->workers[i]);
+
+  g_clear_pointer (&self->workers, g_free);
+  self->num_workers = 0;
+
+  utils_dbg (ANL, "analyzer destroyed\n");
+}
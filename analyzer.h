@@ -0,0 +1,43 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Offline media analyzer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ANALYZER_H__
+#define __ANALYZER_H__
+
+#include <gst/gst.h>
+
+struct analyzer
+{
+  GThread **workers;
+  gint num_workers;
+  gint stopping;
+
+  /* configuration */
+  gfloat lead_silence_db;
+  gfloat trail_silence_db;
+};
+
+int analyzer_init (struct analyzer * self, gint num_workers);
+void analyzer_cleanup (struct analyzer * self);
+
+/* also used by the transcoder's workers */
+void analyzer_lower_thread_priority (void);
+
+#endif /* __ANALYZER_H__ */
@@ -20,9 +20,12 @@
 
 #define _XOPEN_SOURCE		/* Needed for strptime() */
 #include "scheduler.h"
+#include "tracepoints.h"
+#include "tracer.h"
 #include "utils.h"
 #include <string.h>		/* For memset() / strncmp() */
 #include <time.h>		/* For strptime() and time() */
+#include <math.h>		/* For lroundf() */
 #include <signal.h>		/* For sig_atomic_t */
 #include <libxml/parser.h>	/* For parser context etc */
 #include <libxml/tree.h>	/* For grabbing stuff off the tree */
@@ -105,6 +108,24 @@ cfg_get_boolean(xmlDocPtr config, xmlNodePtr element)
 	return ret;
 }
 
+/* Durations are given in (decimal) seconds but
+ * we keep them in milliseconds from here on */
+static int
+cfg_get_duration_ms(xmlDocPtr config, xmlNodePtr element)
+{
+	float secs = cfg_get_float(config, element);
+	if(parser_failed)
+		return -1;
+
+	if(secs < 0) {
+		utils_err(CFG, "Got negative duration: %g\n", secs);
+		parser_failed = 1;
+		return -1;
+	}
+
+	return (int) lroundf(secs * 1000.0f);
+}
+
 static char*
 cfg_get_str_attr(xmlNodePtr element, const char* attr)
 {
@@ -161,18 +182,23 @@ cfg_get_fader(xmlDocPtr config, xmlNodePtr fdr_node)
 		return NULL;
 	}
 	memset(fdr, 0, sizeof(struct fader));
+	fdr->overlap_ms = -1;
 
 	/* Fill it up */
 	element = fdr_node->xmlChildrenNode;
 	while (element != NULL) {
 		if(!strncmp((const char*) element->name, "FadeInDurationSecs", 19))
-			fdr->fadein_duration_secs = cfg_get_integer(config, element);
+			fdr->fadein_duration_ms = cfg_get_duration_ms(config, element);
 		if(!strncmp((const char*) element->name, "FadeOutDurationSecs", 20))
-			fdr->fadeout_duration_secs = cfg_get_integer(config, element);
+			fdr->fadeout_duration_ms = cfg_get_duration_ms(config, element);
 		if(!strncmp((const char*) element->name, "MinLevel", 9))
 			fdr->min_lvl = cfg_get_float(config, element);
 		if(!strncmp((const char*) element->name, "MaxLevel", 9))
 			fdr->max_lvl = cfg_get_float(config, element);
+		if(!strncmp((const char*) element->name, "Gapless", 8))
+			fdr->gapless = cfg_get_boolean(config, element);
+		if(!strncmp((const char*) element->name, "OverlapSecs", 12))
+			fdr->overlap_ms = cfg_get_duration_ms(config, element);
 		if(parser_failed) {
 			utils_err(CFG, "Parsing of fader element failed\n");
 			parser_failed = 1;
@@ -181,21 +207,26 @@ cfg_get_fader(xmlDocPtr config, xmlNodePtr fdr_node)
 		element = element->next;
 	}
 
-	/* Sanity check, at least one duration field needs to be set,
-	 * note that fader is an optional element so failure here
-	 * should not be fatal */
-	if(!fdr->fadein_duration_secs || !fdr->fadeout_duration_secs) {
+	/* Sanity check, at least one duration field (or gapless
+	 * or the overlap) needs to be set, note that fader is an
+	 * optional element so failure here should not be fatal */
+	if(!fdr->fadein_duration_ms && !fdr->fadeout_duration_ms &&
+	   !fdr->gapless && fdr->overlap_ms < 0) {
 		utils_wrn(CFG, "Got empty fader element\n");
 		failed = 1;
 		goto cleanup;
 	}
 
-	utils_dbg(CFG, "Got fader\n\tFade in duration (secs): %i\n\t"
-			"Fade out duration (secs): %i\n\t"
+	utils_dbg(CFG, "Got fader\n\tFade in duration (ms): %i\n\t"
+			"Fade out duration (ms): %i\n\t"
 			"Minimum level: %g\n\t"
-			"Maximum level: %g\n",
-			fdr->fadein_duration_secs, fdr->fadeout_duration_secs,
-			fdr->min_lvl, fdr->max_lvl);
+			"Maximum level: %g\n\t"
+			"Gapless: %s\n\t"
+			"Overlap (ms): %i\n",
+			fdr->fadein_duration_ms, fdr->fadeout_duration_ms,
+			fdr->min_lvl, fdr->max_lvl,
+			fdr->gapless ? "true" : "false",
+			fdr->overlap_ms);
 
 cleanup:
 	if(parser_failed || failed) {
@@ -901,7 +932,9 @@ cleanup:
 	xmlCleanupParser();
 	if(parser_failed) {
 		ret = -1;
-		cfg_cleanup(cfg);
+		if(cfg->ws != NULL)
+			cfg_free_week_schedule(cfg->ws);
+		cfg->ws = NULL;
 	}
 	return ret;
 }
@@ -909,6 +942,10 @@ cleanup:
 int
 cfg_reload_if_needed(struct config *cfg)
 {
+	struct week_schedule *old_ws = NULL;
+	const char* filepath = cfg->filepath;
+	int ret = 0;
+	uint64_t trace_start = 0;
 	time_t mtime = utils_get_mtime(cfg->filepath);
 	if(!mtime) {
 		utils_err(CFG, "Unable to check mtime for %s\n", cfg->filepath);
@@ -921,7 +958,19 @@ cfg_reload_if_needed(struct config *cfg)
 
 	utils_info(CFG, "Got different mtime, reloading %s\n", cfg->filepath);
 
-	/* Re-load playlist */
-	cfg_cleanup(cfg);
-	return cfg_process(cfg);
+	/* Re-load config, cfg itself stays around, only the
+	 * week schedule is replaced. If the new one doesn't
+	 * parse keep using the old one. */
+	TRACE_RELOAD_START("config", filepath);
+	trace_start = tracer_begin();
+	old_ws = cfg->ws;
+	cfg->ws = NULL;
+	ret = cfg_process(cfg);
+	if(ret < 0)
+		cfg->ws = old_ws;
+	else if(old_ws != NULL)
+		cfg_free_week_schedule(old_ws);
+	tracer_end(trace_start, "config", "cfg_reload", filepath);
+	TRACE_RELOAD_END("config", filepath, ret);
+	return ret;
 }
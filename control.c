@@ -0,0 +1,443 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Control / introspection socket
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE       /* for accept4 */
+#include "control.h"
+#include "tracer.h"
+#include "utils.h"
+#include <glib-unix.h>    /* for g_unix_fd_add, g_unix_signal_add */
+#include <stdlib.h>       /* for free */
+#include <stdio.h>        /* for open_memstream */
+#include <sys/socket.h>   /* for socket, accept4, send */
+#include <sys/un.h>       /* for struct sockaddr_un */
+#include <sys/stat.h>     /* for lstat, chmod */
+#include <unistd.h>       /* for read, close, unlink */
+#include <string.h>       /* for strlen, strcmp */
+#include <errno.h>        /* for errno */
+#include <time.h>         /* for time */
+#include <signal.h>       /* for SIGUSR2 */
+
+/* it's for local tools, a handful of them is plenty */
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_LINE_MAX 256
+
+struct control_client
+{
+  struct control *control;
+  gint fd;
+  guint source_id;
+  GIOCondition condition;
+
+  /* the command being received */
+  gchar line[CONTROL_LINE_MAX];
+  gsize line_len;
+  gboolean overlong;
+
+  /* replies not sent yet; we stop reading until they are */
+  GString *out;
+  gsize out_off;
+  gboolean closing;
+};
+
+struct control_command
+{
+  const gchar *name;
+  const gchar *help;
+  void (*func) (struct control * self, FILE * out);
+};
+
+static void control_cmd_help (struct control * self, FILE * out);
+
+static void
+control_cmd_queue (struct control * self, FILE * out)
+{
+  player_dump (self->player, out);
+}
+
+static void
+control_cmd_playlists (struct control * self, FILE * out)
+{
+  sched_dump_playlists (self->scheduler, time (NULL), out);
+}
+
+static void
+control_cmd_decisions (struct control * self, FILE * out)
+{
+  sched_dump_decisions (self->scheduler, out);
+}
+
+static void
+control_cmd_caches (struct control * self, FILE * out)
+{
+  transcoder_dump (self->transcoder, out);
+  pcm_cache_dump (self->pcm_cache, out);
+}
+
+static void
+control_cmd_stats (struct control * self, FILE * out)
+{
+  if (stats_render (self->stats_buff, STATS_RENDER_LEN) < 0)
+    fprintf (out, "error\tstats didn't fit in the buffer\n");
+  else
+    fputs (self->stats_buff, out);
+}
+
+static void
+control_cmd_trace (struct control * self, FILE * out)
+{
+  if (tracer_dump (out) < 0)
+    fprintf (out, "error\ttracer is disabled or out of memory\n");
+}
+
+static const struct control_command control_commands[] = {
+  { "help", "this list", control_cmd_help },
+  { "queue", "play queue, spare item and item pool", control_cmd_queue },
+  { "playlists", "today's zones and playlist cursors",
+    control_cmd_playlists },
+  { "decisions", "last scheduler decisions, oldest first",
+    control_cmd_decisions },
+  { "caches", "transcode and PCM cache usage", control_cmd_caches },
+  { "stats", "counters and histograms, as in /metrics", control_cmd_stats },
+  { "trace", "recent events as Chrome trace JSON, on a single line",
+    control_cmd_trace },
+  { "quit", "close the connection", NULL },
+};
+
+static void
+control_cmd_help (struct control * self, FILE * out)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (control_commands); i++)
+    fprintf (out, "command\tname=%s\thelp=%s\n", control_commands[i].name,
+        control_commands[i].help);
+}
+
+static void
+control_client_free (struct control_client * cl)
+{
+  struct control *self = cl->control;
+
+  self->clients = g_list_remove (self->clients, cl);
+  if (cl->source_id)
+    g_source_remove (cl->source_id);
+  close (cl->fd);
+  g_string_free (cl->out, TRUE);
+  g_free (cl);
+}
+
+static void
+control_client_run (struct control_client * cl, gchar * line)
+{
+  struct control *self = cl->control;
+  const struct control_command *cmd = NULL;
+  gchar *reply = NULL;
+  gsize reply_len = 0;
+  FILE *out;
+  guint i;
+
+  g_strstrip (line);
+  if (!line[0])
+    return;
+
+  for (i = 0; i < G_N_ELEMENTS (control_commands); i++) {
+    if (!strcmp (line, control_commands[i].name)) {
+      cmd = &control_commands[i];
+      break;
+    }
+  }
+
+  if (cmd && !cmd->func) {
+    cl->closing = TRUE;
+    return;
+  }
+
+  out = open_memstream (&reply, &reply_len);
+  if (!out) {
+    utils_perr (CTL, "Could not allocate reply");
+    cl->closing = TRUE;
+    return;
+  }
+
+  if (cmd) {
+    cmd->func (self, out);
+    stats_counter_add (&self->commands, 1);
+  } else
+    fprintf (out, "error\tunknown command '%s', try 'help'\n", line);
+  fputs (".\n", out);
+  fclose (out);
+
+  g_string_append_len (cl->out, reply, reply_len);
+  free (reply);
+}
+
+/* returns FALSE when the client went away */
+static gboolean
+control_client_read (struct control_client * cl)
+{
+  gchar buf[CONTROL_LINE_MAX];
+  gssize ret;
+  gssize i;
+
+  ret = read (cl->fd, buf, sizeof (buf));
+  if (ret < 0)
+    return errno == EAGAIN || errno == EINTR;
+  if (ret == 0)
+    return FALSE;
+
+  for (i = 0; i < ret; i++) {
+    if (buf[i] == '\n') {
+      cl->line[cl->line_len] = '\0';
+      if (cl->overlong)
+        g_string_append (cl->out, "error\tcommand too long\n.\n");
+      else
+        control_client_run (cl, cl->line);
+      cl->line_len = 0;
+      cl->overlong = FALSE;
+      if (cl->closing)
+        break;
+    } else if (cl->line_len < CONTROL_LINE_MAX - 1)
+      cl->line[cl->line_len++] = buf[i];
+    else
+      cl->overlong = TRUE;
+  }
+
+  return TRUE;
+}
+
+/* returns FALSE on error */
+static gboolean
+control_client_flush (struct control_client * cl)
+{
+  gssize ret;
+
+  while (cl->out_off < cl->out->len) {
+    ret = send (cl->fd, cl->out->str + cl->out_off,
+        cl->out->len - cl->out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (ret < 0)
+      return errno == EAGAIN || errno == EINTR;
+    cl->out_off += ret;
+  }
+
+  g_string_truncate (cl->out, 0);
+  cl->out_off = 0;
+  return TRUE;
+}
+
+static gboolean
+control_client_io (gint fd, GIOCondition condition, struct control_client * cl)
+{
+  GIOCondition wanted;
+
+  if (condition & G_IO_ERR)
+    goto close;
+
+  if ((condition & (G_IO_IN | G_IO_HUP)) && !control_client_read (cl))
+    goto close;
+
+  if (!control_client_flush (cl))
+    goto close;
+
+  if (cl->out->len)
+    wanted = G_IO_OUT;
+  else if (cl->closing)
+    goto close;
+  else
+    wanted = G_IO_IN;
+
+  if (wanted == cl->condition)
+    return G_SOURCE_CONTINUE;
+
+  /* the condition of a unix fd source can't be changed, swap it */
+  cl->condition = wanted;
+  cl->source_id = g_unix_fd_add (cl->fd, wanted,
+      (GUnixFDSourceFunc) control_client_io, cl);
+  return G_SOURCE_REMOVE;
+
+close:
+  /* the source goes away when we return */
+  cl->source_id = 0;
+  control_client_free (cl);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+control_accept (gint fd, GIOCondition condition, struct control * self)
+{
+  struct control_client *cl;
+  gint client_fd;
+
+  while ((client_fd = accept4 (self->sockfd, NULL, NULL,
+              SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    if (g_list_length (self->clients) >= CONTROL_MAX_CLIENTS) {
+      utils_wrn (CTL, "Too many control clients, dropping one\n");
+      close (client_fd);
+      continue;
+    }
+
+    cl = g_new0 (struct control_client, 1);
+    cl->control = self;
+    cl->fd = client_fd;
+    cl->out = g_string_new (NULL);
+    cl->condition = G_IO_IN;
+    cl->source_id = g_unix_fd_add (client_fd, cl->condition,
+        (GUnixFDSourceFunc) control_client_io, cl);
+    self->clients = g_list_prepend (self->clients, cl);
+
+    utils_dbg (CTL, "control client connected\n");
+  }
+
+  if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+    utils_pwrn (CTL, "accept() failed");
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+control_trace_signal (struct control * self)
+{
+  tracer_dump_file (self->trace_path ? self->trace_path : TRACER_DEFAULT_FILE);
+  return G_SOURCE_CONTINUE;
+}
+
+/* a socket left over from a previous run is removed, one that somebody
+ * still answers on means there is another instance running */
+static int
+control_check_stale (struct control * self, struct sockaddr_un * addr)
+{
+  struct stat st;
+  gint fd;
+  gint ret;
+
+  if (lstat (self->path, &st) < 0)
+    return 0;
+
+  if (!S_ISSOCK (st.st_mode)) {
+    utils_err (CTL, "%s exists and is not a socket\n", self->path);
+    return -1;
+  }
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  ret = connect (fd, (struct sockaddr *) addr, sizeof (*addr));
+  close (fd);
+
+  if (ret == 0) {
+    utils_err (CTL, "%s is in use by another instance\n", self->path);
+    return -1;
+  }
+
+  unlink (self->path);
+  return 0;
+}
+
+int
+control_init (struct control * self, struct player * player,
+    struct scheduler * scheduler, struct transcoder * transcoder,
+    struct pcm_cache * pcm_cache)
+{
+  struct sockaddr_un addr = { 0 };
+
+  self->player = player;
+  self->scheduler = scheduler;
+  self->transcoder = transcoder;
+  self->pcm_cache = pcm_cache;
+  self->sockfd = -1;
+
+  stats_counter_register (&self->commands, "control_commands",
+      "Commands served on the control socket");
+
+  /* works without the socket too */
+  if (tracer_enabled)
+    self->signal_id = g_unix_signal_add (SIGUSR2,
+        (GSourceFunc) control_trace_signal, self);
+
+  if (!self->path) {
+    utils_dbg (CTL, "control socket disabled\n");
+    return 0;
+  }
+
+  if (strlen (self->path) >= sizeof (addr.sun_path)) {
+    utils_err (CTL, "control socket path too long: %s\n", self->path);
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, self->path);
+
+  if (control_check_stale (self, &addr) < 0)
+    return -1;
+
+  self->sockfd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+      0);
+  if (self->sockfd < 0) {
+    utils_perr (CTL, "Could not create control socket");
+    return -1;
+  }
+
+  if (bind (self->sockfd, (struct sockaddr *) &addr, sizeof (addr)) < 0) {
+    utils_perr (CTL, "Could not bind control socket to %s", self->path);
+    goto fail;
+  }
+
+  /* it shows what we play and from where, keep it to our group */
+  chmod (self->path, 0660);
+
+  if (listen (self->sockfd, CONTROL_MAX_CLIENTS) < 0) {
+    utils_perr (CTL, "Could not listen on control socket");
+    unlink (self->path);
+    goto fail;
+  }
+
+  self->stats_buff = g_malloc (STATS_RENDER_LEN);
+  self->source_id = g_unix_fd_add (self->sockfd, G_IO_IN,
+      (GUnixFDSourceFunc) control_accept, self);
+
+  utils_dbg (CTL, "control socket listening on %s\n", self->path);
+  return 0;
+
+fail:
+  close (self->sockfd);
+  self->sockfd = -1;
+  return -1;
+}
+
+void
+control_cleanup (struct control * self)
+{
+  while (self->clients)
+    control_client_free (self->clients->data);
+
+  if (self->source_id)
+    g_source_remove (self->source_id);
+  self->source_id = 0;
+
+  if (self->signal_id)
+    g_source_remove (self->signal_id);
+  self->signal_id = 0;
+
+  if (self->sockfd > 0) {
+    close (self->sockfd);
+    unlink (self->path);
+  }
+  self->sockfd = -1;
+
+  g_clear_pointer (&self->stats_buff, g_free);
+}
@@ -0,0 +1,69 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Control / introspection socket
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include "player.h"
+#include "scheduler.h"
+#include "transcoder.h"
+#include "pcm_cache.h"
+#include "stats.h"
+#include <glib.h>
+
+/* A UNIX socket for local tooling, served from the main loop so that
+ * the play queue and the playlists can be looked at without locking.
+ *
+ * The protocol is line based: the client sends a command per line
+ * ("help" lists them), the reply is one record per line, tab separated,
+ * the record type first and key=value pairs after it, terminated by
+ * a line with a single ".". Errors are a single "error\t<message>"
+ * record, terminated the same way. */
+
+struct control
+{
+  /* configuration; a NULL path disables the control socket */
+  gchar *path;
+  /* where the tracer gets dumped on SIGUSR2 */
+  gchar *trace_path;
+
+  /* external objects */
+  struct player *player;
+  struct scheduler *scheduler;
+  struct transcoder *transcoder;
+  struct pcm_cache *pcm_cache;
+
+  /* internal */
+  gint sockfd;
+  guint source_id;
+  GList *clients;
+  gchar *stats_buff;
+  guint signal_id;
+
+  /* statistics */
+  struct stats_counter commands;
+};
+
+int control_init (struct control * self, struct player * player,
+    struct scheduler * scheduler, struct transcoder * transcoder,
+    struct pcm_cache * pcm_cache);
+void control_cleanup (struct control * self);
+
+#endif /* __CONTROL_H__ */
@@ -0,0 +1,402 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Per-element pipeline statistics
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "element_stats.h"
+#include "stats.h"
+#include "utils.h"
+#include <string.h>   /* for strcmp */
+#include <time.h>     /* for clock_gettime */
+
+/* pushes nest, one per element a buffer goes through on the same thread */
+#define ELEMENT_STATS_DEPTH 16
+
+enum element_role
+{
+  ROLE_NONE = -1,
+  ROLE_DECODE = 0,
+  ROLE_MIXER,
+  ROLE_CONVERT,
+  ROLE_RESAMPLE,
+  ROLE_SINK,
+  ROLE_COUNT,
+};
+
+struct element_role_stats
+{
+  const gchar *cpu_name;
+  const gchar *cpu_help;
+  const gchar *cpu_total_name;
+  const gchar *cpu_total_help;
+  const gchar *buffers_name;
+  const gchar *buffers_help;
+
+  struct stats_hist cpu;
+  struct stats_counter cpu_total;
+  struct stats_counter buffers;
+};
+
+#define ROLE_STATS(role, what) \
+  { "element_" role "_cpu", "CPU time per buffer in " what, \
+    "element_" role "_cpu_usecs", "CPU time spent in " what ", us", \
+    "element_" role "_buffers", "Buffers that went through " what }
+
+static struct element_role_stats role_stats[ROLE_COUNT] = {
+  [ROLE_DECODE] = ROLE_STATS ("decode", "the item bins"),
+  [ROLE_MIXER] = ROLE_STATS ("mixer", "the mixer"),
+  [ROLE_CONVERT] = ROLE_STATS ("convert", "the output audioconvert"),
+  [ROLE_RESAMPLE] = ROLE_STATS ("resample", "the output audioresample"),
+  [ROLE_SINK] = ROLE_STATS ("sink", "the audio sink"),
+};
+
+/* where a streaming thread is; the item is only set for ROLE_DECODE,
+ * timed is unset for pushes between elements we don't track */
+struct element_frame
+{
+  gint role;
+  struct play_queue_item *item;
+  gboolean timed;
+};
+
+/* only ever touched by its own thread */
+struct element_thread
+{
+  struct element_frame stack[ELEMENT_STATS_DEPTH];
+  guint depth;
+  guint64 last_cpu;
+  guint64 pending_cpu[ROLE_COUNT];
+  GstClockTime mixer_out;
+};
+
+static __thread struct element_thread element_thread;
+
+static struct
+{
+  gint active;
+  GstElement *pipeline;
+  GstElement *elements[ROLE_COUNT];
+  GQuark item_quark;
+  GstTracer *tracer;
+
+  struct stats_hist path_latency;
+  struct stats_hist item_decode_cpu;
+} element_stats;
+
+static guint64
+element_stats_thread_cpu (void)
+{
+  struct timespec ts = { 0 };
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (guint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/* figures out the top-level element of the pipeline an object is in;
+ * the parents don't change while buffers flow, no need to lock */
+static void
+element_stats_classify (GstObject * object, struct element_frame * frame)
+{
+  GstObject *parent = NULL;
+  gint i;
+
+  frame->role = ROLE_NONE;
+  frame->item = NULL;
+
+  while (object && (parent = GST_OBJECT_PARENT (object)) &&
+      parent != GST_OBJECT (element_stats.pipeline))
+    object = parent;
+
+  /* some other pipeline, e.g. the analyzer's */
+  if (!object || !parent)
+    return;
+
+  for (i = ROLE_MIXER; i < ROLE_COUNT; i++) {
+    if (object == GST_OBJECT (element_stats.elements[i])) {
+      frame->role = i;
+      return;
+    }
+  }
+
+  frame->item = g_object_get_qdata (G_OBJECT (object),
+      element_stats.item_quark);
+  if (frame->item)
+    frame->role = ROLE_DECODE;
+}
+
+static void
+element_stats_charge (struct element_frame * frame, guint64 cpu)
+{
+  if (frame->role == ROLE_NONE)
+    return;
+
+  element_thread.pending_cpu[frame->role] += cpu;
+  stats_counter_add (&role_stats[frame->role].cpu_total, cpu);
+  if (frame->item)
+    __atomic_add_fetch (&frame->item->decode_cpu_us, cpu, __ATOMIC_RELAXED);
+}
+
+/* a buffer is done with an element, what it cost goes to the histogram */
+static void
+element_stats_buffer_done (gint role)
+{
+  stats_hist_add (&role_stats[role].cpu, element_thread.pending_cpu[role]);
+  stats_counter_add (&role_stats[role].buffers, 1);
+  element_thread.pending_cpu[role] = 0;
+}
+
+/* pad-push-pre and pad-push-list-pre */
+static void
+element_stats_push_pre (GObject * tracer, GstClockTime ts, GstPad * pad,
+    gpointer data)
+{
+  struct element_thread *thread = &element_thread;
+  struct element_frame src, dst;
+  GstPad *peer;
+  guint64 now;
+
+  if (!g_atomic_int_get (&element_stats.active))
+    return;
+
+  element_stats_classify (GST_OBJECT (pad), &src);
+  peer = GST_PAD_PEER (pad);
+  element_stats_classify (peer ? GST_OBJECT (peer) : NULL, &dst);
+
+  /* neither side is ours (e.g. the analyzer's pipelines), there is
+   * nothing to charge until the push returns, skip the clock read;
+   * the frame is still pushed so that push_post() stays balanced */
+  dst.timed = (src.role != ROLE_NONE || dst.role != ROLE_NONE);
+  if (!dst.timed) {
+    if (thread->depth < ELEMENT_STATS_DEPTH)
+      thread->stack[thread->depth] = dst;
+    thread->depth++;
+    thread->last_cpu = 0;
+    return;
+  }
+
+  now = element_stats_thread_cpu ();
+
+  /* whoever pushes has been running since the last hook */
+  if (thread->last_cpu)
+    element_stats_charge (&src, now - thread->last_cpu);
+
+  if (src.role != dst.role) {
+    if (src.role != ROLE_NONE && src.role != ROLE_SINK)
+      element_stats_buffer_done (src.role);
+
+    if (src.role == ROLE_MIXER)
+      thread->mixer_out = ts;
+
+    if (dst.role == ROLE_SINK && thread->mixer_out) {
+      stats_hist_add (&element_stats.path_latency,
+          GST_TIME_AS_USECONDS (ts - thread->mixer_out));
+      thread->mixer_out = 0;
+    }
+  }
+
+  if (thread->depth < ELEMENT_STATS_DEPTH)
+    thread->stack[thread->depth] = dst;
+  thread->depth++;
+  thread->last_cpu = now;
+}
+
+/* pad-push-post and pad-push-list-post */
+static void
+element_stats_push_post (GObject * tracer, GstClockTime ts, GstPad * pad,
+    GstFlowReturn res)
+{
+  struct element_thread *thread = &element_thread;
+  struct element_frame *done;
+  guint64 now;
+
+  if (!g_atomic_int_get (&element_stats.active))
+    return;
+
+  /* the push started before we were installed */
+  if (!thread->depth) {
+    thread->last_cpu = element_stats_thread_cpu ();
+    return;
+  }
+
+  /* the element the push went into is returning */
+  thread->depth--;
+  done = thread->depth < ELEMENT_STATS_DEPTH ?
+      &thread->stack[thread->depth] : NULL;
+
+  /* back to an element we don't track either, see push_pre() */
+  if (done && !done->timed) {
+    thread->last_cpu = 0;
+    return;
+  }
+
+  now = element_stats_thread_cpu ();
+
+  if (done) {
+    if (thread->last_cpu)
+      element_stats_charge (done, now - thread->last_cpu);
+
+    /* nothing comes out of the sink, it's done when it returns */
+    if (done->role == ROLE_SINK && (!thread->depth ||
+            thread->stack[thread->depth - 1].role != ROLE_SINK))
+      element_stats_buffer_done (ROLE_SINK);
+  }
+
+  thread->last_cpu = now;
+}
+
+/*
+ * Tracer
+ */
+
+typedef struct
+{
+  GstTracer parent;
+} ElementStatsTracer;
+
+typedef struct
+{
+  GstTracerClass parent_class;
+} ElementStatsTracerClass;
+
+GType element_stats_tracer_get_type (void);
+G_DEFINE_TYPE (ElementStatsTracer, element_stats_tracer, GST_TYPE_TRACER);
+
+static void
+element_stats_tracer_class_init (ElementStatsTracerClass * klass)
+{
+}
+
+static void
+element_stats_tracer_init (ElementStatsTracer * self)
+{
+  GstTracer *tracer = GST_TRACER (self);
+
+  gst_tracing_register_hook (tracer, "pad-push-pre",
+      G_CALLBACK (element_stats_push_pre));
+  gst_tracing_register_hook (tracer, "pad-push-post",
+      G_CALLBACK (element_stats_push_post));
+  gst_tracing_register_hook (tracer, "pad-push-list-pre",
+      G_CALLBACK (element_stats_push_pre));
+  gst_tracing_register_hook (tracer, "pad-push-list-post",
+      G_CALLBACK (element_stats_push_post));
+}
+
+/*
+ * Entry points
+ */
+
+/* the element that the src pad of element is linked to */
+static GstElement *
+element_stats_downstream (GstElement * element)
+{
+  GstElement *next = NULL;
+  GstPad *src, *peer;
+
+  src = gst_element_get_static_pad (element, "src");
+  if (!src)
+    return NULL;
+
+  peer = gst_pad_get_peer (src);
+  if (peer) {
+    next = gst_pad_get_parent_element (peer);
+    gst_object_unref (peer);
+  }
+  gst_object_unref (src);
+
+  /* the pipeline holds on to it */
+  if (next)
+    gst_object_unref (next);
+  return next;
+}
+
+gint
+element_stats_init (struct player * player)
+{
+  GstElementFactory *factory;
+  GstElement *element;
+  const gchar *name;
+  gint i;
+
+  element_stats.pipeline = player->pipeline;
+  element_stats.elements[ROLE_MIXER] = player->mixer;
+  element_stats.elements[ROLE_SINK] = player->sink;
+  element_stats.item_quark = g_quark_from_static_string (ELEMENT_STATS_ITEM_KEY);
+
+  /* whatever is between the mixer and the sink, the caps filter
+   * that pins the mix format doesn't do anything worth counting */
+  element = player->mixer;
+  while ((element = element_stats_downstream (element)) &&
+      element != player->sink) {
+    factory = gst_element_get_factory (element);
+    name = factory ? gst_plugin_feature_get_name (factory) : "";
+    if (!strcmp (name, "audioconvert"))
+      element_stats.elements[ROLE_CONVERT] = element;
+    else if (!strcmp (name, "audioresample"))
+      element_stats.elements[ROLE_RESAMPLE] = element;
+  }
+
+  for (i = 0; i < ROLE_COUNT; i++) {
+    stats_hist_register (&role_stats[i].cpu, role_stats[i].cpu_name,
+        role_stats[i].cpu_help, "us");
+    stats_counter_register (&role_stats[i].cpu_total,
+        role_stats[i].cpu_total_name, role_stats[i].cpu_total_help);
+    stats_counter_register (&role_stats[i].buffers,
+        role_stats[i].buffers_name, role_stats[i].buffers_help);
+  }
+  stats_hist_register (&element_stats.path_latency, "element_path_latency",
+      "Time from the mixer's output to the sink's input", "us");
+  stats_hist_register (&element_stats.item_decode_cpu, "item_decode_cpu",
+      "Decoding CPU time per second of audio, per item", "us");
+
+  element_stats.tracer = g_object_new (element_stats_tracer_get_type (),
+      NULL);
+  g_atomic_int_set (&element_stats.active, 1);
+
+  utils_dbg (PLR, "element stats enabled\n");
+  return 0;
+}
+
+void
+element_stats_cleanup (void)
+{
+  /* the hooks stay registered with the tracer, for as long as
+   * the process runs, they just stop doing anything */
+  g_atomic_int_set (&element_stats.active, 0);
+}
+
+void
+element_stats_item_done (struct play_queue_item * item)
+{
+  guint64 cpu, samples;
+
+  if (!g_atomic_int_get (&element_stats.active))
+    return;
+
+  cpu = __atomic_load_n (&item->decode_cpu_us, __ATOMIC_RELAXED);
+  if (item->played_end_sample <= item->start_sample || !cpu)
+    return;
+
+  /* per second of audio, so that long and short files compare */
+  samples = item->played_end_sample - item->start_sample;
+  stats_hist_add (&element_stats.item_decode_cpu,
+      gst_util_uint64_scale (cpu, item->player->mix_rate, samples));
+
+  utils_dbg (PLR, "item %p: decoding took %" G_GUINT64_FORMAT "us of CPU "
+      "for %" G_GUINT64_FORMAT " samples: %s\n", item, cpu, samples,
+      item->file);
+}
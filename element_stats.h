@@ -0,0 +1,45 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Per-element pipeline statistics
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ELEMENT_STATS_H__
+#define __ELEMENT_STATS_H__
+
+#include "player.h"
+
+/* A GstTracer on the player's pipeline: the CPU time of every streaming
+ * thread is charged to the top-level element it is running in (the item
+ * bins count as "decode", then mixer, convert, resample and sink), along
+ * with how many buffers go through each and how long a buffer takes from
+ * the mixer to the sink. Everything ends up in the stats, and each item
+ * keeps its own decoding cost, to tell which files are expensive.
+ *
+ * Every pad push in the process goes through the tracer's hooks once it
+ * is installed, and they can't be removed, so this is opt-in. */
+
+/* the bin's "play-queue-item" data points back to its item */
+#define ELEMENT_STATS_ITEM_KEY "play-queue-item"
+
+gint element_stats_init (struct player * player);
+void element_stats_cleanup (void);
+
+/* accounts the decoding cost of an item that is done */
+void element_stats_item_done (struct play_queue_item * item);
+
+#endif /* __ELEMENT_STATS_H__ */
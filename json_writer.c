@@ -0,0 +1,423 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Streaming JSON writer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "json_writer.h"
+#include <stdlib.h>	/* For realloc() / free() */
+#include <string.h>	/* For memset() / memcpy() / strlen() */
+#if defined(__SSE2__)
+#include <emmintrin.h>	/* For SSE2 intrinsics */
+#endif
+
+/*********\
+* HELPERS *
+\*********/
+
+/* Makes room for len more bytes, plus the terminating NUL */
+static int
+json_reserve(struct json_writer *jw, size_t len)
+{
+	size_t size = 0;
+	char* buf = NULL;
+
+	if(jw->failed)
+		return -1;
+
+	if(jw->len + len + 1 <= jw->size)
+		return 0;
+
+	size = jw->size ? jw->size : 256;
+	while(size < jw->len + len + 1)
+		size *= 2;
+
+	buf = realloc(jw->buf, size);
+	if(!buf) {
+		jw->failed = 1;
+		return -1;
+	}
+	jw->buf = buf;
+	jw->size = size;
+	return 0;
+}
+
+static inline void
+json_put(struct json_writer *jw, const char* data, size_t len)
+{
+	if(json_reserve(jw, len) < 0)
+		return;
+	memcpy(jw->buf + jw->len, data, len);
+	jw->len += len;
+}
+
+static inline void
+json_putc(struct json_writer *jw, char c)
+{
+	if(json_reserve(jw, 1) < 0)
+		return;
+	jw->buf[jw->len++] = c;
+}
+
+static void
+json_newline(struct json_writer *jw)
+{
+	int i = 0;
+
+	if(json_reserve(jw, jw->depth + 1) < 0)
+		return;
+	jw->buf[jw->len++] = '\n';
+	for(i = 0; i < jw->depth; i++)
+		jw->buf[jw->len++] = '\t';
+}
+
+/* Comma and indentation before a key, or a value that
+ * doesn't follow a key */
+static void
+json_before_value(struct json_writer *jw)
+{
+	uint32_t bit = 1U << jw->depth;
+
+	if(jw->after_key) {
+		jw->after_key = 0;
+		return;
+	}
+
+	if(!jw->depth)
+		return;
+
+	if(!(jw->empty & bit))
+		json_putc(jw, ',');
+	jw->empty &= ~bit;
+
+	if(jw->pretty)
+		json_newline(jw);
+}
+
+static void
+json_begin(struct json_writer *jw, char c)
+{
+	json_before_value(jw);
+	json_putc(jw, c);
+
+	if(jw->depth + 1 >= JSON_MAX_DEPTH) {
+		jw->failed = 1;
+		return;
+	}
+	jw->depth++;
+	jw->empty |= 1U << jw->depth;
+}
+
+static void
+json_end(struct json_writer *jw, char c)
+{
+	uint32_t bit = 1U << jw->depth;
+	int was_empty = jw->empty & bit;
+
+	if(!jw->depth) {
+		jw->failed = 1;
+		return;
+	}
+	jw->empty &= ~bit;
+	jw->depth--;
+
+	if(jw->pretty && !was_empty)
+		json_newline(jw);
+	json_putc(jw, c);
+}
+
+static inline int
+json_needs_escape(unsigned char c)
+{
+	return c < 0x20 || c == '"' || c == '\\';
+}
+
+#define JSON_ONES	0x0101010101010101ULL
+#define JSON_HIGHS	0x8080808080808080ULL
+
+/* Returns the offset of the first byte that needs escaping
+ * (control characters, '"' and '\'), or len if there's none.
+ * This is what almost all the time goes to for tag data that
+ * doesn't need any escaping, so look at 16 bytes at a time
+ * with SSE2, or 8 at a time on anything else. */
+static size_t
+json_scan(const char* str, size_t len)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i ctrl = _mm_set1_epi8(0x1F);
+	__m128i v;
+	__m128i m;
+	int mask = 0;
+
+	for(; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) (str + i));
+		/* There's no unsigned compare, v <= 0x1F is
+		 * the same as max(v, 0x1F) == 0x1F */
+		m = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl);
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bslash));
+		mask = _mm_movemask_epi8(m);
+		if(mask)
+			return i + __builtin_ctz(mask);
+	}
+#else
+	uint64_t w = 0;
+	uint64_t q = 0;
+	uint64_t b = 0;
+	uint64_t hit = 0;
+
+	for(; i + 8 <= len; i += 8) {
+		memcpy(&w, str + i, 8);
+		q = w ^ (JSON_ONES * '"');
+		b = w ^ (JSON_ONES * '\\');
+		/* A byte is zero (or below 0x20) if subtracting
+		 * borrows into its high bit, ignoring bytes that
+		 * had it set already */
+		hit = ((w - JSON_ONES * 0x20) & ~w) |
+		      ((q - JSON_ONES) & ~q) |
+		      ((b - JSON_ONES) & ~b);
+		if(hit & JSON_HIGHS)
+			break;
+	}
+	/* Found in this word, the loop below tells where */
+#endif
+	for(; i < len; i++)
+		if(json_needs_escape((unsigned char) str[i]))
+			return i;
+
+	return len;
+}
+
+static void
+json_escape(struct json_writer *jw, unsigned char c)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6] = {'\\', 'u', '0', '0', 0, 0};
+
+	switch(c) {
+	case '"':
+		json_put(jw, "\\\"", 2);
+		return;
+	case '\\':
+		json_put(jw, "\\\\", 2);
+		return;
+	case '\b':
+		json_put(jw, "\\b", 2);
+		return;
+	case '\f':
+		json_put(jw, "\\f", 2);
+		return;
+	case '\n':
+		json_put(jw, "\\n", 2);
+		return;
+	case '\r':
+		json_put(jw, "\\r", 2);
+		return;
+	case '\t':
+		json_put(jw, "\\t", 2);
+		return;
+	default:
+		esc[4] = hex[c >> 4];
+		esc[5] = hex[c & 0xF];
+		json_put(jw, esc, 6);
+		return;
+	}
+}
+
+static void
+json_put_uint(struct json_writer *jw, uint64_t val)
+{
+	char digits[20];
+	int i = sizeof(digits);
+
+	do {
+		digits[--i] = '0' + (val % 10);
+		val /= 10;
+	} while(val);
+
+	json_put(jw, digits + i, sizeof(digits) - i);
+}
+
+
+/**************\
+* ENTRY POINTS *
+\**************/
+
+void
+json_init(struct json_writer *jw, int pretty)
+{
+	memset(jw, 0, sizeof(struct json_writer));
+	jw->pretty = pretty;
+}
+
+void
+json_free(struct json_writer *jw)
+{
+	free(jw->buf);
+	memset(jw, 0, sizeof(struct json_writer));
+}
+
+void
+json_reset(struct json_writer *jw)
+{
+	jw->len = 0;
+	jw->failed = 0;
+	jw->depth = 0;
+	jw->empty = 0;
+	jw->after_key = 0;
+}
+
+int
+json_finish(struct json_writer *jw)
+{
+	if(jw->failed || jw->depth || json_reserve(jw, 0) < 0)
+		return -1;
+
+	jw->buf[jw->len] = '\0';
+	return (int) jw->len;
+}
+
+void
+json_begin_object(struct json_writer *jw)
+{
+	json_begin(jw, '{');
+}
+
+void
+json_end_object(struct json_writer *jw)
+{
+	json_end(jw, '}');
+}
+
+void
+json_begin_array(struct json_writer *jw)
+{
+	json_begin(jw, '[');
+}
+
+void
+json_end_array(struct json_writer *jw)
+{
+	json_end(jw, ']');
+}
+
+void
+json_key(struct json_writer *jw, const char* key)
+{
+	json_string(jw, key);
+	if(jw->pretty)
+		json_put(jw, ": ", 2);
+	else
+		json_putc(jw, ':');
+	jw->after_key = 1;
+}
+
+void
+json_string_len(struct json_writer *jw, const char* str, size_t len)
+{
+	size_t run = 0;
+
+	json_before_value(jw);
+
+	/* Enough for the usual case of nothing to escape */
+	if(json_reserve(jw, len + 2) < 0)
+		return;
+	jw->buf[jw->len++] = '"';
+
+	while(len) {
+		run = json_scan(str, len);
+		json_put(jw, str, run);
+		if(run == len)
+			break;
+		json_escape(jw, (unsigned char) str[run]);
+		str += run + 1;
+		len -= run + 1;
+	}
+
+	json_putc(jw, '"');
+}
+
+void
+json_string(struct json_writer *jw, const char* str)
+{
+	json_string_len(jw, str, str ? strlen(str) : 0);
+}
+
+void
+json_uint(struct json_writer *jw, uint64_t val)
+{
+	json_before_value(jw);
+	json_put_uint(jw, val);
+}
+
+void
+json_int(struct json_writer *jw, int64_t val)
+{
+	json_before_value(jw);
+	if(val < 0) {
+		json_putc(jw, '-');
+		json_put_uint(jw, -(uint64_t) val);
+	} else
+		json_put_uint(jw, val);
+}
+
+void
+json_bool(struct json_writer *jw, int val)
+{
+	json_before_value(jw);
+	if(val)
+		json_put(jw, "true", 4);
+	else
+		json_put(jw, "false", 5);
+}
+
+void
+json_raw(struct json_writer *jw, const char* data, size_t len)
+{
+	json_put(jw, data, len);
+}
+
+void
+json_kv_string(struct json_writer *jw, const char* key, const char* str)
+{
+	json_key(jw, key);
+	json_string(jw, str);
+}
+
+void
+json_kv_uint(struct json_writer *jw, const char* key, uint64_t val)
+{
+	json_key(jw, key);
+	json_uint(jw, val);
+}
+
+void
+json_kv_int(struct json_writer *jw, const char* key, int64_t val)
+{
+	json_key(jw, key);
+	json_int(jw, val);
+}
+
+void
+json_kv_bool(struct json_writer *jw, const char* key, int val)
+{
+	json_key(jw, key);
+	json_bool(jw, val);
+}
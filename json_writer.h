@@ -0,0 +1,78 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Streaming JSON writer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __JSON_WRITER_H__
+#define __JSON_WRITER_H__
+
+#include <stdint.h>	/* For typed ints */
+#include <stddef.h>	/* For size_t */
+
+/* Writes JSON straight into a buffer that grows as needed and is
+ * kept around between documents, commas (and indentation, if
+ * pretty) are taken care of. Strings must be valid UTF-8, they
+ * are only escaped where JSON requires it. If an allocation
+ * fails the rest of the document is dropped and json_finish()
+ * returns -1. */
+
+#define JSON_MAX_DEPTH	16
+
+struct json_writer {
+	char*	buf;
+	size_t	len;
+	size_t	size;
+	int	pretty;
+	int	failed;
+	int	depth;
+	/* Set while the container at depth i is still empty */
+	uint32_t empty;
+	/* Next value goes right after a key */
+	int	after_key;
+};
+
+void json_init(struct json_writer *jw, int pretty);
+void json_free(struct json_writer *jw);
+
+/* Starts a new document on the same buffer */
+void json_reset(struct json_writer *jw);
+/* Returns the length of the document in jw->buf (also
+ * NUL-terminated), or -1 if something went wrong */
+int json_finish(struct json_writer *jw);
+
+void json_begin_object(struct json_writer *jw);
+void json_end_object(struct json_writer *jw);
+void json_begin_array(struct json_writer *jw);
+void json_end_array(struct json_writer *jw);
+
+void json_key(struct json_writer *jw, const char* key);
+void json_string(struct json_writer *jw, const char* str);
+void json_string_len(struct json_writer *jw, const char* str, size_t len);
+void json_uint(struct json_writer *jw, uint64_t val);
+void json_int(struct json_writer *jw, int64_t val);
+void json_bool(struct json_writer *jw, int val);
+/* Copied as is, e.g. a trailing newline */
+void json_raw(struct json_writer *jw, const char* data, size_t len);
+
+/* Key / value pairs, for the common case */
+void json_kv_string(struct json_writer *jw, const char* key, const char* str);
+void json_kv_uint(struct json_writer *jw, const char* key, uint64_t val);
+void json_kv_int(struct json_writer *jw, const char* key, int64_t val);
+void json_kv_bool(struct json_writer *jw, const char* key, int val);
+
+#endif /* __JSON_WRITER_H__ */
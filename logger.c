@@ -0,0 +1,572 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Asynchronous log writer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE	/* For the GNU strerror_r() */
+#include "logger.h"
+#include "stats.h"
+#include "utils.h"
+#include <stdio.h>		/* For snprintf() / vsnprintf() / rename() */
+#include <stdlib.h>		/* For calloc() / free() */
+#include <string.h>		/* For strerror_r() / memcpy() */
+#include <errno.h>		/* For errno */
+#include <fcntl.h>		/* For open() */
+#include <unistd.h>		/* For close() / syscall() */
+#include <time.h>		/* For clock_gettime() / localtime_r() */
+#include <pthread.h>		/* For pthread_create() / pthread_join() / mutex */
+#include <sched.h>		/* For sched_yield() */
+#include <sys/uio.h>		/* For writev() */
+#include <sys/stat.h>		/* For fstat() */
+#include <sys/syscall.h>	/* For SYS_futex */
+#include <linux/futex.h>	/* For FUTEX_WAIT / FUTEX_WAKE */
+#include <linux/limits.h>	/* For PATH_MAX */
+
+/* Some codes for prety output on the terminal */
+#define NORMAL	"\x1B[0m"
+#define RED	"\x1B[31m"
+#define YELLOW	"\x1B[33m"
+#define MAGENTA	"\x1B[35m"
+#define CYAN	"\x1B[36m"
+
+/* Most messages the writer hands to a single writev() */
+#define LOGGER_BATCH		64
+
+struct logger_record {
+	/* Ring position this slot is ready for, see logger_vlog() */
+	uint64_t seq;
+	uint64_t timestamp;
+	int	level;
+	int	len;
+	char	text[LOGGER_MSG_LEN];
+};
+
+static struct {
+	struct	logger_record *ring;
+	/* Next position to fill, claimed by producers */
+	uint64_t head __attribute__((aligned(64)));
+	/* Producers between checking active and publishing */
+	uint32_t producers;
+	/* Next position to write out, only the writer touches it */
+	uint64_t tail __attribute__((aligned(64)));
+	/* Futex word, set while the writer sleeps */
+	uint32_t waiting __attribute__((aligned(64)));
+	int	active;
+	pthread_t tid;
+	/* File sink, -1 for stdout/stderr, the lock is only for
+	 * the writer rotating it under a synchronous write */
+	const char* filepath;
+	int	fd;
+	pthread_mutex_t file_lock;
+	uint64_t max_bytes;
+	uint64_t file_bytes;
+	uint64_t dropped_reported;
+	struct	stats_counter messages;
+	struct	stats_counter dropped;
+	struct	stats_counter batches;
+	struct	stats_counter overflows;
+} logger = { .fd = -1, .file_lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*********\
+* HELPERS *
+\*********/
+
+static const char*
+logger_color(int level)
+{
+	switch(level) {
+	case ERROR:
+		return RED;
+	case WARN:
+		return YELLOW;
+	case INFO:
+		return CYAN;
+	default:
+		return MAGENTA;
+	}
+}
+
+/* Info goes to stdout, everything else to stderr */
+static int
+logger_terminal_fd(int level)
+{
+	return level == INFO ? STDOUT_FILENO : STDERR_FILENO;
+}
+
+static uint64_t
+logger_get_realtime_usecs(void)
+{
+	struct timespec ts = {0};
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* "YYYY-mm-dd HH:MM:SS.mmm ", the prefix of each line in the file */
+static void
+logger_format_stamp(char* buf, size_t size, uint64_t timestamp)
+{
+	struct tm tm = {0};
+	time_t secs = timestamp / 1000000ULL;
+
+	localtime_r(&secs, &tm);
+	strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(buf + 19, size - 19, ".%03u ",
+		 (unsigned int) ((timestamp / 1000) % 1000));
+}
+
+/* Returns the length of the message in buf, truncated if needed */
+static int
+logger_format(char* buf, size_t size, const char* prefix, int err,
+	      const char* fmt, va_list args)
+{
+	static const char trunc[] = "...\n";
+	char errbuf[128] = {0};
+	size_t len = 0;
+	int ret = 0;
+
+	len = strlen(prefix);
+	if(len >= size)
+		len = size - 1;
+	memcpy(buf, prefix, len);
+
+	ret = vsnprintf(buf + len, size - len, fmt, args);
+	if(ret < 0)
+		ret = 0;
+	len += ret;
+
+	if(err && len < size)
+		len += snprintf(buf + len, size - len, ": %s\n",
+				strerror_r(err, errbuf, sizeof(errbuf)));
+
+	if(len >= size) {
+		len = size - 1;
+		memcpy(buf + len - (sizeof(trunc) - 1), trunc,
+		       sizeof(trunc) - 1);
+	}
+
+	return (int) len;
+}
+
+/* Keeps going on partial writes, gives up on errors; there's
+ * nowhere to report them anyway */
+static void
+logger_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t ret = 0;
+
+	while(iovcnt > 0) {
+		ret = writev(fd, iov, iovcnt);
+		if(ret < 0) {
+			if(errno == EINTR)
+				continue;
+			return;
+		}
+
+		if(logger.fd >= 0 && fd == logger.fd)
+			__atomic_add_fetch(&logger.file_bytes, ret,
+					   __ATOMIC_RELAXED);
+
+		while(iovcnt > 0 && (size_t) ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char*) iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
+static void
+logger_write_sync(int level, const char* text, int len)
+{
+	struct iovec iov[3];
+	const char* color = logger_color(level);
+
+	iov[0].iov_base = (void*) color;
+	iov[0].iov_len = strlen(color);
+	iov[1].iov_base = (void*) text;
+	iov[1].iov_len = len;
+	iov[2].iov_base = (void*) NORMAL;
+	iov[2].iov_len = sizeof(NORMAL) - 1;
+
+	logger_writev_all(logger_terminal_fd(level), iov, 3);
+}
+
+/* The ring is full, this one is too important to drop, write it
+ * out from here, ahead of whatever is still waiting in the ring */
+static void
+logger_write_overflow(int level, const char* text, int len)
+{
+	struct iovec iov[2];
+	char stamp[32];
+
+	pthread_mutex_lock(&logger.file_lock);
+	if(logger.fd < 0) {
+		pthread_mutex_unlock(&logger.file_lock);
+		logger_write_sync(level, text, len);
+		return;
+	}
+
+	logger_format_stamp(stamp, sizeof(stamp), logger_get_realtime_usecs());
+	iov[0].iov_base = stamp;
+	iov[0].iov_len = strlen(stamp);
+	iov[1].iov_base = (void*) text;
+	iov[1].iov_len = len;
+	logger_writev_all(logger.fd, iov, 2);
+
+	pthread_mutex_unlock(&logger.file_lock);
+}
+
+static int
+logger_open_file(void)
+{
+	struct stat st = {0};
+
+	logger.fd = open(logger.filepath, O_WRONLY | O_CREAT | O_APPEND |
+			 O_CLOEXEC, 0644);
+	if(logger.fd < 0)
+		return -errno;
+
+	logger.file_bytes = fstat(logger.fd, &st) == 0 ? st.st_size : 0;
+	return 0;
+}
+
+/* <file>.N-1 -> <file>.N ... <file> -> <file>.1, and a new <file> */
+static void
+logger_rotate(void)
+{
+	char from[PATH_MAX];
+	char to[PATH_MAX];
+	int i = 0;
+
+	pthread_mutex_lock(&logger.file_lock);
+	close(logger.fd);
+	logger.fd = -1;
+
+	for(i = LOGGER_KEEP_FILES - 1; i > 0; i--) {
+		snprintf(from, sizeof(from), "%s.%i", logger.filepath, i);
+		snprintf(to, sizeof(to), "%s.%i", logger.filepath, i + 1);
+		rename(from, to);
+	}
+	snprintf(to, sizeof(to), "%s.1", logger.filepath);
+	rename(logger.filepath, to);
+
+	/* If that failed, we fall back to the terminal */
+	if(logger_open_file() < 0)
+		logger.fd = -1;
+	pthread_mutex_unlock(&logger.file_lock);
+}
+
+static inline struct logger_record*
+logger_ready_record(uint64_t pos)
+{
+	struct logger_record *rec = &logger.ring[pos & (LOGGER_SLOTS - 1)];
+
+	if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return NULL;
+	return rec;
+}
+
+/* Writes out whatever is ready, returns how many messages it got */
+static int
+logger_drain(void)
+{
+	struct logger_record *batch[LOGGER_BATCH];
+	struct iovec iov[3 * LOGGER_BATCH];
+	char stamps[LOGGER_BATCH][32];
+	struct logger_record *rec = NULL;
+	const char* color = NULL;
+	uint64_t batch_bytes = 0;
+	uint64_t file_bytes = 0;
+	int count = 0;
+	int iovcnt = 0;
+	int fd = -1;
+	int i = 0;
+
+	while(count < LOGGER_BATCH &&
+	      (rec = logger_ready_record(logger.tail + count)) != NULL) {
+		batch[count++] = rec;
+		batch_bytes += rec->len + 24;
+	}
+	if(!count)
+		return 0;
+
+	stats_counter_add(&logger.batches, 1);
+
+	/* Overflowing errors / warnings add to it as well */
+	file_bytes = __atomic_load_n(&logger.file_bytes, __ATOMIC_RELAXED);
+	if(logger.fd >= 0 && logger.max_bytes && file_bytes &&
+	   file_bytes + batch_bytes > logger.max_bytes)
+		logger_rotate();
+
+	for(i = 0; i < count; i++) {
+		rec = batch[i];
+
+		/* In the file, with a timestamp and no colors */
+		if(logger.fd >= 0) {
+			logger_format_stamp(stamps[i], sizeof(stamps[i]),
+					    rec->timestamp);
+			iov[iovcnt].iov_base = stamps[i];
+			iov[iovcnt++].iov_len = strlen(stamps[i]);
+			iov[iovcnt].iov_base = rec->text;
+			iov[iovcnt++].iov_len = rec->len;
+			continue;
+		}
+
+		/* On the terminal, stdout and stderr take turns */
+		if(fd >= 0 && fd != logger_terminal_fd(rec->level)) {
+			logger_writev_all(fd, iov, iovcnt);
+			iovcnt = 0;
+		}
+		fd = logger_terminal_fd(rec->level);
+		color = logger_color(rec->level);
+		iov[iovcnt].iov_base = (void*) color;
+		iov[iovcnt++].iov_len = strlen(color);
+		iov[iovcnt].iov_base = rec->text;
+		iov[iovcnt++].iov_len = rec->len;
+		iov[iovcnt].iov_base = (void*) NORMAL;
+		iov[iovcnt++].iov_len = sizeof(NORMAL) - 1;
+	}
+	logger_writev_all(logger.fd >= 0 ? logger.fd : fd, iov, iovcnt);
+
+	/* Hand the slots back to the producers, for the next lap */
+	for(i = 0; i < count; i++)
+		__atomic_store_n(&batch[i]->seq, logger.tail + i + LOGGER_SLOTS,
+				 __ATOMIC_RELEASE);
+	logger.tail += count;
+
+	return count;
+}
+
+static void
+logger_report_dropped(void)
+{
+	uint64_t dropped = stats_counter_get(&logger.dropped);
+	char msg[128] = {0};
+	int len = 0;
+
+	if(dropped == logger.dropped_reported)
+		return;
+
+	len = snprintf(msg, sizeof(msg), "[LOG] Dropped %llu messages, "
+		       "the log writer couldn't keep up\n",
+		       (unsigned long long) (dropped - logger.dropped_reported));
+	logger.dropped_reported = dropped;
+
+	if(logger.fd >= 0) {
+		if(write(logger.fd, msg, len) > 0)
+			__atomic_add_fetch(&logger.file_bytes, len,
+					   __ATOMIC_RELAXED);
+	} else
+		logger_write_sync(WARN, msg, len);
+}
+
+static void
+logger_wake(void)
+{
+	/* Pairs with the fence in the writer, either it sees
+	 * our message or we see it going to sleep */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(!__atomic_load_n(&logger.waiting, __ATOMIC_RELAXED))
+		return;
+	if(__atomic_exchange_n(&logger.waiting, 0, __ATOMIC_RELAXED))
+		syscall(SYS_futex, &logger.waiting, FUTEX_WAKE_PRIVATE, 1,
+			NULL, NULL, 0);
+}
+
+/* Sleeps until a producer or logger_cleanup() wakes it up */
+static void*
+logger_thread(void* arg)
+{
+	while(1) {
+		if(logger_drain() > 0)
+			continue;
+
+		logger_report_dropped();
+
+		if(!__atomic_load_n(&logger.active, __ATOMIC_ACQUIRE))
+			break;
+
+		/* Pairs with the fence in logger_cleanup() too, either
+		 * we see it going away or it sees us going to sleep */
+		__atomic_store_n(&logger.waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(!logger_ready_record(logger.tail) &&
+		   __atomic_load_n(&logger.active, __ATOMIC_RELAXED))
+			syscall(SYS_futex, &logger.waiting, FUTEX_WAIT_PRIVATE,
+				1, NULL, NULL, 0);
+		__atomic_store_n(&logger.waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	return arg;
+}
+
+
+/**************\
+* ENTRY POINTS *
+\**************/
+
+void
+logger_vlog(int level, const char* prefix, int err, const char* fmt,
+	    va_list args)
+{
+	struct logger_record *rec = NULL;
+	char buf[LOGGER_MSG_LEN];
+	uint64_t pos = 0;
+	uint64_t seq = 0;
+	int len = 0;
+
+	/* Keeps logger_cleanup() from freeing the ring under us */
+	__atomic_add_fetch(&logger.producers, 1, __ATOMIC_SEQ_CST);
+	if(!__atomic_load_n(&logger.active, __ATOMIC_SEQ_CST)) {
+		__atomic_sub_fetch(&logger.producers, 1, __ATOMIC_RELEASE);
+		len = logger_format(buf, sizeof(buf), prefix, err, fmt, args);
+		logger_write_sync(level, buf, len);
+		return;
+	}
+
+	/* Claim a slot; it's free for position pos once the writer
+	 * is done with it from the previous lap (seq == pos), if it
+	 * isn't the writer is a whole ring behind */
+	pos = __atomic_load_n(&logger.head, __ATOMIC_RELAXED);
+	while(1) {
+		rec = &logger.ring[pos & (LOGGER_SLOTS - 1)];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if(seq == pos) {
+			if(__atomic_compare_exchange_n(&logger.head, &pos,
+						       pos + 1, 1,
+						       __ATOMIC_RELAXED,
+						       __ATOMIC_RELAXED))
+				break;
+		} else if((int64_t) (seq - pos) < 0) {
+			goto full;
+		} else
+			pos = __atomic_load_n(&logger.head, __ATOMIC_RELAXED);
+	}
+
+	rec->timestamp = logger_get_realtime_usecs();
+	rec->level = level;
+	rec->len = logger_format(rec->text, sizeof(rec->text), prefix, err,
+				 fmt, args);
+
+	/* Ready for the writer */
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&logger.producers, 1, __ATOMIC_RELEASE);
+	stats_counter_add(&logger.messages, 1);
+
+	logger_wake();
+	return;
+
+ full:
+	/* Still counted as a producer, so that the file
+	 * doesn't get closed under us */
+	if(level <= WARN) {
+		len = logger_format(buf, sizeof(buf), prefix, err, fmt, args);
+		logger_write_overflow(level, buf, len);
+		stats_counter_add(&logger.overflows, 1);
+	} else
+		stats_counter_add(&logger.dropped, 1);
+	__atomic_sub_fetch(&logger.producers, 1, __ATOMIC_RELEASE);
+}
+
+int
+logger_init(const char* filepath, uint64_t max_bytes)
+{
+	uint64_t i = 0;
+	int ret = 0;
+
+	stats_counter_register(&logger.messages, "log_messages",
+			       "Messages that went through the log ring");
+	stats_counter_register(&logger.dropped, "log_dropped",
+			       "Messages dropped because the log ring was full");
+	stats_counter_register(&logger.batches, "log_batches",
+			       "Batches written out by the log writer");
+	stats_counter_register(&logger.overflows, "log_overflows",
+			       "Errors / warnings written out directly "
+			       "because the log ring was full");
+
+	logger.ring = calloc(LOGGER_SLOTS, sizeof(struct logger_record));
+	if(!logger.ring) {
+		utils_perr(UTILS, "Could not allocate log ring");
+		return -ENOMEM;
+	}
+	for(i = 0; i < LOGGER_SLOTS; i++)
+		logger.ring[i].seq = i;
+	logger.head = logger.tail = 0;
+
+	logger.filepath = filepath;
+	logger.max_bytes = max_bytes;
+	if(filepath) {
+		ret = logger_open_file();
+		if(ret < 0) {
+			errno = -ret;
+			utils_perr(UTILS, "Could not open log file %s", filepath);
+			goto fail;
+		}
+	}
+
+	__atomic_store_n(&logger.active, 1, __ATOMIC_RELEASE);
+	ret = pthread_create(&logger.tid, NULL, logger_thread, NULL);
+	if(ret != 0) {
+		__atomic_store_n(&logger.active, 0, __ATOMIC_RELEASE);
+		errno = ret;
+		utils_perr(UTILS, "Could not start log writer");
+		ret = -ret;
+		goto fail;
+	}
+
+	return 0;
+
+ fail:
+	if(logger.fd >= 0)
+		close(logger.fd);
+	logger.fd = -1;
+	free(logger.ring);
+	logger.ring = NULL;
+	return ret;
+}
+
+void
+logger_cleanup(void)
+{
+	if(!__atomic_load_n(&logger.active, __ATOMIC_ACQUIRE))
+		return;
+
+	/* From here on new messages are written out synchronously,
+	 * the writer drains what's left and goes away */
+	__atomic_store_n(&logger.active, 0, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	__atomic_exchange_n(&logger.waiting, 0, __ATOMIC_RELAXED);
+	syscall(SYS_futex, &logger.waiting, FUTEX_WAKE_PRIVATE, 1,
+		NULL, NULL, 0);
+	pthread_join(logger.tid, NULL);
+
+	/* Anything that made it in while it was on its way out */
+	while(__atomic_load_n(&logger.producers, __ATOMIC_ACQUIRE))
+		sched_yield();
+	while(logger_drain() > 0);
+
+	if(logger.fd >= 0)
+		close(logger.fd);
+	logger.fd = -1;
+	free(logger.ring);
+	logger.ring = NULL;
+}
@@ -0,0 +1,56 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Asynchronous log writer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <stdarg.h>	/* For va_list handling */
+#include <stdint.h>	/* For typed ints */
+
+/* The utils_* log calls format their message straight into a slot
+ * of a fixed-size ring and return, a writer thread drains the ring
+ * in batches (one writev() for as many messages as are ready) to
+ * stdout/stderr or to a log file. Any thread can log (including
+ * streaming ones) without blocking on a slow terminal / journal
+ * or allocating anything. If the ring is full info / debug messages
+ * get dropped and counted (the writer reports how many it lost),
+ * errors and warnings get written out synchronously instead.
+ *
+ * Before logger_init() and after logger_cleanup() messages are
+ * written out synchronously, as before. */
+
+/* Must be a power of 2 */
+#define LOGGER_SLOTS		1024
+/* Longer messages get truncated */
+#define LOGGER_MSG_LEN		1000
+/* Rotated files are kept as <file>.1 (newest) ... <file>.N */
+#define LOGGER_KEEP_FILES	4
+
+/* filepath may be NULL to keep logging on stdout/stderr, max_bytes
+ * is the size after which the file gets rotated (0 for never) */
+int logger_init(const char* filepath, uint64_t max_bytes);
+void logger_cleanup(void);
+
+/* level is one of enum log_levels, err an errno value
+ * to append (as in perror()) or 0 */
+void logger_vlog(int level, const char* prefix, int err, const char* fmt,
+		 va_list args);
+
+#endif /* __LOGGER_H__ */
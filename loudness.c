@@ -0,0 +1,397 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * EBU R128 / ITU-R BS.1770 loudness meter
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loudness.h"
+#include "utils.h"
+#include <stdlib.h>	/* For calloc/realloc/free */
+#include <math.h>	/* For tan/pow/log10/sin/cos */
+
+/* The K-weighting filters are IIRs so we can't vectorize them
+ * along time, instead we put each channel of a frame on a vector
+ * lane and run all channels at once. GCC's vector extensions
+ * map this to SSE2/AVX on x86 and NEON on ARM, without having
+ * to maintain per-architecture intrinsics. We use doubles since
+ * the 38Hz high pass is too sensitive for single precision. */
+typedef double v4df __attribute__ ((vector_size (LOUDNESS_MAX_CHANNELS *
+						  sizeof(double))));
+typedef long long v4di __attribute__ ((vector_size (LOUDNESS_MAX_CHANNELS *
+						    sizeof(long long))));
+
+/* Gating block is 400ms, with 75% overlap, so we
+ * accumulate 100ms sub-blocks and combine the last 4 */
+#define SUBBLOCKS_PER_BLOCK	4
+#define ABSOLUTE_GATE_LUFS	-70.0
+#define RELATIVE_GATE_LU	-10.0
+
+/* True peak is measured by 4x oversampling through a
+ * 48-tap polyphase interpolator, as in BS.1770 Annex 2 */
+#define TP_PHASES		4
+#define TP_TAPS			12
+
+/* Keeps the filter state out of the denormal range
+ * on digital silence, the high pass removes it */
+#define ANTI_DENORMAL		1e-18
+
+struct biquad {
+	double	b0, b1, b2;
+	double	a1, a2;
+	v4df	z1, z2;
+};
+
+struct loudness_meter {
+	int	rate;
+	int	channels;
+	v4df	weights;
+
+	/* K-weighting */
+	struct	biquad shelf;
+	struct	biquad highpass;
+
+	/* Gating */
+	size_t	subblock_frames;
+	size_t	subblock_pos;
+	v4df	subblock_acc;
+	double	subblocks[SUBBLOCKS_PER_BLOCK];
+	int	num_subblocks;
+	double*	blocks;
+	size_t	num_blocks;
+	size_t	max_blocks;
+
+	/* True peak */
+	int	tp_phase_step;
+	double	tp_coefs[TP_PHASES][TP_TAPS];
+	v4df	tp_hist[2 * TP_TAPS];
+	int	tp_pos;
+	v4df	tp_max;
+};
+
+
+/*********\
+* HELPERS *
+\*********/
+
+/* Vectors are passed around by reference, passing them by value
+ * changes the calling convention depending on the target ISA */
+
+static inline void
+loudness_biquad_run(struct biquad *bq, v4df *sample)
+{
+	/* Transposed direct form II, in-place */
+	v4df x = (*sample);
+	v4df y = bq->b0 * x + bq->z1;
+	bq->z1 = bq->b1 * x - bq->a1 * y + bq->z2;
+	bq->z2 = bq->b2 * x - bq->a2 * y;
+	(*sample) = y;
+}
+
+static inline void
+loudness_vmax(v4df *max, const v4df *val)
+{
+	v4di mask = ((*val) > (*max));
+	(*max) = (v4df) (((v4di) (*val) & mask) | ((v4di) (*max) & ~mask));
+}
+
+static void
+loudness_init_filters(struct loudness_meter *lm)
+{
+	double f0, gain, q, k, vh, vb, a0;
+
+	/* Stage 1: high shelf, accounts for the acoustic
+	 * effects of the head. Coefficients are re-computed
+	 * for the actual rate instead of using the 48KHz
+	 * ones from the spec. */
+	f0 = 1681.974450955533;
+	gain = 3.999843853973347;
+	q = 0.7071752369554196;
+	k = tan(M_PI * f0 / (double) lm->rate);
+	vh = pow(10.0, gain / 20.0);
+	vb = pow(vh, 0.4996667741545416);
+	a0 = 1.0 + k / q + k * k;
+	lm->shelf.b0 = (vh + vb * k / q + k * k) / a0;
+	lm->shelf.b1 = 2.0 * (k * k - vh) / a0;
+	lm->shelf.b2 = (vh - vb * k / q + k * k) / a0;
+	lm->shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+	lm->shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+	/* Stage 2: RLB high pass */
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / (double) lm->rate);
+	a0 = 1.0 + k / q + k * k;
+	lm->highpass.b0 = 1.0;
+	lm->highpass.b1 = -2.0;
+	lm->highpass.b2 = 1.0;
+	lm->highpass.a1 = 2.0 * (k * k - 1.0) / a0;
+	lm->highpass.a2 = (1.0 - k / q + k * k) / a0;
+}
+
+static void
+loudness_init_true_peak(struct loudness_meter *lm)
+{
+	const int num_taps = TP_PHASES * TP_TAPS;
+	double h[TP_PHASES * TP_TAPS];
+	double t, sum;
+	int n, p;
+
+	/* Above 96KHz 2x oversampling is enough, above 192KHz
+	 * the sample peak is already a good approximation */
+	if(lm->rate >= 176400)
+		lm->tp_phase_step = TP_PHASES;
+	else if(lm->rate >= 88200)
+		lm->tp_phase_step = TP_PHASES / 2;
+	else
+		lm->tp_phase_step = 1;
+
+	/* Hann-windowed sinc, cut-off at the original Nyquist */
+	for(n = 0; n < num_taps; n++) {
+		t = ((double) n - (num_taps - 1) / 2.0) / TP_PHASES;
+		h[n] = (t == 0.0) ? 1.0 : sin(M_PI * t) / (M_PI * t);
+		h[n] *= 0.5 - 0.5 * cos(2.0 * M_PI * (n + 1) / (num_taps + 1));
+	}
+
+	/* Split it to phases and normalize each one for unity gain */
+	for(p = 0; p < TP_PHASES; p++) {
+		sum = 0.0;
+		for(n = 0; n < TP_TAPS; n++) {
+			lm->tp_coefs[p][n] = h[p + n * TP_PHASES];
+			sum += lm->tp_coefs[p][n];
+		}
+		for(n = 0; n < TP_TAPS; n++)
+			lm->tp_coefs[p][n] /= sum;
+	}
+}
+
+static inline void
+loudness_true_peak_run(struct loudness_meter *lm, const v4df *sample)
+{
+	const v4df *window = NULL;
+	v4df x = (*sample);
+	v4df y;
+	int p, n;
+
+	/* History is mirrored so that the window is
+	 * always contiguous, newest sample first */
+	lm->tp_pos = lm->tp_pos ? lm->tp_pos - 1 : TP_TAPS - 1;
+	lm->tp_hist[lm->tp_pos] = x;
+	lm->tp_hist[lm->tp_pos + TP_TAPS] = x;
+	window = &lm->tp_hist[lm->tp_pos];
+
+	if(lm->tp_phase_step == TP_PHASES) {
+		y = x * x;
+		loudness_vmax(&lm->tp_max, &y);
+		return;
+	}
+
+	for(p = 0; p < TP_PHASES; p += lm->tp_phase_step) {
+		y = window[0] * lm->tp_coefs[p][0];
+		for(n = 1; n < TP_TAPS; n++)
+			y += window[n] * lm->tp_coefs[p][n];
+		y *= y;
+		loudness_vmax(&lm->tp_max, &y);
+	}
+}
+
+static int
+loudness_push_block(struct loudness_meter *lm)
+{
+	double *tmp = NULL;
+	double energy = 0.0;
+	size_t max_blocks = 0;
+	int i = 0;
+
+	for(i = 0; i < SUBBLOCKS_PER_BLOCK; i++)
+		energy += lm->subblocks[i];
+	energy /= SUBBLOCKS_PER_BLOCK;
+
+	if(lm->num_blocks >= lm->max_blocks) {
+		/* 10 blocks per second, start with 10 minutes */
+		max_blocks = lm->max_blocks ? lm->max_blocks * 2 : 6000;
+		tmp = realloc(lm->blocks, max_blocks * sizeof(double));
+		if(!tmp) {
+			utils_err(ANL, "Could not expand gating blocks array\n");
+			return -1;
+		}
+		lm->blocks = tmp;
+		lm->max_blocks = max_blocks;
+	}
+
+	lm->blocks[lm->num_blocks++] = energy;
+	return 0;
+}
+
+static int
+loudness_end_subblock(struct loudness_meter *lm)
+{
+	v4df mean_square = lm->subblock_acc / (double) lm->subblock_frames;
+	v4df weighted = mean_square * lm->weights;
+	double energy = 0.0;
+	int c = 0;
+
+	for(c = 0; c < LOUDNESS_MAX_CHANNELS; c++)
+		energy += weighted[c];
+
+	for(c = 0; c < SUBBLOCKS_PER_BLOCK - 1; c++)
+		lm->subblocks[c] = lm->subblocks[c + 1];
+	lm->subblocks[SUBBLOCKS_PER_BLOCK - 1] = energy;
+
+	lm->subblock_acc = (v4df) {0};
+	lm->subblock_pos = 0;
+
+	if(++lm->num_subblocks < SUBBLOCKS_PER_BLOCK)
+		return 0;
+
+	return loudness_push_block(lm);
+}
+
+static inline double
+loudness_energy_to_lufs(double energy)
+{
+	return -0.691 + 10.0 * log10(energy);
+}
+
+
+/**************\
+* ENTRY POINTS *
+\**************/
+
+struct loudness_meter*
+loudness_meter_new(int rate, int channels)
+{
+	struct loudness_meter *lm = NULL;
+	int c = 0;
+
+	if(rate <= 0 || channels <= 0 || channels > LOUDNESS_MAX_CHANNELS) {
+		utils_err(ANL, "Unsupported format: %i channels @ %iHz\n",
+			  channels, rate);
+		return NULL;
+	}
+
+	lm = calloc(1, sizeof(struct loudness_meter));
+	if(!lm) {
+		utils_err(ANL, "Could not allocate loudness meter\n");
+		return NULL;
+	}
+
+	lm->rate = rate;
+	lm->channels = channels;
+	lm->subblock_frames = rate / 10;
+
+	/* Front channels have a weight of 1.0, the surround
+	 * ones (only present on >3 channels) get +1.5dB */
+	for(c = 0; c < LOUDNESS_MAX_CHANNELS; c++)
+		lm->weights[c] = (c < channels) ? ((c >= 3) ? 1.41 : 1.0) : 0.0;
+
+	loudness_init_filters(lm);
+	loudness_init_true_peak(lm);
+
+	return lm;
+}
+
+void
+loudness_meter_free(struct loudness_meter *lm)
+{
+	if(!lm)
+		return;
+	free(lm->blocks);
+	free(lm);
+}
+
+int
+loudness_meter_process(struct loudness_meter *lm, const float *frames,
+		       size_t num_frames)
+{
+	v4df x;
+	size_t i = 0;
+	int c = 0;
+	int ret = 0;
+
+	for(i = 0; i < num_frames; i++, frames += lm->channels) {
+		x = (v4df) {0};
+		for(c = 0; c < lm->channels; c++)
+			x[c] = frames[c];
+
+		loudness_true_peak_run(lm, &x);
+
+		x += ANTI_DENORMAL;
+		loudness_biquad_run(&lm->shelf, &x);
+		loudness_biquad_run(&lm->highpass, &x);
+		lm->subblock_acc += x * x;
+
+		if(++lm->subblock_pos < lm->subblock_frames)
+			continue;
+
+		ret = loudness_end_subblock(lm);
+		if(ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+float
+loudness_meter_get_integrated(struct loudness_meter *lm)
+{
+	double abs_gate = pow(10.0, (ABSOLUTE_GATE_LUFS + 0.691) / 10.0);
+	double rel_gate = 0.0;
+	double sum = 0.0;
+	size_t count = 0;
+	size_t i = 0;
+
+	/* Absolute gating */
+	for(i = 0; i < lm->num_blocks; i++)
+		if(lm->blocks[i] > abs_gate) {
+			sum += lm->blocks[i];
+			count++;
+		}
+
+	if(!count)
+		return -INFINITY;
+
+	/* Relative gating */
+	rel_gate = (sum / count) * pow(10.0, RELATIVE_GATE_LU / 10.0);
+	if(rel_gate < abs_gate)
+		rel_gate = abs_gate;
+
+	sum = 0.0;
+	count = 0;
+	for(i = 0; i < lm->num_blocks; i++)
+		if(lm->blocks[i] > rel_gate) {
+			sum += lm->blocks[i];
+			count++;
+		}
+
+	if(!count)
+		return -INFINITY;
+
+	return (float) loudness_energy_to_lufs(sum / count);
+}
+
+float
+loudness_meter_get_true_peak(struct loudness_meter *lm)
+{
+	double max_square = 0.0;
+	int c = 0;
+
+	for(c = 0; c < lm->channels; c++)
+		if(lm->tp_max[c] > max_square)
+			max_square = lm->tp_max[c];
+
+	return (float) (10.0 * log10(max_square));
+}
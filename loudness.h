@@ -0,0 +1,42 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * EBU R128 / ITU-R BS.1770 loudness meter
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOUDNESS_H__
+#define __LOUDNESS_H__
+
+#include <stddef.h>	/* For size_t */
+
+/* All channels of a frame are processed in parallel
+ * on the lanes of a single vector */
+#define LOUDNESS_MAX_CHANNELS	4
+
+struct loudness_meter;
+
+struct loudness_meter* loudness_meter_new(int rate, int channels);
+void loudness_meter_free(struct loudness_meter *lm);
+
+/* Input is interleaved 32bit float samples */
+int loudness_meter_process(struct loudness_meter *lm, const float *frames,
+			   size_t num_frames);
+
+float loudness_meter_get_integrated(struct loudness_meter *lm);
+float loudness_meter_get_true_peak(struct loudness_meter *lm);
+
+#endif /* __LOUDNESS_H__ */
@@ -1,16 +1,35 @@
 #include "scheduler.h"
 #include "player.h"
 #include "meta_handler.h"
+#include "media_index.h"
+#include "analyzer.h"
+#include "transcoder.h"
+#include "pcm_cache.h"
+#include "realtime.h"
+#include "control.h"
+#include "stats.h"
+#include "logger.h"
+#include "tracer.h"
+#include "element_stats.h"
 #include "utils.h"
 #include <unistd.h>	/* For getopt() */
 #include <signal.h>	/* For sig_atomic_t and signal handling */
-#include <stdlib.h>	/* For strtol() */
+#include <stdlib.h>	/* For strtol() / strtod() */
 #include <stdio.h>	/* For perror() */
 
 static struct player player = {0};
 
 static const char * usage_str =
-  "Usage: %s [-s audio_sink_bin] [-d debug_level] [-m debug_mask] [-p port] <config_file>\n";
+  "Usage: %s [-s audio_sink_bin] [-d debug_level] [-m debug_mask] [-p port]\n"
+  "\t[-i index_file] [-w analysis_workers] [-L target_lufs]\n"
+  "\t[-S lead_silence_dbfs] [-T trail_silence_dbfs]\n"
+  "\t[-R mix_rate] [-C mix_channels] [-t transcode_cache_dir]\n"
+  "\t[-q transcode_cache_mb] [-j transcode_jobs]\n"
+  "\t[-c pcm_cache_max_secs] [-M pcm_cache_mb]\n"
+  "\t[-F linear|equal-power|s-curve] [-r rt_priority] [-a rt_cpu_list]\n"
+  "\t[-n now_playing_shm_name] [-b bind_address] [-u control_socket]\n"
+  "\t[-l log_file] [-z log_file_max_mb] [-e trace_events]\n"
+  "\t[-o trace_file] [-E] <config_file>\n";
 
 static void
 signal_handler(int sig, siginfo_t * info, void *extra)
@@ -24,13 +43,50 @@ main(int argc, char **argv)
 	struct scheduler sched = {0};
 	struct sigaction sa = {0};
 	struct meta_handler mh = {0};
+	struct analyzer anl = {0};
+	struct transcoder tc = {0};
+	struct pcm_cache pcm = {0};
+	struct control ctl = {0};
 	int ret = 0, opt, tmp;
+	double tmpf = 0.0;
 	int dbg_lvl = INFO;
 	int dbg_mask = PLR|SCHED|META;
 	uint16_t port = 9670;
 	char *sink = NULL;
+	char *index_file = NULL;
+	int num_workers = 1;
+	int rt_priority = 0;
+	char *rt_cpus = NULL;
+	char *shm_name = NP_SHM_DEFAULT_NAME;
+	char *bind_addr = NULL;
+	char *log_file = NULL;
+	uint64_t log_max_bytes = 16ULL << 20;
+	uint32_t trace_events = 0;
+	int element_stats = 0;
 
-	while ((opt = getopt(argc, argv, "s:d:m:p:")) != -1) {
+	/* EBU R128 target level */
+	player.loudness_target = -23.0;
+
+	/* Internal mix format */
+	player.mix_rate = 48000;
+	player.mix_channels = 2;
+	player.fade_shape = XFADE_SHAPE_LINEAR;
+
+	/* RMS levels below which leading / trailing audio is
+	 * considered silence, trailing is a bit more eager since
+	 * fade outs and reverb tails are covered by the crossfade */
+	anl.lead_silence_db = -50.0;
+	anl.trail_silence_db = -45.0;
+
+	/* Transcode cache, disabled unless a directory is given */
+	tc.quota_bytes = 4096ULL << 20;
+	tc.max_jobs = 1;
+
+	/* Jingles, station IDs etc are kept decoded in memory */
+	pcm.max_duration = 30 * GST_SECOND;
+	pcm.quota_bytes = 256ULL << 20;
+
+	while ((opt = getopt(argc, argv, "s:d:m:p:i:w:L:S:T:R:C:t:q:j:c:M:F:r:a:n:b:u:l:z:e:o:E")) != -1) {
 		switch (opt) {
 		case 's':
 			sink = optarg;
@@ -56,6 +112,139 @@ main(int argc, char **argv)
 			else
 				port = tmp;
 			break;
+		case 'i':
+			index_file = optarg;
+			break;
+		case 'n':
+			/* An empty name disables it */
+			shm_name = optarg[0] ? optarg : NULL;
+			break;
+		case 'b':
+			bind_addr = optarg;
+			break;
+		case 'u':
+			ctl.path = optarg;
+			break;
+		case 'l':
+			log_file = optarg;
+			break;
+		case 'z':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0)
+				perror("Failed to parse log file size");
+			else
+				log_max_bytes = (uint64_t) tmp << 20;
+			break;
+		case 'e':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0 || tmp < 0)
+				perror("Failed to parse number of trace events");
+			else
+				trace_events = tmp;
+			break;
+		case 'o':
+			ctl.trace_path = optarg;
+			break;
+		case 'E':
+			element_stats = 1;
+			break;
+		case 'w':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0)
+				perror("Failed to parse number of analysis workers");
+			else
+				num_workers = tmp;
+			break;
+		case 'L':
+			tmpf = strtod(optarg, NULL);
+			if (errno != 0)
+				perror("Failed to parse target loudness");
+			else
+				player.loudness_target = tmpf;
+			break;
+		case 'S':
+			tmpf = strtod(optarg, NULL);
+			if (errno != 0)
+				perror("Failed to parse leading silence threshold");
+			else
+				anl.lead_silence_db = tmpf;
+			break;
+		case 'T':
+			tmpf = strtod(optarg, NULL);
+			if (errno != 0)
+				perror("Failed to parse trailing silence threshold");
+			else
+				anl.trail_silence_db = tmpf;
+			break;
+		case 'R':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0)
+				perror("Failed to parse mix sample rate");
+			else if (tmp <= 0)
+				fprintf(stderr, "Invalid mix sample rate: %s\n",
+					optarg);
+			else
+				player.mix_rate = tmp;
+			break;
+		case 'C':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0)
+				perror("Failed to parse mix channels");
+			else if (tmp <= 0)
+				fprintf(stderr, "Invalid number of mix channels: "
+					"%s\n", optarg);
+			else if (tmp > XFADE_MAX_CHANNELS) {
+				fprintf(stderr, "Too many mix channels, using %i\n",
+					XFADE_MAX_CHANNELS);
+				player.mix_channels = XFADE_MAX_CHANNELS;
+			} else
+				player.mix_channels = tmp;
+			break;
+		case 't':
+			tc.cache_dir = optarg;
+			break;
+		case 'q':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0)
+				perror("Failed to parse transcode cache quota");
+			else
+				tc.quota_bytes = (uint64_t) tmp << 20;
+			break;
+		case 'j':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0)
+				perror("Failed to parse number of transcode jobs");
+			else
+				tc.max_jobs = tmp;
+			break;
+		case 'c':
+			tmpf = strtod(optarg, NULL);
+			if (errno != 0)
+				perror("Failed to parse PCM cache clip length");
+			else
+				pcm.max_duration = tmpf * GST_SECOND;
+			break;
+		case 'M':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0)
+				perror("Failed to parse PCM cache quota");
+			else
+				pcm.quota_bytes = (uint64_t) tmp << 20;
+			break;
+		case 'F':
+			if (!xfade_shape_from_string(optarg, &player.fade_shape))
+				fprintf(stderr, "Unknown fade shape: %s\n", optarg);
+			break;
+		case 'r':
+			tmp = strtol(optarg, NULL, 10);
+			if (errno != 0)
+				perror("Failed to parse realtime priority");
+			else
+				rt_priority = tmp;
+			break;
+		case 'a':
+			rt_cpus = optarg;
+			break;
 		default:
 			printf(usage_str, argv[0]);
 			return(0);
@@ -70,6 +259,36 @@ main(int argc, char **argv)
 	utils_set_log_level(dbg_lvl);
 	utils_set_debug_mask(dbg_mask);
 
+	/* Everyone registers their stats on init */
+	stats_init();
+	utils_register_stats();
+
+	/* From here on messages go through the log writer */
+	ret = logger_init(log_file, log_max_bytes);
+	if (ret < 0) {
+		utils_err(NONE, "Unable to initialize logger\n");
+		ret = -10;
+		goto cleanup;
+	}
+
+	/* Disabled unless asked for, dumped through the control
+	 * socket or on SIGUSR2 */
+	ret = tracer_init(trace_events);
+	if (ret < 0) {
+		utils_err(NONE, "Unable to initialize tracer\n");
+		ret = -11;
+		goto cleanup;
+	}
+
+	/* Needs to be up before the scheduler loads
+	 * any playlists, so that it can register their files */
+	ret = midx_init(index_file);
+	if (ret < 0) {
+		utils_err(NONE, "Unable to initialize media index\n");
+		ret = -4;
+		goto cleanup;
+	}
+
 	ret = sched_init(&sched, argv[optind]);
 	if (ret < 0) {
 		utils_err(NONE, "Unable to initialize scheduler\n");
@@ -77,20 +296,75 @@ main(int argc, char **argv)
 		goto cleanup;
 	}
 
-	ret = meta_handler_init(&mh, port, NULL);
+	ret = meta_handler_init(&mh, port, bind_addr, shm_name);
 	if (ret < 0) {
 		utils_err(NONE, "Unable to initialize metadata request hanlder\n");
 		ret = -2;
 		goto cleanup;
 	}
 
-	ret = player_init(&player, &sched, &mh, sink);
+	/* Transcoded files are in the mix format */
+	tc.mix_rate = player.mix_rate;
+	tc.mix_channels = player.mix_channels;
+	ret = transcoder_init(&tc);
+	if (ret < 0) {
+		utils_err(NONE, "Unable to initialize transcoder\n");
+		ret = -6;
+		goto cleanup;
+	}
+
+	/* So are the cached clips */
+	pcm.mix_rate = player.mix_rate;
+	pcm.mix_channels = player.mix_channels;
+	ret = pcm_cache_init(&pcm);
+	if (ret < 0) {
+		utils_err(NONE, "Unable to initialize PCM cache\n");
+		ret = -7;
+		goto cleanup;
+	}
+
+	/* Before the player, so that its threads can pick it up */
+	ret = rt_init(rt_priority, rt_cpus,
+		      pcm.max_duration ? pcm.quota_bytes : 0);
+	if (ret < 0) {
+		utils_err(NONE, "Unable to initialize realtime mode\n");
+		ret = -8;
+		goto cleanup;
+	}
+
+	ret = player_init(&player, &sched, &mh, &tc, &pcm, sink);
 	if (ret < 0) {
 		utils_err(NONE, "Unable to initialize player\n");
 		ret = -3;
 		goto cleanup;
 	}
 
+	/* Needs the pipeline, off by default since it
+	 * hooks every buffer push */
+	if (element_stats) {
+		ret = element_stats_init(&player);
+		if (ret < 0) {
+			utils_err(NONE, "Unable to initialize element stats\n");
+			ret = -12;
+			goto cleanup;
+		}
+	}
+
+	ret = analyzer_init(&anl, num_workers);
+	if (ret < 0) {
+		utils_err(NONE, "Unable to initialize media analyzer\n");
+		ret = -5;
+		goto cleanup;
+	}
+
+	/* Served from the player's main loop */
+	ret = control_init(&ctl, &player, &sched, &tc, &pcm);
+	if (ret < 0) {
+		utils_err(NONE, "Unable to initialize control socket\n");
+		ret = -9;
+		goto cleanup;
+	}
+
 	/* Install signal handler */
 	/* Install a signal handler for graceful exit */
 	sigemptyset(&sa.sa_mask);
@@ -106,8 +380,17 @@ main(int argc, char **argv)
 	utils_info(PLR, "Graceful exit...\n");
 
  cleanup:
+	control_cleanup(&ctl);
+	analyzer_cleanup(&anl);
+	transcoder_cleanup(&tc);
+	pcm_cache_cleanup(&pcm);
+	element_stats_cleanup();
 	player_cleanup(&player);
 	sched_cleanup(&sched);
+	midx_cleanup();
 	meta_handler_destroy(&mh);
+	rt_cleanup();
+	tracer_cleanup();
+	logger_cleanup();
 	return ret;
 }
@@ -0,0 +1,741 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Media library index
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "media_index.h"
+#include "stats.h"
+#include "utils.h"
+#include <stdlib.h>	/* For malloc/calloc/free */
+#include <stdio.h>	/* For FILE handling */
+#include <string.h>	/* For strncmp() / strdup() */
+#include <stdint.h>	/* For uint32_t */
+#include <inttypes.h>	/* For SCNu64 / PRIu64 etc */
+#include <limits.h>	/* For PATH_MAX */
+#include <pthread.h>	/* For pthread mutex / cond */
+
+/* The index is a hash table of files we've seen on playlists,
+ * keyed by their path. It's shared between the scheduler (that
+ * registers files when it loads playlists), the analyzer workers
+ * (that fill it up in the background) and the player (that looks
+ * up the results when it creates a new item). The on-disk copy
+ * is a plain text file, one entry per line, so that it survives
+ * restarts and we don't have to re-analyze the whole library.
+ *
+ * Files that fail to decode (during analysis or playback) are
+ * quarantined, so that the scheduler skips them instead of having
+ * the player fail on them over and over. Those are stored on lines
+ * starting with 'Q' (which older versions skip as malformed). */
+
+#define MIDX_FILE_HEADER	"#MIDX 3"
+#define MIDX_INITIAL_BUCKETS	1024
+#define MIDX_SAVE_INTERVAL	64
+/* Quarantined files get re-checked after 10 minutes,
+ * doubling on every failure, up to a week */
+#define MIDX_RETRY_MIN_SECS	600
+#define MIDX_RETRY_MAX_SECS	(7 * 24 * 3600)
+
+struct media_index {
+	char*	filepath;
+	struct	midx_entry **buckets;
+	unsigned int num_buckets;
+	unsigned int num_entries;
+	/* FIFO of entries waiting for analysis */
+	struct	midx_entry *pending_head;
+	struct	midx_entry *pending_tail;
+	int	unsaved;
+	int	cancelled;
+	/* No analyzer workers, see midx_is_quarantined() */
+	int	no_analysis;
+	pthread_mutex_t lock;
+	pthread_cond_t pending_cond;
+	/* Statistics */
+	struct	stats_counter hits;
+	struct	stats_counter misses;
+	struct	stats_counter expedited;
+};
+
+static struct media_index midx = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.pending_cond = PTHREAD_COND_INITIALIZER,
+};
+
+
+/*********\
+* HELPERS *
+\*********/
+
+static uint32_t
+midx_hash(const char* str)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+
+	while(*str) {
+		hash ^= (unsigned char) *str++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static struct midx_entry*
+midx_lookup(const char* filepath)
+{
+	struct midx_entry *entry = NULL;
+	uint32_t idx = 0;
+
+	if(!midx.buckets)
+		return NULL;
+
+	idx = midx_hash(filepath) & (midx.num_buckets - 1);
+	for(entry = midx.buckets[idx]; entry; entry = entry->next)
+		if(!strncmp(entry->filepath, filepath, PATH_MAX))
+			return entry;
+
+	return NULL;
+}
+
+static int
+midx_grow(void)
+{
+	struct midx_entry **buckets = NULL;
+	struct midx_entry *entry = NULL;
+	struct midx_entry *next = NULL;
+	unsigned int num_buckets = 0;
+	unsigned int i = 0;
+	uint32_t idx = 0;
+
+	num_buckets = midx.num_buckets ? midx.num_buckets * 2 :
+					 MIDX_INITIAL_BUCKETS;
+
+	buckets = calloc(num_buckets, sizeof(struct midx_entry*));
+	if(!buckets) {
+		utils_err(IDX, "Could not allocate hash table\n");
+		return -1;
+	}
+
+	/* Re-hash existing entries */
+	for(i = 0; i < midx.num_buckets; i++) {
+		for(entry = midx.buckets[i]; entry; entry = next) {
+			next = entry->next;
+			idx = midx_hash(entry->filepath) & (num_buckets - 1);
+			entry->next = buckets[idx];
+			buckets[idx] = entry;
+		}
+	}
+
+	free(midx.buckets);
+	midx.buckets = buckets;
+	midx.num_buckets = num_buckets;
+	return 0;
+}
+
+static struct midx_entry*
+midx_insert(const char* filepath)
+{
+	struct midx_entry *entry = NULL;
+	uint32_t idx = 0;
+
+	/* Keep load factor under 0.75 */
+	if((midx.num_entries + 1) * 4 > midx.num_buckets * 3)
+		if(midx_grow() < 0)
+			return NULL;
+
+	entry = calloc(1, sizeof(struct midx_entry));
+	if(!entry) {
+		utils_err(IDX, "Could not allocate index entry\n");
+		return NULL;
+	}
+
+	entry->filepath = strdup(filepath);
+	if(!entry->filepath) {
+		utils_err(IDX, "Could not allocate index entry\n");
+		free(entry);
+		return NULL;
+	}
+
+	idx = midx_hash(filepath) & (midx.num_buckets - 1);
+	entry->next = midx.buckets[idx];
+	midx.buckets[idx] = entry;
+	midx.num_entries++;
+
+	return entry;
+}
+
+static void
+midx_queue_pending(struct midx_entry *entry)
+{
+	if(entry->flags & (MIDX_PENDING | MIDX_BUSY))
+		return;
+
+	entry->flags |= MIDX_PENDING;
+	entry->next_pending = NULL;
+	entry->prev_pending = midx.pending_tail;
+	if(midx.pending_tail)
+		midx.pending_tail->next_pending = entry;
+	else
+		midx.pending_head = entry;
+	midx.pending_tail = entry;
+
+	pthread_cond_signal(&midx.pending_cond);
+}
+
+static void
+midx_unlink_pending(struct midx_entry *entry)
+{
+	if(entry->prev_pending)
+		entry->prev_pending->next_pending = entry->next_pending;
+	else
+		midx.pending_head = entry->next_pending;
+
+	if(entry->next_pending)
+		entry->next_pending->prev_pending = entry->prev_pending;
+	else
+		midx.pending_tail = entry->prev_pending;
+
+	entry->next_pending = entry->prev_pending = NULL;
+}
+
+static int
+midx_load_quarantined(const char* line)
+{
+	struct midx_entry *entry = NULL;
+	char path[PATH_MAX] = {0};
+	long mtime = 0;
+	long retry_at = 0;
+	int failures = 0;
+	int ret = 0;
+
+	ret = sscanf(line, "Q %ld %i %ld %4095[^\n]", &mtime, &failures,
+		     &retry_at, path);
+	if(ret != 4) {
+		utils_wrn(IDX, "Skipping malformed index line: %s", line);
+		return 0;
+	}
+
+	entry = midx_insert(path);
+	if(!entry)
+		return -1;
+	entry->mtime = (time_t) mtime;
+	entry->failures = failures;
+	entry->retry_at = (time_t) retry_at;
+	entry->flags = MIDX_QUARANTINED;
+	return 1;
+}
+
+static int
+midx_load(void)
+{
+	struct midx_info info = {0};
+	struct midx_entry *entry = NULL;
+	char line[PATH_MAX + 256] = {0};
+	char path[PATH_MAX] = {0};
+	FILE *idx_file = NULL;
+	long mtime = 0;
+	int num_loaded = 0;
+	int ret = 0;
+
+	idx_file = fopen(midx.filepath, "r");
+	if(!idx_file) {
+		utils_wrn(IDX, "No usable index found at %s, starting fresh\n",
+			  midx.filepath);
+		return 0;
+	}
+
+	/* A different version means different fields, just re-analyze */
+	if(!fgets(line, sizeof(line), idx_file) ||
+	   strncmp(line, MIDX_FILE_HEADER, strlen(MIDX_FILE_HEADER))) {
+		utils_wrn(IDX, "Index %s has an unknown format, ignoring it\n",
+			  midx.filepath);
+		goto cleanup;
+	}
+
+	while(fgets(line, sizeof(line), idx_file) != NULL) {
+		if(line[0] == 'Q') {
+			ret = midx_load_quarantined(line);
+			if(ret < 0)
+				goto cleanup;
+			num_loaded += ret;
+			continue;
+		}
+
+		ret = sscanf(line, "%ld %f %f %"SCNu64" %"SCNu64" %"SCNu64
+			     " %"SCNu32" %"SCNu32" %15s %4095[^\n]", &mtime,
+			     &info.integrated_lufs, &info.true_peak_dbtp,
+			     &info.duration_ns, &info.cue_in_ns,
+			     &info.cue_out_ns, &info.native_rate,
+			     &info.native_channels, info.native_format, path);
+		if(ret != 10) {
+			utils_wrn(IDX, "Skipping malformed index line: %s", line);
+			continue;
+		}
+
+		entry = midx_insert(path);
+		if(!entry) {
+			ret = -1;
+			goto cleanup;
+		}
+		entry->mtime = (time_t) mtime;
+		entry->info = info;
+		entry->flags = MIDX_ANALYZED;
+		num_loaded++;
+	}
+	ret = 0;
+
+	utils_info(IDX, "Loaded %i entries from %s\n", num_loaded, midx.filepath);
+
+cleanup:
+	fclose(idx_file);
+	return ret;
+}
+
+static int
+midx_save_internal(void)
+{
+	struct midx_entry *entry = NULL;
+	char tmp_filepath[PATH_MAX] = {0};
+	FILE *idx_file = NULL;
+	unsigned int i = 0;
+	int ret = 0;
+
+	if(!midx.filepath)
+		return 0;
+
+	/* Write to a temporary file and rename it over the old one, so
+	 * that we never end up with a half-written index */
+	ret = snprintf(tmp_filepath, PATH_MAX, "%s.tmp", midx.filepath);
+	if(ret >= PATH_MAX) {
+		utils_err(IDX, "Index path too long: %s\n", midx.filepath);
+		return -1;
+	}
+
+	idx_file = fopen(tmp_filepath, "w");
+	if(!idx_file) {
+		utils_perr(IDX, "Couldn't open %s", tmp_filepath);
+		return -1;
+	}
+
+	fprintf(idx_file, MIDX_FILE_HEADER"\n");
+	for(i = 0; i < midx.num_buckets; i++)
+		for(entry = midx.buckets[i]; entry; entry = entry->next) {
+			if(entry->flags & MIDX_QUARANTINED) {
+				fprintf(idx_file, "Q %ld %i %ld %s\n",
+					(long) entry->mtime, entry->failures,
+					(long) entry->retry_at, entry->filepath);
+				continue;
+			}
+			if(!(entry->flags & MIDX_ANALYZED))
+				continue;
+			fprintf(idx_file, "%ld %.2f %.2f %"PRIu64" %"PRIu64
+				" %"PRIu64" %"PRIu32" %"PRIu32" %s %s\n",
+				(long) entry->mtime,
+				entry->info.integrated_lufs,
+				entry->info.true_peak_dbtp,
+				entry->info.duration_ns,
+				entry->info.cue_in_ns,
+				entry->info.cue_out_ns,
+				entry->info.native_rate,
+				entry->info.native_channels,
+				entry->info.native_format,
+				entry->filepath);
+		}
+
+	if(fclose(idx_file) != 0) {
+		utils_perr(IDX, "Couldn't write %s", tmp_filepath);
+		return -1;
+	}
+
+	ret = rename(tmp_filepath, midx.filepath);
+	if(ret < 0) {
+		utils_perr(IDX, "Couldn't replace %s", midx.filepath);
+		return -1;
+	}
+
+	midx.unsaved = 0;
+	utils_dbg(IDX, "Saved %s\n", midx.filepath);
+	return 0;
+}
+
+
+/**************\
+* ENTRY POINTS *
+\**************/
+
+int
+midx_init(const char* index_filepath)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&midx.lock);
+
+	stats_counter_register(&midx.hits, "index_hits",
+			       "Files that were analyzed by the time we needed them");
+	stats_counter_register(&midx.misses, "index_misses",
+			       "Files that weren't analyzed when we needed them");
+	stats_counter_register(&midx.expedited, "index_prefetches",
+			       "Files moved to the head of the analysis queue");
+
+	midx.cancelled = 0;
+	ret = midx_grow();
+	if(ret < 0)
+		goto cleanup;
+
+	/* No index file means we only keep the index in memory */
+	if(!index_filepath) {
+		utils_info(IDX, "No index file set, analysis results won't persist\n");
+		goto cleanup;
+	}
+
+	midx.filepath = strdup(index_filepath);
+	if(!midx.filepath) {
+		utils_err(IDX, "Could not allocate index filepath\n");
+		ret = -1;
+		goto cleanup;
+	}
+
+	ret = midx_load();
+
+cleanup:
+	pthread_mutex_unlock(&midx.lock);
+	return ret;
+}
+
+void
+midx_cleanup(void)
+{
+	struct midx_entry *entry = NULL;
+	struct midx_entry *next = NULL;
+	unsigned int i = 0;
+
+	pthread_mutex_lock(&midx.lock);
+
+	if(midx.unsaved)
+		midx_save_internal();
+
+	for(i = 0; i < midx.num_buckets; i++)
+		for(entry = midx.buckets[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry->filepath);
+			free(entry);
+		}
+
+	free(midx.buckets);
+	midx.buckets = NULL;
+	midx.num_buckets = 0;
+	midx.num_entries = 0;
+	midx.pending_head = midx.pending_tail = NULL;
+	free(midx.filepath);
+	midx.filepath = NULL;
+
+	pthread_mutex_unlock(&midx.lock);
+}
+
+int
+midx_save(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&midx.lock);
+	ret = midx_save_internal();
+	pthread_mutex_unlock(&midx.lock);
+
+	return ret;
+}
+
+void
+midx_register_file(const char* filepath)
+{
+	struct midx_entry *entry = NULL;
+	time_t mtime = 0;
+
+	/* Not under the lock, stat() may take a while (e.g. over
+	 * NFS) and the analyzer workers / the player need it too */
+	mtime = utils_get_mtime((char*) filepath);
+
+	pthread_mutex_lock(&midx.lock);
+
+	entry = midx_lookup(filepath);
+	if(!entry) {
+		entry = midx_insert(filepath);
+		if(entry)
+			midx_queue_pending(entry);
+		goto cleanup;
+	}
+
+	/* Known to be bad, leave it alone unless it got replaced,
+	 * midx_is_quarantined() takes care of re-checking it */
+	if(entry->flags & MIDX_QUARANTINED) {
+		if(!mtime || mtime == entry->mtime)
+			goto cleanup;
+		utils_info(IDX, "File changed, releasing from quarantine: %s\n",
+			   filepath);
+		entry->flags &= ~MIDX_QUARANTINED;
+		entry->failures = 0;
+		midx.unsaved++;
+		midx_queue_pending(entry);
+		goto cleanup;
+	}
+
+	/* Not analyzed yet, or the analysis failed last time,
+	 * (re-)queue it (this is a no-op if it's already queued) */
+	if(!(entry->flags & MIDX_ANALYZED)) {
+		midx_queue_pending(entry);
+		goto cleanup;
+	}
+
+	/* File changed since we last analyzed it */
+	if(mtime && mtime != entry->mtime) {
+		utils_dbg(IDX, "File changed, re-analyzing: %s\n", filepath);
+		midx_queue_pending(entry);
+	}
+
+cleanup:
+	pthread_mutex_unlock(&midx.lock);
+}
+
+/* Blocks until there is a file to analyze, returns a copy of its
+ * path that the caller should free, or NULL if we got cancelled */
+char*
+midx_wait_pending(void)
+{
+	struct midx_entry *entry = NULL;
+	char* filepath = NULL;
+
+	pthread_mutex_lock(&midx.lock);
+
+	while(!midx.pending_head && !midx.cancelled) {
+		/* Nothing else to do, write out what's left */
+		if(midx.unsaved)
+			midx_save_internal();
+		pthread_cond_wait(&midx.pending_cond, &midx.lock);
+	}
+
+	if(midx.cancelled)
+		goto cleanup;
+
+	entry = midx.pending_head;
+	midx_unlink_pending(entry);
+	entry->flags &= ~MIDX_PENDING;
+	entry->flags |= MIDX_BUSY;
+
+	filepath = strdup(entry->filepath);
+	if(!filepath)
+		entry->flags &= ~MIDX_BUSY;
+
+cleanup:
+	pthread_mutex_unlock(&midx.lock);
+	return filepath;
+}
+
+/* Called when analysis is disabled, quarantined files get
+ * released once their back-off period is over */
+void
+midx_disable_analysis(void)
+{
+	pthread_mutex_lock(&midx.lock);
+	midx.no_analysis = 1;
+	pthread_mutex_unlock(&midx.lock);
+}
+
+void
+midx_cancel_wait(void)
+{
+	pthread_mutex_lock(&midx.lock);
+	midx.cancelled = 1;
+	pthread_cond_broadcast(&midx.pending_cond);
+	pthread_mutex_unlock(&midx.lock);
+}
+
+void
+midx_store_info(const char* filepath, time_t mtime,
+		const struct midx_info *info)
+{
+	struct midx_entry *entry = NULL;
+
+	pthread_mutex_lock(&midx.lock);
+
+	entry = midx_lookup(filepath);
+	if(!entry)
+		entry = midx_insert(filepath);
+	if(!entry)
+		goto cleanup;
+
+	if(entry->flags & MIDX_QUARANTINED)
+		utils_info(IDX, "Re-check passed, releasing from quarantine: %s\n",
+			   filepath);
+
+	entry->mtime = mtime;
+	entry->info = (*info);
+	entry->flags &= ~(MIDX_BUSY | MIDX_QUARANTINED);
+	entry->flags |= MIDX_ANALYZED;
+	entry->failures = 0;
+
+	/* Don't lose too much work if we crash */
+	if(++midx.unsaved >= MIDX_SAVE_INTERVAL)
+		midx_save_internal();
+
+cleanup:
+	pthread_mutex_unlock(&midx.lock);
+}
+
+void
+midx_store_failure(const char* filepath)
+{
+	struct midx_entry *entry = NULL;
+
+	pthread_mutex_lock(&midx.lock);
+
+	/* Leave it un-analyzed, we'll retry when the
+	 * playlist gets re-loaded and registers it again */
+	entry = midx_lookup(filepath);
+	if(entry)
+		entry->flags &= ~MIDX_BUSY;
+
+	pthread_mutex_unlock(&midx.lock);
+}
+
+/* The file couldn't be decoded, keep the scheduler away from
+ * it for a while, backing off further every time it fails */
+void
+midx_quarantine(const char* filepath, time_t mtime)
+{
+	struct midx_entry *entry = NULL;
+	long delay = MIDX_RETRY_MIN_SECS;
+	int i = 0;
+
+	pthread_mutex_lock(&midx.lock);
+
+	entry = midx_lookup(filepath);
+	if(!entry)
+		entry = midx_insert(filepath);
+	if(!entry)
+		goto cleanup;
+
+	entry->failures++;
+	for(i = 1; i < entry->failures && delay < MIDX_RETRY_MAX_SECS; i++)
+		delay *= 2;
+	if(delay > MIDX_RETRY_MAX_SECS)
+		delay = MIDX_RETRY_MAX_SECS;
+
+	entry->mtime = mtime;
+	entry->retry_at = time(NULL) + delay;
+	entry->flags &= ~(MIDX_BUSY | MIDX_ANALYZED);
+	entry->flags |= MIDX_QUARANTINED;
+
+	utils_wrn(IDX, "Quarantined (failure %i, re-check in %lis): %s\n",
+		  entry->failures, delay, filepath);
+
+	/* We may be on the player's main loop, leave
+	 * the writing to an idle analyzer worker */
+	midx.unsaved++;
+	pthread_cond_signal(&midx.pending_cond);
+
+cleanup:
+	pthread_mutex_unlock(&midx.lock);
+}
+
+/* A single hash lookup, so that the scheduler can call it on every
+ * pick. Once the back-off period is over the file goes through
+ * analysis again, but stays off the air until that succeeds
+ * (midx_store_info() releases it), if it fails again it'll be
+ * quarantined for twice as long. With analysis disabled it's
+ * released right away and the player gets to try it again. */
+int
+midx_is_quarantined(const char* filepath)
+{
+	struct midx_entry *entry = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&midx.lock);
+
+	entry = midx_lookup(filepath);
+	if(!entry || !(entry->flags & MIDX_QUARANTINED))
+		goto cleanup;
+
+	ret = 1;
+	if(time(NULL) < entry->retry_at ||
+	   (entry->flags & (MIDX_PENDING | MIDX_BUSY)))
+		goto cleanup;
+
+	/* Nobody would ever re-check it, give it to the player
+	 * instead, if it fails there again it'll come back here
+	 * for twice as long (failures is kept) */
+	if(midx.no_analysis) {
+		utils_info(IDX, "Back-off expired, releasing from "
+			   "quarantine: %s\n", filepath);
+		entry->flags &= ~MIDX_QUARANTINED;
+		midx.unsaved++;
+		ret = 0;
+		goto cleanup;
+	}
+
+	utils_info(IDX, "Re-checking quarantined file: %s\n", filepath);
+	midx_queue_pending(entry);
+
+cleanup:
+	pthread_mutex_unlock(&midx.lock);
+	return ret;
+}
+
+/* Move a file that's about to be played to the front of the
+ * analysis queue, so that it gets checked before it's needed */
+void
+midx_expedite(const char* filepath)
+{
+	struct midx_entry *entry = NULL;
+
+	pthread_mutex_lock(&midx.lock);
+
+	entry = midx_lookup(filepath);
+	if(!entry || !(entry->flags & MIDX_PENDING) ||
+	   midx.pending_head == entry)
+		goto cleanup;
+
+	midx_unlink_pending(entry);
+	entry->next_pending = midx.pending_head;
+	midx.pending_head->prev_pending = entry;
+	midx.pending_head = entry;
+
+	stats_counter_add(&midx.expedited, 1);
+	utils_dbg(IDX, "Expedited analysis of %s\n", filepath);
+
+cleanup:
+	pthread_mutex_unlock(&midx.lock);
+}
+
+int
+midx_get_info(const char* filepath, struct midx_info *info)
+{
+	struct midx_entry *entry = NULL;
+	int ret = -1;
+
+	pthread_mutex_lock(&midx.lock);
+
+	entry = midx_lookup(filepath);
+	if(entry && (entry->flags & MIDX_ANALYZED)) {
+		(*info) = entry->info;
+		info->mtime = entry->mtime;
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&midx.lock);
+
+	stats_counter_add(ret ? &midx.misses : &midx.hits, 1);
+	return ret;
+}
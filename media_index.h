@@ -0,0 +1,95 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Media library index
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MEDIA_INDEX_H__
+#define __MEDIA_INDEX_H__
+
+#include <time.h>	/* For time_t */
+#include <stdint.h>	/* For uint64_t */
+
+/* Per-file information gathered by the offline analyzer */
+struct midx_info {
+	/* EBU R128 integrated loudness (LUFS) */
+	float	integrated_lufs;
+	/* ITU-R BS.1770 true peak (dBTP) */
+	float	true_peak_dbtp;
+	/* Decoded duration and the first / last non-silent
+	 * position, all in nanoseconds */
+	uint64_t duration_ns;
+	uint64_t cue_in_ns;
+	uint64_t cue_out_ns;
+	/* What the decoder produces on its own, so that the
+	 * player can skip conversion when it matches the mix */
+	uint32_t native_rate;
+	uint32_t native_channels;
+	char	native_format[16];
+	/* Of the file as it got analyzed, only
+	 * filled in by midx_get_info() */
+	time_t	mtime;
+};
+
+enum midx_flags {
+	MIDX_PENDING	= 0x1,
+	MIDX_BUSY	= 0x2,
+	MIDX_ANALYZED	= 0x4,
+	MIDX_QUARANTINED = 0x8,
+};
+
+struct midx_entry {
+	char*	filepath;
+	time_t	mtime;
+	int	flags;
+	struct	midx_info info;
+	/* Consecutive failures and when to give it another
+	 * chance, while quarantined */
+	int	failures;
+	time_t	retry_at;
+	/* Hash chain */
+	struct	midx_entry *next;
+	/* Analysis queue, doubly linked so that an
+	 * entry can be moved to the front in O(1) */
+	struct	midx_entry *next_pending;
+	struct	midx_entry *prev_pending;
+};
+
+int midx_init(const char* index_filepath);
+void midx_cleanup(void);
+int midx_save(void);
+
+/* Playlist side */
+void midx_register_file(const char* filepath);
+
+/* Analyzer side */
+char* midx_wait_pending(void);
+void midx_cancel_wait(void);
+void midx_disable_analysis(void);
+void midx_store_info(const char* filepath, time_t mtime,
+		     const struct midx_info *info);
+void midx_store_failure(const char* filepath);
+void midx_quarantine(const char* filepath, time_t mtime);
+
+/* Player side */
+int midx_get_info(const char* filepath, struct midx_info *info);
+
+/* Scheduler side */
+int midx_is_quarantined(const char* filepath);
+void midx_expedite(const char* filepath);
+
+#endif /* __MEDIA_INDEX_H__ */
@@ -18,152 +18,1250 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE	/* For accept4() */
 #include <netinet/ip.h>	/* For IP stuff (also brings in socket etc) */
-#include <arpa/inet.h>	/* For inet_aton */
-#include <stdlib.h>	/* For malloc() / free() */
-#include <string.h>	/* For memset() */
-#include <stdio.h>	/* For snprintf() */
+#include <netinet/tcp.h>	/* For TCP_NODELAY */
+#include <arpa/inet.h>	/* For inet_pton() / inet_ntop() */
+#include <sys/epoll.h>	/* For epoll_*() */
+#include <sys/eventfd.h>	/* For eventfd() */
+#include <stdlib.h>	/* For malloc() / realloc() / free() */
+#include <string.h>	/* For memset() / memmove() / strstr() */
+#include <strings.h>	/* For strncasecmp() */
+#include <stdio.h>	/* For snprintf() / sscanf() */
 #include <unistd.h>	/* For read/write */
+#include <sys/uio.h>	/* For struct iovec */
 #include <errno.h>	/* For errno */
 #include <time.h>	/* For time() / gmtime() / strftime() */
+#include <sched.h>	/* For sched_yield() */
+#include <fcntl.h>	/* For O_* flags */
+#include <signal.h>	/* For kill() */
+#include <sys/mman.h>	/* For shm_open() / mmap() */
+#include <sys/syscall.h>	/* For SYS_futex */
+#include <linux/futex.h>	/* For FUTEX_WAKE */
 #include "meta_handler.h"
+#include "json_writer.h"
+#include "stats.h"
 #include "utils.h"
 
+/* Web frontends poll us every second or so, keep their
+ * connections open instead of setting up a new one on
+ * every request, and drop them if they go quiet */
+#define META_MAX_EVENTS		64
+#define META_MAX_CLIENTS	4096
+#define META_IDLE_TIMEOUT_SECS	30
+/* Request line and headers, we don't accept bodies */
+#define META_REQ_LEN		4096
+
+/* Displays and the like can subscribe instead, either with an
+ * event stream (/events) that gets an update every time something
+ * visible changes, or with long-polling (/poll?since=<version>)
+ * that returns once there is a version newer than the given one,
+ * or after META_POLL_TIMEOUT_SECS with the one they already have.
+ * Event streams get a comment every META_SSE_PING_SECS so that
+ * proxies keep them open, and are dropped if they fall behind by
+ * more than META_MAX_BACKLOG. */
+#define META_POLL_TIMEOUT_SECS	25
+#define META_SSE_PING_SECS	15
+#define META_MAX_BACKLOG	(64 * 1024)
+
+struct meta_client {
+	int	fd;
+	int	keep_alive;
+	int	closing;
+	/* Shut down its side, gets answers to what it
+	 * sent so far and then we close */
+	int	eof;
+	/* Subscribed to /events */
+	int	streaming;
+	/* Waiting on /poll, until poll_deadline */
+	int	waiting;
+	time_t	poll_deadline;
+	uint32_t events;
+	time_t	last_active;
+	char	req[META_REQ_LEN + 1];
+	size_t	req_len;
+	/* Pending response */
+	char*	resp;
+	size_t	resp_size;
+	size_t	resp_len;
+	size_t	resp_off;
+	struct meta_client *prev;
+	struct meta_client *next;
+};
+
+struct meta_request {
+	char	method[16];
+	char	path[256];
+	char	if_none_match[128];
+	uint64_t last_event_id;
+	int	keep_alive;
+};
+
+/* FNV-1a, for telling if the rendered state changed */
+#define META_HASH_INIT	0xcbf29ce484222325ULL
+#define META_HASH_PRIME	0x100000001b3ULL
+
+static int meta_client_process(struct meta_handler *mh, struct meta_client *cl);
+
 
 /*********\
 * HELPERS *
 \*********/
 
 static int
-meta_create_server_socket(uint16_t port, const char* ip4addr)
+meta_create_server_socket(uint16_t port, const char* addr)
 {
-	struct sockaddr_in name = {0};
+	struct sockaddr_storage name = {0};
+	struct sockaddr_in6 *name6 = (struct sockaddr_in6 *) &name;
+	struct sockaddr_in *name4 = (struct sockaddr_in *) &name;
+	int family = AF_INET6;
 	int sockfd = 0;
+	int one = 1;
+	int zero = 0;
 	int ret = 0;
 
+	/* Check if it's an ipv6 or an ipv4 address, with
+	 * no address we go for both through a dual-stack
+	 * socket (v4 clients show up as ::ffff:a.b.c.d) */
+	if(addr != NULL) {
+		if(inet_pton(AF_INET6, addr, &name6->sin6_addr) == 1)
+			family = AF_INET6;
+		else if(inet_pton(AF_INET, addr, &name4->sin_addr) == 1)
+			family = AF_INET;
+		else {
+			utils_err(META, "Invalid address: %s\n", addr);
+			return -EINVAL;
+		}
+	} else
+		name6->sin6_addr = in6addr_any;
+
 	/* Create the socket. */
-	sockfd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	sockfd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sockfd < 0 && addr == NULL && errno == EAFNOSUPPORT) {
+		/* Kernel without ipv6, fall back to ipv4 only */
+		utils_wrn(META, "No IPv6 support, listening on IPv4 only\n");
+		family = AF_INET;
+		name4->sin_addr.s_addr = htonl(INADDR_ANY);
+		sockfd = socket(family, SOCK_STREAM | SOCK_NONBLOCK |
+				SOCK_CLOEXEC, 0);
+	}
 	if (sockfd < 0) {
 		utils_perr(META, "Could not create server socket");
 		return -errno;
 	}
 
-	/* Check if it's an ipv4 address */
-	if(ip4addr != NULL) {
-		ret = inet_aton(ip4addr, &name.sin_addr);
-		if(ret != 0)
-			return -EINVAL;
-	} else
-		name.sin_addr.s_addr = htonl(INADDR_ANY);
+	/* Don't wait for TIME_WAIT sockets after a restart */
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
 
 	/* Give the socket a name. */
-	name.sin_family = AF_INET;
-	name.sin_port = htons(port);
-	ret = bind(sockfd, (struct sockaddr *) &name, sizeof (name));
+	if(family == AF_INET6) {
+		/* The default depends on net.ipv6.bindv6only, only
+		 * the wildcard address can accept both anyway */
+		if(addr == NULL)
+			setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &zero,
+				   sizeof(zero));
+		name6->sin6_family = AF_INET6;
+		name6->sin6_port = htons(port);
+		ret = bind(sockfd, (struct sockaddr *) name6, sizeof(*name6));
+	} else {
+		name4->sin_family = AF_INET;
+		name4->sin_port = htons(port);
+		ret = bind(sockfd, (struct sockaddr *) name4, sizeof(*name4));
+	}
 	if (ret < 0) {
 		utils_perr(META, "Could not bind server socket");
-		return -errno;
+		ret = -errno;
+		close(sockfd);
+		return ret;
 	}
 
 	return sockfd;
 }
 
+/* Fills in buf with "addr:port" ("[addr]:port" for ipv6) */
 static void
-meta_server_thread_cleanup(void* arg)
+meta_format_peer(const struct sockaddr_storage *peer, char* buf, size_t len)
 {
-	struct meta_handler *mh = (struct meta_handler*) arg;
-	mh->active = 0;
-	pthread_mutex_unlock(&mh->state.proc_mutex);
-	close(mh->sockfd);
-	utils_dbg(META, "Server thread terminated\n");
+	const struct sockaddr_in6 *peer6 = (const struct sockaddr_in6 *) peer;
+	const struct sockaddr_in *peer4 = (const struct sockaddr_in *) peer;
+	char addr[INET6_ADDRSTRLEN] = {0};
+
+	if(peer->ss_family == AF_INET6) {
+		inet_ntop(AF_INET6, &peer6->sin6_addr, addr, sizeof(addr));
+		snprintf(buf, len, "[%s]:%i", addr, ntohs(peer6->sin6_port));
+	} else if(peer->ss_family == AF_INET) {
+		inet_ntop(AF_INET, &peer4->sin_addr, addr, sizeof(addr));
+		snprintf(buf, len, "%s:%i", addr, ntohs(peer4->sin_port));
+	} else
+		snprintf(buf, len, "unknown");
 }
 
+static int
+meta_client_set_events(struct meta_handler *mh, struct meta_client *cl,
+		       uint32_t events)
+{
+	struct epoll_event ev = {0};
+
+	if(cl->events == events)
+		return 0;
 
-/*****************\
-* SERVER CALLBACK *
-\*****************/
+	ev.events = events;
+	ev.data.ptr = cl;
+	if(epoll_ctl(mh->epfd, EPOLL_CTL_MOD, cl->fd, &ev) < 0) {
+		utils_pwrn(META, "Could not update client events");
+		return -1;
+	}
+	cl->events = events;
+	return 0;
+}
 
+static void
+meta_client_close(struct meta_handler *mh, struct meta_client *cl)
+{
+	/* Closing the fd also removes it from the epoll set */
+	close(cl->fd);
+
+	if(cl->prev)
+		cl->prev->next = cl->next;
+	else
+		mh->clients = cl->next;
+	if(cl->next)
+		cl->next->prev = cl->prev;
+	mh->num_clients--;
+
+	free(cl->resp);
+	free(cl);
+}
+
+static void
+meta_accept_clients(struct meta_handler *mh)
+{
+	struct sockaddr_storage clientname = {0};
+	char peer[INET6_ADDRSTRLEN + 16] = {0};
+	struct epoll_event ev = {0};
+	struct meta_client *cl = NULL;
+	socklen_t size = 0;
+	int one = 1;
+	int fd = 0;
+
+	while(1) {
+		size = sizeof(clientname);
+		fd = accept4(mh->sockfd, (struct sockaddr *) &clientname,
+			     &size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK &&
+			   errno != EINTR && errno != ECONNABORTED)
+				utils_pwrn(META, "accept() failed");
+			return;
+		}
+
+		meta_format_peer(&clientname, peer, sizeof(peer));
+
+		if(mh->num_clients >= META_MAX_CLIENTS) {
+			utils_wrn(META, "Too many clients, dropping %s\n",
+				  peer);
+			close(fd);
+			continue;
+		}
+
+		cl = calloc(1, sizeof(struct meta_client));
+		if(!cl) {
+			utils_perr(META, "Could not allocate client");
+			close(fd);
+			continue;
+		}
+		cl->fd = fd;
+		cl->last_active = time(NULL);
+		cl->events = EPOLLIN;
+
+		/* Responses go out in one piece */
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		ev.events = cl->events;
+		ev.data.ptr = cl;
+		if(epoll_ctl(mh->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			utils_pwrn(META, "Could not add client");
+			close(fd);
+			free(cl);
+			continue;
+		}
+
+		cl->next = mh->clients;
+		if(mh->clients)
+			mh->clients->prev = cl;
+		mh->clients = cl;
+		mh->num_clients++;
+
+		utils_dbg(META, "Connection from host %s\n", peer);
+	}
+}
+
+/* Returns the length of the request (up to and including
+ * the empty line), 0 if we need more data, -1 on error */
 static int
-meta_server_callback(struct meta_handler *mh, int sockfd)
+meta_parse_request(struct meta_client *cl, struct meta_request *req)
+{
+	char* end = NULL;
+	char* line = NULL;
+	char* eol = NULL;
+	char* value = NULL;
+	int major = 0;
+	int minor = 0;
+	int req_len = 0;
+
+	cl->req[cl->req_len] = '\0';
+	end = strstr(cl->req, "\r\n\r\n");
+	if(!end)
+		return cl->req_len >= META_REQ_LEN ? -1 : 0;
+	req_len = end - cl->req + 4;
+
+	/* Terminate the header block, so that we can
+	 * use string functions on it */
+	end[2] = '\0';
+
+	if(sscanf(cl->req, "%15s %255s HTTP/%i.%i", req->method, req->path,
+		  &major, &minor) != 4 || major != 1)
+		return -1;
+
+	/* Persistent by default on 1.1, not on 1.0 */
+	req->keep_alive = (minor >= 1);
+
+	for(line = strstr(cl->req, "\r\n") + 2; *line; line = eol + 2) {
+		eol = strstr(line, "\r\n");
+		if(!eol)
+			break;
+		if(!strncasecmp(line, "Last-Event-ID:", 14)) {
+			req->last_event_id = strtoull(line + 14, NULL, 10);
+			continue;
+		}
+		if(!strncasecmp(line, "If-None-Match:", 14)) {
+			value = line + 14;
+			while(*value == ' ' || *value == '\t')
+				value++;
+			snprintf(req->if_none_match,
+				 sizeof(req->if_none_match), "%.*s",
+				 (int) (eol - value), value);
+			continue;
+		}
+		if(strncasecmp(line, "Connection:", 11))
+			continue;
+		value = line + 11;
+		while(*value == ' ' || *value == '\t')
+			value++;
+		if(!strncasecmp(value, "close", 5))
+			req->keep_alive = 0;
+		else if(!strncasecmp(value, "keep-alive", 10))
+			req->keep_alive = 1;
+	}
+
+	return req_len;
+}
+
+/* The Date header only changes once a second */
+static const char*
+meta_get_date_hdr(struct meta_handler *mh)
+{
+	time_t now = time(NULL);
+	struct tm tm = {0};
+
+	if(now == mh->date_time)
+		return mh->date_hdr;
+
+	gmtime_r(&now, &tm);
+	strftime(mh->date_hdr, sizeof(mh->date_hdr),
+		 "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+	mh->date_time = now;
+
+	return mh->date_hdr;
+}
+
+static int
+meta_client_reserve(struct meta_client *cl, size_t len)
+{
+	char* resp = NULL;
+	size_t needed = cl->resp_len + len;
+
+	if(needed <= cl->resp_size)
+		return 0;
+
+	resp = realloc(cl->resp, needed);
+	if(!resp) {
+		utils_perr(META, "Could not allocate response");
+		return -1;
+	}
+	cl->resp = resp;
+	cl->resp_size = needed;
+
+	return 0;
+}
+
+/* Appends a full response to the client's output */
+static int
+meta_queue_response(struct meta_handler *mh, struct meta_client *cl,
+		    const char* status, const char* content_type,
+		    const char* body, int len, int head_only)
 {
-	struct current_state *st = &mh->state;
-	struct song_info *curr = &st->current;
-	struct song_info *next = &st->next;
-	time_t now = 0;
-	struct tm *tm = NULL;
-	char date_str[64] = {0};
-	int len = 0;
 	int ret = 0;
 
-	/* Ignore input */
-	while(recv(sockfd, NULL, 0, MSG_TRUNC | MSG_OOB) > 0);
+	/* Headers are way less than this */
+	if(meta_client_reserve(cl, 512 + (head_only ? 0 : len)) < 0)
+		return -1;
 
-	/* Buffer freed */
-	if(mh->msg_buff == NULL)
+	ret = snprintf(cl->resp + cl->resp_len, 512,
+		       "HTTP/1.1 %s\r\n"
+		       "Server: audio-scheduler\r\n"
+		       "%s"
+		       "Content-Length: %i\r\n"
+		       "Content-type: %s\r\n"
+		       "Pragma: no-cache\r\n"
+		       "Cache-Control: no-cache\r\n"
+		       "Connection: %s\r\n\r\n",
+		       status, meta_get_date_hdr(mh), len, content_type,
+		       cl->keep_alive ? "keep-alive" : "close");
+	if(ret < 0 || ret >= 512)
 		return -1;
+	cl->resp_len += ret;
 
-	/* Create JSON message */
-	pthread_mutex_lock(&st->proc_mutex);
-	snprintf(mh->msg_buff, ST_STRING_LEN,
-		"{\n\t\"current_song\": {\n\t\t"
-		"\"Artist\": \"%s\",\n\t\t"
-		"\"Album\": \"%s\",\n\t\t"
-		"\"Title\": \"%s\",\n\t\t"
-		"\"Path\": \"%s\",\n\t\t"
-		"\"Duration\": \"%i\",\n\t\t"
-		"\"Elapsed\": \"%i\",\n\t\t"
-		"\"Zone\": \"%s\"\n\t\t},\n"
-		"\t\"next_song\": {\n\t\t"
-		"\"Artist\": \"%s\",\n\t\t"
-		"\"Album\": \"%s\",\n\t\t"
-		"\"Title\": \"%s\",\n\t\t"
-		"\"Path\": \"%s\",\n\t\t"
-		"\"Duration\": \"%i\",\n\t\t"
-		"\"Elapsed\": \"%i\",\n\t\t"
-		"\"Zone\": \"%s\"\n\t\t},\n"
-		"\t\"overlap\": \"%i\"\n}\r\n",
-		curr->artist,
-		curr->album,
-		curr->title,
-		curr->path,
-		curr->duration_sec,
-		curr->elapsed_sec,
-		curr->zone,
-		next->artist,
-		next->album,
-		next->title,
-		next->path,
-		next->duration_sec,
-		next->elapsed_sec,
-		next->zone,
-		st->overlap_sec);
-	pthread_mutex_unlock(&st->proc_mutex);
-
-	now = time(NULL);
-	tm = gmtime(&now);
-	strftime(date_str, 64, "%a, %d %b %Y %H:%M:%S %Z", tm);
-
-	len = strnlen(mh->msg_buff, ST_STRING_LEN);
-
-	dprintf(sockfd, "HTTP/1.1 200 OK\r\n"
-			"Server: audio-scheduler\r\n"
-			"Date: %s\r\n"
-			"Content-Length: %i\r\n"
-			"Content-type: application/json; charset=utf-8\r\n"
-			"Pragma: no-cache\r\n"
-			"Cache-Control: no-cache\r\n"
-			"Connection: Closed\r\n\r\n",
-			date_str, len);
-
-	ret = write(sockfd, mh->msg_buff, len);
-	if(ret < 0 || ret != len)
-		utils_pwrn(META, "Write error");
-
-	shutdown(sockfd, SHUT_WR);
+	if(!head_only && len > 0) {
+		memcpy(cl->resp + cl->resp_len, body, len);
+		cl->resp_len += len;
+	}
 
 	return 0;
 }
 
+/* Sends as much of the pending response as the socket takes,
+ * returns -1 if the client should be dropped */
+static int
+meta_client_flush(struct meta_handler *mh, struct meta_client *cl)
+{
+	ssize_t ret = 0;
+
+	while(cl->resp_off < cl->resp_len) {
+		ret = send(cl->fd, cl->resp + cl->resp_off,
+			   cl->resp_len - cl->resp_off, MSG_NOSIGNAL);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return meta_client_set_events(mh, cl, EPOLLOUT);
+		if(ret < 0) {
+			utils_dbg(META, "Write error: %s\n", strerror(errno));
+			return -1;
+		}
+		cl->resp_off += ret;
+	}
+
+	cl->resp_off = cl->resp_len = 0;
+
+	/* Subscribers don't send anything else, we
+	 * only need to know if they went away */
+	if(cl->streaming || cl->waiting)
+		return meta_client_set_events(mh, cl, EPOLLRDHUP);
+
+	if(cl->closing || (cl->eof && !cl->req_len))
+		return -1;
+
+	return meta_client_set_events(mh, cl, EPOLLIN);
+}
+
+/* Tries to send a response straight from iov, whatever
+ * doesn't go out is copied for meta_client_flush() */
+static int
+meta_client_sendv(struct meta_client *cl, struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg = {0};
+	ssize_t ret = 0;
+	size_t skip = 0;
+	int i = 0;
+
+	/* Like writev() but without SIGPIPE */
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	do {
+		ret = sendmsg(cl->fd, &msg, MSG_NOSIGNAL);
+	} while(ret < 0 && errno == EINTR);
+
+	if(ret < 0) {
+		if(errno != EAGAIN && errno != EWOULDBLOCK) {
+			utils_dbg(META, "Write error: %s\n", strerror(errno));
+			return -1;
+		}
+		ret = 0;
+	}
+
+	skip = ret;
+	for(i = 0; i < iovcnt; i++) {
+		if(skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		if(meta_client_reserve(cl, iov[i].iov_len - skip) < 0)
+			return -1;
+		memcpy(cl->resp + cl->resp_len,
+		       (char*) iov[i].iov_base + skip, iov[i].iov_len - skip);
+		cl->resp_len += iov[i].iov_len - skip;
+		skip = 0;
+	}
+
+	return 0;
+}
+
+/* Sends data to a subscriber, behind anything that's still
+ * pending, returns -1 if it should be dropped */
+static int
+meta_client_stream(struct meta_handler *mh, struct meta_client *cl,
+		   const char* data, size_t len)
+{
+	struct iovec iov = {0};
+
+	if(cl->resp_len) {
+		if(cl->resp_len - cl->resp_off > META_MAX_BACKLOG) {
+			utils_dbg(META, "Dropping slow subscriber %i\n",
+				  cl->fd);
+			return -1;
+		}
+		if(meta_client_reserve(cl, len) < 0)
+			return -1;
+		memcpy(cl->resp + cl->resp_len, data, len);
+		cl->resp_len += len;
+		return 0;
+	}
+
+	iov.iov_base = (void*) data;
+	iov.iov_len = len;
+	if(meta_client_sendv(cl, &iov, 1) < 0)
+		return -1;
+
+	/* Didn't make it out in one piece, wait for EPOLLOUT */
+	if(cl->resp_len)
+		return meta_client_flush(mh, cl);
+
+	return 0;
+}
+
+static void
+meta_song_set_elapsed(struct song_info *song, uint64_t now)
+{
+	uint64_t elapsed = 0;
+
+	if(song->start_usecs && now > song->start_usecs)
+		elapsed = (now - song->start_usecs) / 1000000ULL;
+	if(elapsed > song->duration_sec)
+		elapsed = song->duration_sec;
+
+	song->elapsed_sec = (uint32_t) elapsed;
+}
+
+static int
+meta_etag_matches(const char* if_none_match, const char* etag)
+{
+	if(!if_none_match[0])
+		return 0;
+	if(!strcmp(if_none_match, "*"))
+		return 1;
+	/* Could be a list, possibly with weak tags */
+	return strstr(if_none_match, etag) != NULL;
+}
+
+/* The now-playing document has always had numbers as strings,
+ * keep it that way for existing clients */
+static void
+meta_json_kv_numstr(struct json_writer *jw, const char* key, uint32_t val)
+{
+	char num[12] = {0};
+
+	snprintf(num, sizeof(num), "%u", val);
+	json_kv_string(jw, key, num);
+}
+
+static void
+meta_json_song(struct json_writer *jw, const char* key,
+	       const struct song_info *song)
+{
+	json_key(jw, key);
+	json_begin_object(jw);
+	json_kv_string(jw, "Artist", song->artist);
+	json_kv_string(jw, "Album", song->album);
+	json_kv_string(jw, "Title", song->title);
+	json_kv_string(jw, "Path", song->path);
+	meta_json_kv_numstr(jw, "Duration", song->duration_sec);
+	meta_json_kv_numstr(jw, "Elapsed", song->elapsed_sec);
+	json_kv_string(jw, "Zone", song->zone);
+	json_end_object(jw);
+}
+
+/* Renders the JSON body into mh->json */
+static int
+meta_render_state(struct meta_handler *mh, const struct current_state *st)
+{
+	struct json_writer *jw = &mh->json;
+
+	json_reset(jw);
+	json_begin_object(jw);
+	meta_json_song(jw, "current_song", &st->current);
+	meta_json_song(jw, "next_song", &st->next);
+	meta_json_kv_numstr(jw, "overlap", st->overlap_sec);
+	json_end_object(jw);
+	json_raw(jw, "\r\n", 2);
+
+	return json_finish(jw);
+}
+
+static uint64_t
+meta_hash(uint64_t hash, const void* data, size_t len)
+{
+	const unsigned char *bytes = data;
+	size_t i = 0;
+
+	for(i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= META_HASH_PRIME;
+	}
+
+	return hash;
+}
+
+static uint64_t
+meta_hash_song(uint64_t hash, const struct song_info *song)
+{
+	hash = meta_hash(hash, song->artist, strlen(song->artist) + 1);
+	hash = meta_hash(hash, song->album, strlen(song->album) + 1);
+	hash = meta_hash(hash, song->title, strlen(song->title) + 1);
+	hash = meta_hash(hash, song->path, strlen(song->path) + 1);
+	hash = meta_hash(hash, song->zone, strlen(song->zone) + 1);
+	return meta_hash(hash, &song->duration_sec,
+			 sizeof(song->duration_sec));
+}
+
+/* What the ETag is made of: everything in the response but the
+ * elapsed times, that go up every second while a song plays (and
+ * that clients can work out themselves), or we'd hardly ever get
+ * to send a 304 */
+static uint64_t
+meta_hash_state(const struct current_state *st)
+{
+	uint64_t hash = META_HASH_INIT;
+
+	hash = meta_hash_song(hash, &st->current);
+	hash = meta_hash_song(hash, &st->next);
+	return meta_hash(hash, &st->overlap_sec, sizeof(st->overlap_sec));
+}
+
+/* Everything apart from the status line, the Date and the
+ * Connection headers, that meta_server_callback() adds */
+static struct meta_response*
+meta_build_response(uint64_t version, uint64_t etag_hash, const char* body,
+		    size_t body_len)
+{
+	struct meta_response *resp = NULL;
+	size_t hdr_max = 512;
+	int ret = 0;
+
+	resp = malloc(sizeof(struct meta_response) + 2 * hdr_max + body_len);
+	if(!resp) {
+		utils_perr(META, "Could not allocate response");
+		return NULL;
+	}
+	resp->version = version;
+	snprintf(resp->etag, sizeof(resp->etag), "W/\"%016llx\"",
+		 (unsigned long long) etag_hash);
+
+	ret = snprintf(resp->data, hdr_max,
+		       "Server: audio-scheduler\r\n"
+		       "Content-Length: %zu\r\n"
+		       "Content-type: application/json; charset=utf-8\r\n"
+		       "ETag: %s\r\n"
+		       "Pragma: no-cache\r\n"
+		       "Cache-Control: no-cache\r\n\r\n",
+		       body_len, resp->etag);
+	if(ret < 0 || (size_t) ret >= hdr_max)
+		goto fail;
+	resp->hdr_len = ret;
+	memcpy(resp->data + resp->hdr_len, body, body_len);
+	resp->len = resp->hdr_len + body_len;
+
+	resp->nm_off = resp->len;
+	ret = snprintf(resp->data + resp->nm_off, hdr_max,
+		       "Server: audio-scheduler\r\n"
+		       "ETag: %s\r\n"
+		       "Cache-Control: no-cache\r\n\r\n",
+		       resp->etag);
+	if(ret < 0 || (size_t) ret >= hdr_max)
+		goto fail;
+	resp->nm_len = ret;
+
+	return resp;
+
+ fail:
+	free(resp);
+	return NULL;
+}
+
+/* When the elapsed time of one of the songs goes up next */
+static uint64_t
+meta_next_tick(const struct current_state *st)
+{
+	const struct song_info *songs[2] = {&st->current, &st->next};
+	uint64_t next_tick = UINT64_MAX;
+	uint64_t tick = 0;
+	int i = 0;
+
+	for(i = 0; i < 2; i++) {
+		if(!songs[i]->start_usecs ||
+		   songs[i]->elapsed_sec >= songs[i]->duration_sec)
+			continue;
+		tick = songs[i]->start_usecs +
+		       (uint64_t) (songs[i]->elapsed_sec + 1) * 1000000ULL;
+		if(tick < next_tick)
+			next_tick = tick;
+	}
+
+	return next_tick;
+}
+
+/* Re-renders the response if the state changed since the last time,
+ * or if it has an elapsed time that went stale; the state is read
+ * without locking, so the player never waits for us */
+static struct meta_response*
+meta_get_response(struct meta_handler *mh)
+{
+	struct current_state *st = &mh->snapshot;
+	struct meta_response *resp = NULL;
+	uint32_t seq = __atomic_load_n(&mh->state.seq, __ATOMIC_ACQUIRE);
+	uint64_t hash = 0;
+	int len = 0;
+
+	if(mh->resp && seq == mh->resp_seq &&
+	   stats_get_usecs() < mh->resp_valid_until)
+		return mh->resp;
+
+	meta_state_read(mh, st);
+	len = meta_render_state(mh, st);
+	if(len < 0)
+		return mh->resp;
+
+	/* Nothing visible changed, keep the response */
+	hash = meta_hash(META_HASH_INIT, mh->json.buf, len);
+	if(!mh->resp || hash != mh->hash) {
+		resp = meta_build_response(mh->version + 1,
+					   meta_hash_state(st),
+					   mh->json.buf, len);
+		if(!resp)
+			return mh->resp;
+		free(mh->resp);
+		mh->resp = resp;
+		mh->version++;
+		mh->hash = hash;
+	}
+
+	mh->resp_seq = st->seq;
+	mh->resp_valid_until = meta_next_tick(st);
+	return mh->resp;
+}
+
+/* Start times are recomputed on every update of the player, they
+ * only count as a change if they moved by more than this */
+#define META_START_TOLERANCE_USECS	500000
+
+static long long
+meta_unix_msecs(struct meta_handler *mh, uint64_t usecs)
+{
+	if(!usecs)
+		return 0;
+	return ((int64_t) usecs + mh->realtime_offset) / 1000;
+}
+
+static void
+meta_json_update_song(struct meta_handler *mh, const char* key,
+		      const struct song_info *song)
+{
+	struct json_writer *jw = &mh->push_json;
+
+	json_key(jw, key);
+	json_begin_object(jw);
+	json_kv_string(jw, "Artist", song->artist);
+	json_kv_string(jw, "Album", song->album);
+	json_kv_string(jw, "Title", song->title);
+	json_kv_string(jw, "Path", song->path);
+	json_kv_string(jw, "Zone", song->zone);
+	json_kv_uint(jw, "Duration", song->duration_sec);
+	json_kv_int(jw, "Start", meta_unix_msecs(mh, song->start_usecs));
+	json_end_object(jw);
+}
+
+/* One line of JSON, without elapsed times (subscribers can work
+ * them out from Start, in msecs since the Epoch), so that it only
+ * changes when there's something to tell */
+static int
+meta_render_update(struct meta_handler *mh, const struct current_state *st,
+		   uint64_t version, int fading)
+{
+	struct json_writer *jw = &mh->push_json;
+
+	json_reset(jw);
+	json_begin_object(jw);
+	json_kv_uint(jw, "version", version);
+	meta_json_update_song(mh, "current_song", &st->current);
+	meta_json_update_song(mh, "next_song", &st->next);
+	json_kv_uint(jw, "overlap", st->overlap_sec);
+	json_kv_bool(jw, "fading", fading);
+	json_end_object(jw);
+
+	return json_finish(jw);
+}
+
+static struct meta_push*
+meta_build_push(uint64_t version, const char* body, size_t body_len)
+{
+	struct meta_push *push = NULL;
+	size_t hdr_max = 256;
+	int ret = 0;
+
+	/* SSE framing is way less than hdr_max too */
+	push = malloc(sizeof(struct meta_push) + 2 * hdr_max + 2 * body_len);
+	if(!push) {
+		utils_perr(META, "Could not allocate update");
+		return NULL;
+	}
+	push->version = version;
+
+	ret = snprintf(push->data, hdr_max,
+		       "Server: audio-scheduler\r\n"
+		       "Content-Length: %zu\r\n"
+		       "Content-type: application/json; charset=utf-8\r\n"
+		       "Cache-Control: no-cache\r\n\r\n",
+		       body_len);
+	if(ret < 0 || (size_t) ret >= hdr_max)
+		goto fail;
+	push->hdr_len = ret;
+	memcpy(push->data + ret, body, body_len);
+	push->poll_len = ret + body_len;
+
+	push->sse_off = push->poll_len;
+	ret = snprintf(push->data + push->sse_off, hdr_max,
+		       "id: %llu\nevent: now-playing\ndata: ",
+		       (unsigned long long) version);
+	if(ret < 0 || (size_t) ret >= hdr_max - 2)
+		goto fail;
+	memcpy(push->data + push->sse_off + ret, body, body_len);
+	memcpy(push->data + push->sse_off + ret + body_len, "\n\n", 2);
+	push->sse_len = ret + body_len + 2;
+
+	return push;
+
+ fail:
+	free(push);
+	return NULL;
+}
+
+static int
+meta_push_changed(struct meta_handler *mh, const struct current_state *st,
+		  int fading)
+{
+	const struct song_info *songs[2] = {&st->current, &st->next};
+	struct song_info song;
+	uint64_t hash = META_HASH_INIT;
+	uint64_t diff = 0;
+	int changed = 0;
+	int i = 0;
+
+	for(i = 0; i < 2; i++) {
+		memcpy(&song, songs[i], sizeof(struct song_info));
+		song.start_usecs = 0;
+		song.elapsed_sec = 0;
+		hash = meta_hash(hash, &song, sizeof(struct song_info));
+
+		diff = songs[i]->start_usecs > mh->push_start[i] ?
+		       songs[i]->start_usecs - mh->push_start[i] :
+		       mh->push_start[i] - songs[i]->start_usecs;
+		if(diff > META_START_TOLERANCE_USECS ||
+		   (!songs[i]->start_usecs != !mh->push_start[i]))
+			changed = 1;
+	}
+	hash = meta_hash(hash, &st->overlap_sec, sizeof(st->overlap_sec));
+	hash = meta_hash(hash, &fading, sizeof(fading));
+
+	if(hash != mh->push_hash)
+		changed = 1;
+	if(!changed)
+		return 0;
+
+	mh->push_hash = hash;
+	mh->push_start[0] = st->current.start_usecs;
+	mh->push_start[1] = st->next.start_usecs;
+	return 1;
+}
+
+/* Sends an update to a long-polling client, along with
+ * the status line and the headers that vary */
+static int
+meta_client_send_push(struct meta_handler *mh, struct meta_client *cl,
+		      struct meta_push *push, int head_only)
+{
+	static const char ok[] = "HTTP/1.1 200 OK\r\n";
+	static const char conn_keep_alive[] = "Connection: keep-alive\r\n";
+	static const char conn_close[] = "Connection: close\r\n";
+	const char* date_hdr = meta_get_date_hdr(mh);
+	struct iovec iov[4];
+
+	iov[0].iov_base = (void*) ok;
+	iov[0].iov_len = sizeof(ok) - 1;
+	iov[1].iov_base = (void*) date_hdr;
+	iov[1].iov_len = strlen(date_hdr);
+	if(cl->keep_alive) {
+		iov[2].iov_base = (void*) conn_keep_alive;
+		iov[2].iov_len = sizeof(conn_keep_alive) - 1;
+	} else {
+		iov[2].iov_base = (void*) conn_close;
+		iov[2].iov_len = sizeof(conn_close) - 1;
+	}
+	iov[3].iov_base = push->data;
+	iov[3].iov_len = head_only ? push->hdr_len : push->poll_len;
+
+	return meta_client_sendv(cl, iov, 4);
+}
+
+/* Re-reads the state and, if anything that subscribers care
+ * about changed, serializes a new update and sends it to all
+ * of them; the writer pokes us through statefd every time it
+ * updates the state, and we wake up on our own when the
+ * current song is about to start fading out */
+static void
+meta_push_update(struct meta_handler *mh)
+{
+	struct current_state *st = &mh->snapshot;
+	struct meta_client *cl = NULL;
+	struct meta_client *next = NULL;
+	struct meta_push *push = NULL;
+	uint64_t version = mh->push ? mh->push->version + 1 : 1;
+	uint64_t now = 0;
+	int fading = 0;
+	int len = 0;
+	int ret = 0;
+
+	meta_state_read(mh, st);
+	now = stats_get_usecs();
+	fading = st->fade_usecs && now >= st->fade_usecs;
+	mh->push_wakeup = fading ? 0 : st->fade_usecs;
+
+	if(!meta_push_changed(mh, st, fading) && mh->push)
+		return;
+
+	len = meta_render_update(mh, st, version, fading);
+	if(len < 0)
+		return;
+
+	push = meta_build_push(version, mh->push_json.buf, len);
+	if(!push)
+		return;
+	free(mh->push);
+	mh->push = push;
+	stats_counter_add(&mh->updates, 1);
+
+	utils_dbg(META, "Update %llu\n", (unsigned long long) version);
+
+	for(cl = mh->clients; cl; cl = next) {
+		next = cl->next;
+		if(cl->streaming)
+			ret = meta_client_stream(mh, cl,
+						 push->data + push->sse_off,
+						 push->sse_len);
+		else if(cl->waiting) {
+			cl->waiting = 0;
+			ret = meta_client_send_push(mh, cl, push, 0);
+			/* Flush it and go on with anything pipelined */
+			if(!ret)
+				ret = meta_client_process(mh, cl);
+		} else
+			continue;
+
+		if(ret < 0)
+			meta_client_close(mh, cl);
+	}
+}
+
+static struct meta_push*
+meta_get_push(struct meta_handler *mh)
+{
+	if(!mh->push)
+		meta_push_update(mh);
+	return mh->push;
+}
+
+
+/******************\
+* SERVER CALLBACKS *
+\******************/
+
+static int
+meta_metrics_callback(struct meta_handler *mh, struct meta_client *cl,
+		      int head_only)
+{
+	int len = 0;
+
+	len = stats_render(mh->metrics_buff, STATS_RENDER_LEN);
+	if(len < 0)
+		len = 0;
+
+	return meta_queue_response(mh, cl, "200 OK",
+				   "text/plain; version=0.0.4; charset=utf-8",
+				   mh->metrics_buff, len, head_only);
+}
+
+static int
+meta_error_callback(struct meta_handler *mh, struct meta_client *cl,
+		    const char* status)
+{
+	cl->keep_alive = 0;
+	cl->closing = 1;
+	return meta_queue_response(mh, cl, status, "text/plain; charset=utf-8",
+				   "", 0, 0);
+}
+
+static int
+meta_server_callback(struct meta_handler *mh, struct meta_client *cl,
+		     struct meta_request *req, int head_only)
+{
+	static const char ok[] = "HTTP/1.1 200 OK\r\n";
+	static const char not_modified[] = "HTTP/1.1 304 Not Modified\r\n";
+	static const char conn_keep_alive[] = "Connection: keep-alive\r\n";
+	static const char conn_close[] = "Connection: close\r\n";
+	struct meta_response *resp = meta_get_response(mh);
+	const char* date_hdr = meta_get_date_hdr(mh);
+	struct iovec iov[4];
+
+	if(!resp)
+		return meta_error_callback(mh, cl,
+					   "503 Service Unavailable");
+
+	iov[1].iov_base = (void*) date_hdr;
+	iov[1].iov_len = strlen(date_hdr);
+	if(cl->keep_alive) {
+		iov[2].iov_base = (void*) conn_keep_alive;
+		iov[2].iov_len = sizeof(conn_keep_alive) - 1;
+	} else {
+		iov[2].iov_base = (void*) conn_close;
+		iov[2].iov_len = sizeof(conn_close) - 1;
+	}
+
+	if(meta_etag_matches(req->if_none_match, resp->etag)) {
+		stats_counter_add(&mh->not_modified, 1);
+		iov[0].iov_base = (void*) not_modified;
+		iov[0].iov_len = sizeof(not_modified) - 1;
+		iov[3].iov_base = resp->data + resp->nm_off;
+		iov[3].iov_len = resp->nm_len;
+	} else {
+		iov[0].iov_base = (void*) ok;
+		iov[0].iov_len = sizeof(ok) - 1;
+		iov[3].iov_base = resp->data;
+		iov[3].iov_len = head_only ? resp->hdr_len : resp->len;
+	}
+
+	return meta_client_sendv(cl, iov, 4);
+}
+
+static int
+meta_events_callback(struct meta_handler *mh, struct meta_client *cl,
+		     struct meta_request *req, int head_only)
+{
+	static const char hdr[] = "HTTP/1.1 200 OK\r\n"
+				  "Server: audio-scheduler\r\n"
+				  "Content-type: text/event-stream\r\n"
+				  "Cache-Control: no-cache\r\n"
+				  "Connection: close\r\n";
+	struct meta_push *push = meta_get_push(mh);
+	const char* date_hdr = meta_get_date_hdr(mh);
+	struct iovec iov[4];
+	int iovcnt = 3;
+
+	if(!push)
+		return meta_error_callback(mh, cl,
+					   "503 Service Unavailable");
+
+	/* The stream goes on until one of us closes it */
+	cl->keep_alive = 0;
+	cl->closing = head_only;
+	cl->streaming = !head_only;
+
+	iov[0].iov_base = (void*) hdr;
+	iov[0].iov_len = sizeof(hdr) - 1;
+	iov[1].iov_base = (void*) date_hdr;
+	iov[1].iov_len = strlen(date_hdr);
+	iov[2].iov_base = "\r\n";
+	iov[2].iov_len = 2;
+
+	/* Start with what we have, unless they've seen it already */
+	if(cl->streaming && req->last_event_id != push->version) {
+		iov[3].iov_base = push->data + push->sse_off;
+		iov[3].iov_len = push->sse_len;
+		iovcnt++;
+	}
+
+	return meta_client_sendv(cl, iov, iovcnt);
+}
+
+static int
+meta_poll_callback(struct meta_handler *mh, struct meta_client *cl,
+		   struct meta_request *req, int head_only)
+{
+	struct meta_push *push = meta_get_push(mh);
+	const char* since = strstr(req->path, "since=");
+
+	if(!push)
+		return meta_error_callback(mh, cl,
+					   "503 Service Unavailable");
+
+	if(head_only || !since ||
+	   strtoull(since + 6, NULL, 10) != push->version)
+		return meta_client_send_push(mh, cl, push, head_only);
+
+	/* Nothing new yet, meta_push_update() will answer */
+	cl->waiting = 1;
+	cl->poll_deadline = time(NULL) + META_POLL_TIMEOUT_SECS;
+	return 0;
+}
+
+/* Handles the requests we got so far, pipelined ones are answered
+ * in order, but only after the previous response went out */
+static int
+meta_client_process(struct meta_handler *mh, struct meta_client *cl)
+{
+	struct meta_request req = {{0}};
+	int head_only = 0;
+	int req_len = 0;
+	int ret = 0;
+
+	while(!cl->resp_len && !cl->closing && !cl->streaming &&
+	      !cl->waiting && cl->req_len > 0) {
+		memset(&req, 0, sizeof(struct meta_request));
+		req_len = meta_parse_request(cl, &req);
+		if(req_len == 0)
+			break;
+		if(req_len < 0) {
+			ret = meta_error_callback(mh, cl, "400 Bad Request");
+			cl->req_len = 0;
+			break;
+		}
+
+		stats_counter_add(&mh->requests, 1);
+		cl->keep_alive = req.keep_alive;
+		if(!cl->keep_alive)
+			cl->closing = 1;
+
+		head_only = !strcmp(req.method, "HEAD");
+		if(strcmp(req.method, "GET") && !head_only)
+			ret = meta_error_callback(mh, cl,
+						  "405 Method Not Allowed");
+		else if(!strcmp(req.path, "/metrics") ||
+			!strncmp(req.path, "/metrics?", 9))
+			ret = meta_metrics_callback(mh, cl, head_only);
+		else if(!strcmp(req.path, "/events"))
+			ret = meta_events_callback(mh, cl, &req, head_only);
+		else if(!strcmp(req.path, "/poll") ||
+			!strncmp(req.path, "/poll?", 6))
+			ret = meta_poll_callback(mh, cl, &req, head_only);
+		else
+			ret = meta_server_callback(mh, cl, &req, head_only);
+		if(ret < 0)
+			return -1;
+
+		/* Keep whatever follows, for the next round */
+		cl->req_len -= req_len;
+		memmove(cl->req, cl->req + req_len, cl->req_len);
+
+		ret = meta_client_flush(mh, cl);
+		if(ret < 0)
+			return -1;
+	}
+
+	if(cl->resp_len)
+		return meta_client_flush(mh, cl);
+
+	return ret;
+}
+
+static int
+meta_client_read(struct meta_handler *mh, struct meta_client *cl)
+{
+	ssize_t ret = 0;
+
+	while(cl->req_len < META_REQ_LEN) {
+		ret = recv(cl->fd, cl->req + cl->req_len,
+			   META_REQ_LEN - cl->req_len, 0);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if(ret < 0)
+			return -1;
+		/* Closed by the client, it may still be waiting
+		 * for a response to what it sent, e.g. with
+		 * printf 'GET / HTTP/1.0\r\n\r\n' | nc */
+		if(ret == 0) {
+			cl->eof = 1;
+			break;
+		}
+		/* Nothing to do with it */
+		if(cl->streaming)
+			continue;
+		cl->req_len += ret;
+	}
+
+	/* Can't go on before the poll returns, and
+	 * there's no room to read more */
+	if(cl->waiting && cl->req_len >= META_REQ_LEN)
+		return -1;
+
+	ret = meta_client_process(mh, cl);
+
+	/* Went away, nothing more to send it, or it's
+	 * a subscriber that won't be around for it */
+	if(ret == 0 && cl->eof && (!cl->resp_len || cl->streaming ||
+				  cl->waiting))
+		return -1;
+
+	return ret;
+}
+
+/* Also keeps subscribers going, event streams get a ping
+ * and polls that waited long enough get what we have */
+static void
+meta_drop_idle_clients(struct meta_handler *mh, time_t now)
+{
+	static const char ping[] = ": ping\n\n";
+	struct meta_client *cl = mh->clients;
+	struct meta_client *next = NULL;
+	int ret = 0;
+
+	while(cl) {
+		next = cl->next;
+		ret = 0;
+		if(cl->streaming) {
+			if(now - cl->last_active >= META_SSE_PING_SECS) {
+				cl->last_active = now;
+				ret = meta_client_stream(mh, cl, ping,
+							 sizeof(ping) - 1);
+			}
+		} else if(cl->waiting) {
+			if(now >= cl->poll_deadline && mh->push) {
+				cl->waiting = 0;
+				cl->last_active = now;
+				ret = meta_client_send_push(mh, cl, mh->push, 0);
+				if(!ret)
+					ret = meta_client_process(mh, cl);
+			}
+		} else if(now - cl->last_active >= META_IDLE_TIMEOUT_SECS) {
+			utils_dbg(META, "Dropping idle client %i\n", cl->fd);
+			ret = -1;
+		}
+
+		if(ret < 0)
+			meta_client_close(mh, cl);
+		cl = next;
+	}
+}
+
+
 /***************\
 * SERVER THREAD *
 \***************/
@@ -172,109 +1270,337 @@ static void*
 meta_server_thread(void* arg)
 {
 	struct meta_handler *mh = (struct meta_handler*) arg;
-	struct sockaddr_in clientname = {0};
-	fd_set active_set;
-	int client_sockfd = 0;
-	socklen_t size = 0;
+	struct epoll_event events[META_MAX_EVENTS];
+	struct meta_client *cl = NULL;
+	time_t last_sweep = time(NULL);
+	time_t now = 0;
+	uint64_t now_usecs = 0;
+	uint64_t val = 0;
+	int state_changed = 0;
+	int num_events = 0;
+	int timeout = 0;
 	int i = 0;
 	int ret = 0;
 
 	utils_info(META, "Waiting for connections...\n");
 
-	/* Register cleanup function */
-	pthread_cleanup_push(meta_server_thread_cleanup, arg);
+	while(mh->active) {
+		/* Wake up every second to drop idle clients,
+		 * or earlier if a fade is about to start */
+		timeout = 1000;
+		if(mh->push_wakeup) {
+			now_usecs = stats_get_usecs();
+			if(now_usecs >= mh->push_wakeup)
+				timeout = 0;
+			else if(mh->push_wakeup - now_usecs < 1000000ULL)
+				timeout = (mh->push_wakeup - now_usecs + 999) /
+					  1000;
+		}
 
-	/* Initialize the set of active sockets. */
-	FD_ZERO(&active_set);
-	FD_SET(mh->sockfd, &active_set);
+		num_events = epoll_wait(mh->epfd, events, META_MAX_EVENTS,
+					timeout);
+		if(num_events < 0) {
+			if(errno == EINTR)
+				continue;
+			utils_perr(META, "epoll_wait() failed");
+			break;
+		}
 
-	while(mh->active) {
-		/* Block until input arrives on one or more active sockets. */
-		ret = select(FD_SETSIZE, &active_set, NULL, NULL, NULL);
-		if (ret < 0) {
-			utils_perr(META, "select() failed");
-			ret = -errno;
-			goto cleanup;
-		} if (!ret)
-			continue;	/* No connection within timeout */
-
-		/* Loop on active sockets */
-		for (i = 0; i < FD_SETSIZE && mh->active; ++i) {
-
-			if (!FD_ISSET(i, &active_set))
+		now = time(NULL);
+		state_changed = 0;
+		for(i = 0; i < num_events && mh->active; i++) {
+			/* New connections */
+			if(events[i].data.ptr == &mh->sockfd) {
+				meta_accept_clients(mh);
 				continue;
+			}
+
+			/* meta_handler_destroy() */
+			if(events[i].data.ptr == &mh->wakefd)
+				break;
 
-			/* Data on master socket: Move the connection to
-			 * a new socket and add it to the set of sockets
-			 * to monitor. */
-			if (i == mh->sockfd) {
-
-				size = sizeof(clientname);
-				client_sockfd = accept(mh->sockfd,
-						(struct sockaddr *) &clientname,
-						&size);
-
-				if (client_sockfd < 0) {
-					utils_perr(META, "accept() failed");
-					ret = -errno;
-					goto cleanup;
-				}
-
-				utils_info(META, "Connection from host %s.\n",
-						inet_ntoa(clientname.sin_addr),
-						ntohs(clientname.sin_port));
-
-				FD_SET(client_sockfd, &active_set);
-
-			/* Previously assigned socket */
-			} else {
-				ret = meta_server_callback(mh, i);
-				if (ret < 0)
-					goto cleanup;
-				close(i);
-				FD_CLR(i, &active_set);
+			/* meta_state_update(), pushed after the loop since
+			 * a failed send closes clients that may still have
+			 * events further down */
+			if(events[i].data.ptr == &mh->statefd) {
+				if(read(mh->statefd, &val, sizeof(val)) > 0)
+					state_changed = 1;
+				continue;
 			}
+
+			cl = (struct meta_client*) events[i].data.ptr;
+			cl->last_active = now;
+
+			if(events[i].events & (EPOLLERR | EPOLLHUP))
+				ret = -1;
+			else if(events[i].events & EPOLLOUT) {
+				ret = meta_client_flush(mh, cl);
+				/* Continue with any pipelined requests */
+				if(!ret && !cl->resp_len)
+					ret = meta_client_process(mh, cl);
+			} else
+				ret = meta_client_read(mh, cl);
+
+			if(ret < 0)
+				meta_client_close(mh, cl);
+		}
+
+		if(state_changed || (mh->push_wakeup &&
+		    stats_get_usecs() >= mh->push_wakeup))
+			meta_push_update(mh);
+
+		if(now != last_sweep) {
+			meta_drop_idle_clients(mh, now);
+			last_sweep = now;
 		}
 	}
 
- cleanup:
-	pthread_cleanup_pop(arg);
+	while(mh->clients)
+		meta_client_close(mh, mh->clients);
+
+	utils_dbg(META, "Server thread terminated\n");
 	return arg;
 }
 
 
+/****************\
+* SHARED MEMORY *
+\****************/
+
+/* Checks if an existing segment belongs to a writer that's still
+ * running, returns 1 if so, 0 if it's stale (or not readable) */
+static int
+meta_shm_owner_alive(const char* name)
+{
+	struct np_shm *shm = NULL;
+	pid_t pid = 0;
+
+	shm = np_shm_open(name);
+	if(!shm)
+		return 0;
+
+	pid = (pid_t) shm->writer_pid;
+	np_shm_close(shm);
+
+	if(pid <= 0 || pid == getpid())
+		return 0;
+
+	return (!kill(pid, 0) || errno == EPERM);
+}
+
+static int
+meta_shm_create(struct meta_handler *mh, const char* name)
+{
+	struct np_shm *shm = NULL;
+	int fd = 0;
+	int ret = 0;
+
+	/* Always start from a fresh segment, never resize one that
+	 * others may have mapped, that would SIGBUS its readers */
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+	if(fd < 0 && errno == EEXIST) {
+		if(meta_shm_owner_alive(name)) {
+			utils_err(META, "Shared memory segment %s is in use "
+				  "by another running instance\n", name);
+			return -EBUSY;
+		}
+
+		/* Left over from a previous run, readers that still have
+		 * it mapped keep their copy after unlinking it */
+		utils_dbg(META, "Replacing stale shared memory segment %s\n",
+			  name);
+		if(shm_unlink(name) < 0 && errno != ENOENT) {
+			utils_perr(META, "Could not remove stale shared "
+				   "memory segment %s", name);
+			return -errno;
+		}
+		fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC,
+			      0644);
+	}
+	if(fd < 0) {
+		utils_perr(META, "Could not create shared memory segment %s",
+			   name);
+		return -errno;
+	}
+
+	if(ftruncate(fd, sizeof(struct np_shm)) < 0) {
+		utils_perr(META, "Could not resize shared memory segment");
+		ret = -errno;
+		goto cleanup;
+	}
+
+	shm = mmap(NULL, sizeof(struct np_shm), PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if(shm == MAP_FAILED) {
+		utils_perr(META, "Could not map shared memory segment");
+		ret = -errno;
+		goto cleanup;
+	}
+
+	shm->version = NP_SHM_VERSION;
+	shm->size = sizeof(struct np_shm);
+	shm->writer_pid = getpid();
+	__atomic_store_n(&shm->magic, NP_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	mh->shm = shm;
+	mh->shm_name = name;
+	utils_dbg(META, "Publishing state on shared memory segment %s\n", name);
+
+ cleanup:
+	close(fd);
+	return ret;
+}
+
+static void
+meta_shm_copy_song(struct np_song *dst, const struct song_info *src)
+{
+	memcpy(dst->artist, src->artist, NP_TAG_LEN);
+	memcpy(dst->album, src->album, NP_TAG_LEN);
+	memcpy(dst->title, src->title, NP_TAG_LEN);
+	memcpy(dst->zone, src->zone, NP_TAG_LEN);
+	memcpy(dst->path, src->path, NP_PATH_LEN);
+	dst->path[NP_PATH_LEN - 1] = '\0';
+	dst->start_usecs = src->start_usecs;
+	dst->duration_sec = src->duration_sec;
+}
+
+static void
+meta_shm_publish(struct meta_handler *mh, const struct current_state *st)
+{
+	struct np_shm *shm = mh->shm;
+	uint32_t seq = shm->seq;
+
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	shm->state.updated_usecs = stats_get_usecs();
+	shm->state.fade_usecs = st->fade_usecs;
+	shm->state.overlap_sec = st->overlap_sec;
+	meta_shm_copy_song(&shm->state.current, &st->current);
+	meta_shm_copy_song(&shm->state.next, &st->next);
+
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+
+	/* Readers may be in other processes, so not a private futex.
+	 * This is only a few times per song, don't bother tracking
+	 * if anyone is actually waiting. */
+	syscall(SYS_futex, &shm->seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static void
+meta_shm_destroy(struct meta_handler *mh)
+{
+	if(!mh->shm)
+		return;
+
+	munmap(mh->shm, sizeof(struct np_shm));
+	mh->shm = NULL;
+
+	/* Readers that have it mapped keep their copy */
+	shm_unlink(mh->shm_name);
+	mh->shm_name = NULL;
+}
+
+
 /**************\
 * ENTRY POINTS *
 \**************/
 
 int
-meta_handler_init(struct meta_handler *mh, uint16_t port, const char* ip4addr)
+meta_handler_init(struct meta_handler *mh, uint16_t port, const char* addr,
+		  const char* shm_name)
 {
+	struct epoll_event ev = {0};
+	struct timespec ts = {0};
 	int ret = 0;
 
 	memset(mh, 0, sizeof(struct meta_handler));
 	mh->port = port;
-	mh->ipaddr = ip4addr;
-	pthread_mutex_init(&mh->state.proc_mutex, NULL);
+	mh->ipaddr = addr;
+	mh->sockfd = mh->epfd = mh->wakefd = mh->statefd = -1;
+
+	stats_counter_register(&mh->requests, "http_requests",
+			       "Requests served by the metadata server");
+	stats_counter_register(&mh->not_modified, "http_not_modified",
+			       "Requests answered with 304 Not Modified");
+	stats_counter_register(&mh->updates, "now_playing_updates",
+			       "Updates sent to subscribers");
 
-	/* Allocate output buffer */
-	mh->msg_buff = malloc(ST_STRING_LEN);
-	if(mh->msg_buff == NULL) {
-		utils_perr(META, "Could not allocate output buffer");
+	/* Output buffers grow as needed */
+	json_init(&mh->json, 1);
+	json_init(&mh->push_json, 0);
+
+	mh->metrics_buff = malloc(STATS_RENDER_LEN);
+	if(mh->metrics_buff == NULL) {
+		utils_perr(META, "Could not allocate metrics buffer");
 		return  -errno;
 	}
 
+	/* Start times are on the monotonic clock, subscribers
+	 * get them in wall clock time */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	mh->realtime_offset = (int64_t) ts.tv_sec * 1000000LL +
+			      ts.tv_nsec / 1000 - (int64_t) stats_get_usecs();
+
+	/* Not fatal, the HTTP side still works without it, unless
+	 * another instance is publishing there already */
+	if(shm_name) {
+		ret = meta_shm_create(mh, shm_name);
+		if(ret == -EBUSY)
+			return ret;
+		if(ret < 0)
+			utils_wrn(META, "Now-playing state won't be available "
+				  "on %s\n", shm_name);
+		ret = 0;
+	}
+
 	/* Create the socket and set it up to accept connections. */
-	mh->sockfd = meta_create_server_socket(port, ip4addr);
+	mh->sockfd = meta_create_server_socket(port, addr);
 	if(mh->sockfd < 0)
 		return mh->sockfd;
 
-	ret = listen(mh->sockfd, 1);
+	ret = listen(mh->sockfd, SOMAXCONN);
 	if (ret < 0) {
 		utils_perr(META, "Could not mark socket as passive");
 		return -errno;
 	}
 
+	mh->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (mh->epfd < 0) {
+		utils_perr(META, "Could not create epoll instance");
+		return -errno;
+	}
+
+	/* For waking up the server thread when it's time to go */
+	mh->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mh->wakefd < 0) {
+		utils_perr(META, "Could not create eventfd");
+		return -errno;
+	}
+
+	/* And for letting it know that the state changed */
+	mh->statefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mh->statefd < 0) {
+		utils_perr(META, "Could not create eventfd");
+		return -errno;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &mh->sockfd;
+	ret = epoll_ctl(mh->epfd, EPOLL_CTL_ADD, mh->sockfd, &ev);
+	if (ret == 0) {
+		ev.data.ptr = &mh->wakefd;
+		ret = epoll_ctl(mh->epfd, EPOLL_CTL_ADD, mh->wakefd, &ev);
+	}
+	if (ret == 0) {
+		ev.data.ptr = &mh->statefd;
+		ret = epoll_ctl(mh->epfd, EPOLL_CTL_ADD, mh->statefd, &ev);
+	}
+	if (ret < 0) {
+		utils_perr(META, "Could not set up epoll");
+		return -errno;
+	}
+
 	/* Start server thread */
 	mh->active = 1;
 	ret = pthread_create(&mh->tid, NULL, meta_server_thread, (void*) mh);
@@ -289,16 +1615,88 @@ meta_handler_init(struct meta_handler *mh, uint16_t port, const char* ip4addr)
 void
 meta_handler_destroy(struct meta_handler *mh)
 {
+	uint64_t val = 1;
+
 	if(mh->tid!=NULL){
-		pthread_cancel(mh->tid);
+		mh->active = 0;
+		if(write(mh->wakefd, &val, sizeof(val)) < 0)
+			utils_pwrn(META, "Could not wake up server thread");
 		pthread_join(mh->tid, NULL);
 	}
-	free(mh->msg_buff);
-	mh->msg_buff = NULL;
+	if(mh->wakefd > 0)
+		close(mh->wakefd);
+	if(mh->statefd > 0)
+		close(mh->statefd);
+	if(mh->epfd > 0)
+		close(mh->epfd);
+	if(mh->sockfd > 0)
+		close(mh->sockfd);
+	mh->sockfd = mh->epfd = mh->wakefd = mh->statefd = -1;
+	json_free(&mh->json);
+	free(mh->metrics_buff);
+	mh->metrics_buff = NULL;
+	free(mh->resp);
+	mh->resp = NULL;
+	json_free(&mh->push_json);
+	free(mh->push);
+	mh->push = NULL;
+	meta_shm_destroy(mh);
 }
 
-struct current_state*
-meta_get_state(struct meta_handler *mh)
+void
+meta_state_update(struct meta_handler *mh, const struct song_info *current,
+		  const struct song_info *next, uint32_t overlap_sec,
+		  uint64_t fade_usecs)
 {
-	return &mh->state;
+	struct current_state *st = &mh->state;
+	uint32_t seq = st->seq;
+	uint64_t val = 1;
+
+	/* Single writer, so nobody else touches seq */
+	__atomic_store_n(&st->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(&st->current, current, sizeof(struct song_info));
+	memcpy(&st->next, next, sizeof(struct song_info));
+	st->overlap_sec = overlap_sec;
+	st->fade_usecs = fade_usecs;
+
+	__atomic_store_n(&st->seq, seq + 2, __ATOMIC_RELEASE);
+
+	if(mh->shm)
+		meta_shm_publish(mh, st);
+
+	/* Non-blocking, if the counter is already set
+	 * the server thread hasn't seen the last one yet */
+	if(mh->statefd >= 0 && write(mh->statefd, &val, sizeof(val)) < 0 &&
+	   errno != EAGAIN)
+		utils_pwrn(META, "Could not notify server thread");
+}
+
+void
+meta_state_read(struct meta_handler *mh, struct current_state *out)
+{
+	struct current_state *st = &mh->state;
+	uint32_t seq = 0;
+	uint64_t now = 0;
+
+	while(1) {
+		seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+		if(seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		memcpy(out, st, sizeof(struct current_state));
+
+		/* Don't let the copy move past the re-check */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&st->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	out->seq = seq;
+
+	now = stats_get_usecs();
+	meta_song_set_elapsed(&out->current, now);
+	meta_song_set_elapsed(&out->next, now);
 }
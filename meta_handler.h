@@ -24,46 +24,131 @@
 #include <stdint.h>	/* For typed ints */
 #include <pthread.h>	/* For pthread stuff */
 #include <linux/limits.h>	/* For PATH_MAX */
+#include "stats.h"
+#include "np_shm.h"
+#include "json_writer.h"
 
+/* On IDv2 artist/album/title are up to 60chars,
+ * Vorbis (ogg/flac) doesn't have that limitation.
+ * This is in bytes of UTF-8, where e.g. Greek takes
+ * 2 per character, longer ones get truncated (on a
+ * character boundary). Same as in the shared memory
+ * segment, so that tags can be copied there as-is. */
+#define SI_TAG_LEN	NP_TAG_LEN
+
+/* Strings are stored inline, so that a snapshot
+ * can be copied around without any allocations */
 struct song_info {
-	char*	artist;
-	char*	album;
-	char*	title;
-	char*	path;
-	char*	zone;
+	char	artist[SI_TAG_LEN];
+	char	album[SI_TAG_LEN];
+	char	title[SI_TAG_LEN];
+	char	path[PATH_MAX];
+	char	zone[SI_TAG_LEN];
 	uint32_t duration_sec;
+	/* When the song's position 0 was (or will be) heard, in
+	 * CLOCK_MONOTONIC usecs as in stats_get_usecs(), 0 if we
+	 * don't know yet. Only the readers fill in elapsed_sec
+	 * from that, so the writer doesn't have to wake up every
+	 * second to update it. */
+	uint64_t start_usecs;
 	uint32_t elapsed_sec;
 };
 
-/* On IDv2 artist/album/title are up to 60chars,
- * Vorbis (ogg/flac) doesn't have that limitation.
- * 64 should be enough in any case */
-#define SI_STRING_LEN	(64 + 64 + 64 + 64 + PATH_MAX + 10 + 10)
-
+/* The player is the only writer, it updates the state through
+ * meta_state_update() that never blocks, readers copy it with
+ * meta_state_read() and retry if they raced with an update
+ * (seqlock). That way a slow reader can't stall the main loop. */
 struct current_state {
+	/* Odd while an update is in progress */
+	uint32_t seq;
 	struct song_info current;
 	struct song_info next;
 	/* Overlap between next and current
 	 * (how many secs of next will be played before
 	 * current finishes) */
 	uint32_t overlap_sec;
-	pthread_mutex_t proc_mutex;
+	/* When current starts fading out, same clock as
+	 * start_usecs, 0 if we don't know yet */
+	uint64_t fade_usecs;
+};
+
+/* The now-playing response, rendered when the state changes
+ * or the elapsed time of one of the songs goes up a second */
+struct meta_response {
+	uint64_t version;
+	/* Headers up to and including the empty line, then the body */
+	size_t	hdr_len;
+	size_t	len;
+	/* Headers of a 304 for the same version */
+	size_t	nm_off;
+	size_t	nm_len;
+	/* Weak, it stays the same while only the elapsed
+	 * times change, see meta_hash_state() */
+	char	etag[24];
+	char	data[];
 };
 
-#define ST_STRING_LEN	((2 * SI_STRING_LEN) + 10) + 128
+/* A compact update for subscribers (/events and /poll), serialized
+ * once and sent as is to all of them */
+struct meta_push {
+	uint64_t version;
+	/* Headers and body of a /poll response, without the status
+	 * line, the Date and the Connection headers */
+	size_t	hdr_len;
+	size_t	poll_len;
+	/* The same as an event-stream message */
+	size_t	sse_off;
+	size_t	sse_len;
+	char	data[];
+};
 
 struct meta_handler {
 	struct current_state state;
-	char*	msg_buff;
+	struct	json_writer json;
+	char*	metrics_buff;
+	/* Only touched by the server thread, see meta_get_response() */
+	struct	meta_response *resp;
+	struct	current_state snapshot;
+	uint32_t resp_seq;
+	uint64_t resp_valid_until;
+	uint64_t version;
+	uint64_t hash;
+	time_t	date_time;
+	char	date_hdr[64];
+	/* Same, for subscribers, see meta_push_update() */
+	struct	meta_push *push;
+	struct	json_writer push_json;
+	uint64_t push_hash;
+	uint64_t push_start[2];
+	uint64_t push_wakeup;
+	int64_t	realtime_offset;
+	/* Same state for local processes, see np_shm.h */
+	struct	np_shm *shm;
+	const char* shm_name;
 	const char* ipaddr;
 	int	sockfd;
+	int	epfd;
+	int	wakefd;
+	int	statefd;
+	struct	meta_client *clients;
+	int	num_clients;
 	int	active;
 	pthread_t tid;
 	uint16_t port;
+	struct	stats_counter requests;
+	struct	stats_counter not_modified;
+	struct	stats_counter updates;
 };
 
-int meta_handler_init(struct meta_handler *mh, uint16_t port, const char* ip4addr);
+/* addr is an ipv4 or ipv6 address to listen on, NULL for all of
+ * them, shm_name may be NULL to skip the shared-memory segment */
+int meta_handler_init(struct meta_handler *mh, uint16_t port, const char* addr,
+		      const char* shm_name);
 void meta_handler_destroy(struct meta_handler *mh);
-struct current_state* meta_get_state(struct meta_handler *mh);
+void meta_state_update(struct meta_handler *mh, const struct song_info *current,
+		       const struct song_info *next, uint32_t overlap_sec,
+		       uint64_t fade_usecs);
+/* Also fills in elapsed_sec of both songs */
+void meta_state_read(struct meta_handler *mh, struct current_state *out);
 
 #endif /* __META_HANDLER_H__ */
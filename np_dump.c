@@ -0,0 +1,131 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Shared-memory now-playing segment dumper
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "np_shm.h"
+#include <unistd.h>	/* For getopt() */
+#include <stdio.h>	/* For printf() / perror() */
+#include <time.h>	/* For clock_gettime() */
+
+static const char * usage_str =
+  "Usage: %s [-f] [-n shm_name]\n"
+  "\t-f\tKeep printing the state every time it changes\n";
+
+static uint64_t
+get_usecs(void)
+{
+	struct timespec ts = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void
+print_song(const char* label, const struct np_song *song, uint64_t now)
+{
+	uint32_t elapsed = np_song_elapsed(song, now);
+
+	if(!song->path[0]) {
+		printf("%s: -\n", label);
+		return;
+	}
+
+	printf("%s: %s - %s (%s) [%s] %02u:%02u/%02u:%02u\n", label,
+	       song->artist, song->title, song->album, song->zone,
+	       elapsed / 60, elapsed % 60,
+	       song->duration_sec / 60, song->duration_sec % 60);
+	printf("\t%s\n", song->path);
+}
+
+static void
+print_state(const struct np_state *st, uint32_t seq)
+{
+	uint64_t now = get_usecs();
+
+	printf("seq: %u, updated %.1fs ago\n", seq,
+	       (double) (now - st->updated_usecs) / 1000000.0);
+	print_song("current", &st->current, now);
+	print_song("next", &st->next, now);
+
+	if(!st->fade_usecs)
+		printf("overlap: %us\n", st->overlap_sec);
+	else if(st->fade_usecs > now)
+		printf("overlap: %us, fading out in %.1fs\n", st->overlap_sec,
+		       (double) (st->fade_usecs - now) / 1000000.0);
+	else
+		printf("overlap: %us, fading out\n", st->overlap_sec);
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct np_state st = {0};
+	struct np_shm *shm = NULL;
+	const char* name = NP_SHM_DEFAULT_NAME;
+	uint32_t seq = 0;
+	int follow = 0;
+	int opt = 0;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "fn:")) != -1) {
+		switch (opt) {
+		case 'f':
+			follow = 1;
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		default:
+			printf(usage_str, argv[0]);
+			return -1;
+		}
+	}
+
+	shm = np_shm_open(name);
+	if(!shm) {
+		perror("Could not open now-playing segment");
+		return -2;
+	}
+
+	if(np_shm_read(shm, &st, &seq) < 0) {
+		perror("Could not read now-playing state");
+		ret = -3;
+		goto cleanup;
+	}
+	print_state(&st, seq);
+
+	while(follow) {
+		if(np_shm_wait(shm, seq, -1) < 0) {
+			perror("Could not wait for updates");
+			break;
+		}
+		if(np_shm_read(shm, &st, &seq) < 0) {
+			perror("Could not read now-playing state");
+			ret = -3;
+			break;
+		}
+		printf("\n");
+		print_state(&st, seq);
+	}
+
+ cleanup:
+	np_shm_close(shm);
+	return ret;
+}
@@ -0,0 +1,142 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Shared-memory now-playing segment, reader side
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This one is also built as a standalone library for other
+ * programs, so it only depends on libc */
+
+#include "np_shm.h"
+#include <string.h>		/* For memcpy() */
+#include <errno.h>		/* For errno */
+#include <fcntl.h>		/* For O_* flags */
+#include <time.h>		/* For struct timespec */
+#include <unistd.h>		/* For close() / syscall() */
+#include <sched.h>		/* For sched_yield() */
+#include <sys/mman.h>		/* For shm_open() / mmap() */
+#include <sys/stat.h>		/* For fstat() */
+#include <sys/syscall.h>	/* For SYS_futex */
+#include <linux/futex.h>	/* For FUTEX_WAIT */
+
+struct np_shm*
+np_shm_open(const char* name)
+{
+	struct np_shm *shm = NULL;
+	struct stat st = {0};
+	int fd = 0;
+
+	fd = shm_open(name ? name : NP_SHM_DEFAULT_NAME, O_RDONLY | O_CLOEXEC,
+		      0);
+	if(fd < 0)
+		return NULL;
+
+	if(fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct np_shm)) {
+		close(fd);
+		errno = ENODATA;
+		return NULL;
+	}
+
+	shm = mmap(NULL, sizeof(struct np_shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(shm == MAP_FAILED)
+		return NULL;
+
+	if(__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != NP_SHM_MAGIC ||
+	   shm->version != NP_SHM_VERSION ||
+	   shm->size < sizeof(struct np_shm)) {
+		munmap(shm, sizeof(struct np_shm));
+		errno = EPROTO;
+		return NULL;
+	}
+
+	return shm;
+}
+
+void
+np_shm_close(struct np_shm *shm)
+{
+	if(shm)
+		munmap(shm, sizeof(struct np_shm));
+}
+
+int
+np_shm_read(const struct np_shm *shm, struct np_state *out, uint32_t *seq)
+{
+	uint32_t cur = 0;
+	int tries = 0;
+
+	/* An update is only a few memcpy()s, if seq stays odd
+	 * for that long the writer is gone (or stopped) in the
+	 * middle of one, don't spin on it forever */
+	for(tries = 0; tries < NP_SHM_READ_RETRIES; tries++) {
+		cur = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if(cur & 1) {
+			sched_yield();
+			continue;
+		}
+
+		memcpy(out, &shm->state, sizeof(struct np_state));
+
+		/* Don't let the copy move past the re-check */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == cur) {
+			*seq = cur;
+			return 0;
+		}
+	}
+
+	errno = EAGAIN;
+	return -EAGAIN;
+}
+
+int
+np_shm_wait(const struct np_shm *shm, uint32_t seq, int timeout_ms)
+{
+	struct timespec ts = {0};
+	int ret = 0;
+
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (long) (timeout_ms % 1000) * 1000000L;
+
+	/* The kernel only puts us to sleep if seq is still the
+	 * same, so we can't miss an update in between. The
+	 * mapping is shared, so no FUTEX_PRIVATE_FLAG here. */
+	while(__atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE) == seq) {
+		ret = syscall(SYS_futex, &shm->seq, FUTEX_WAIT, seq,
+			      timeout_ms < 0 ? NULL : &ts, NULL, 0);
+		if(ret < 0 && errno == ETIMEDOUT)
+			return -1;
+		if(ret < 0 && errno != EINTR && errno != EAGAIN)
+			return -1;
+	}
+
+	return 0;
+}
+
+uint32_t
+np_song_elapsed(const struct np_song *song, uint64_t now_usecs)
+{
+	uint64_t elapsed = 0;
+
+	if(song->start_usecs && now_usecs > song->start_usecs)
+		elapsed = (now_usecs - song->start_usecs) / 1000000ULL;
+	if(elapsed > song->duration_sec)
+		elapsed = song->duration_sec;
+
+	return (uint32_t) elapsed;
+}
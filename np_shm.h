@@ -0,0 +1,108 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Shared-memory now-playing segment
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NP_SHM_H__
+#define __NP_SHM_H__
+
+#include <stdint.h>	/* For typed ints */
+
+/* The scheduler publishes what's playing in a POSIX shared memory
+ * segment, for processes on the same host (RDS encoder, studio
+ * clock etc) that can read it without any syscalls instead of
+ * asking the metadata server. The segment is only written by the
+ * scheduler, under a seqlock: seq is odd while an update is in
+ * progress, readers copy the state and retry if seq changed in
+ * the meantime (np_shm_read() does that). The scheduler also does
+ * a FUTEX_WAKE on seq after every update, so readers can sleep
+ * until something changes (np_shm_wait()).
+ *
+ * The layout is fixed, fields are only ever added at the end of
+ * struct np_shm and version is bumped if anything else changes.
+ * Times are in usecs of CLOCK_MONOTONIC, 0 if unknown. */
+
+#define NP_SHM_DEFAULT_NAME	"/audio-scheduler"
+#define NP_SHM_MAGIC		0x504e5341	/* "ASNP" */
+#define NP_SHM_VERSION		2
+
+/* Bytes of UTF-8, including the terminating null */
+#define NP_TAG_LEN		256
+#define NP_PATH_LEN		4096
+
+struct np_song {
+	char	artist[NP_TAG_LEN];
+	char	album[NP_TAG_LEN];
+	char	title[NP_TAG_LEN];
+	char	zone[NP_TAG_LEN];
+	char	path[NP_PATH_LEN];
+	/* When position 0 of the song was (or will be) heard */
+	uint64_t start_usecs;
+	uint32_t duration_sec;
+	uint32_t reserved;
+};
+
+struct np_state {
+	/* When the scheduler last updated the state */
+	uint64_t updated_usecs;
+	/* When current starts fading out */
+	uint64_t fade_usecs;
+	/* How many secs of next will be played before current finishes */
+	uint32_t overlap_sec;
+	uint32_t reserved;
+	struct np_song current;
+	struct np_song next;
+};
+
+struct np_shm {
+	/* Set once the segment is ready, magic goes last */
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t writer_pid;
+	/* Seqlock / futex word */
+	uint32_t seq;
+	uint32_t reserved[3];
+	struct np_state state;
+};
+
+/* Maps the segment read-only, returns NULL with errno set
+ * if it's not there or isn't something we understand */
+struct np_shm* np_shm_open(const char* name);
+void np_shm_close(struct np_shm *shm);
+
+/* Copies a consistent snapshot of the state to out and
+ * the (even) sequence number it corresponds to to seq,
+ * returns 0 on success or -EAGAIN if no consistent copy
+ * could be made after NP_SHM_READ_RETRIES tries (e.g.
+ * because the writer died in the middle of an update, or
+ * got preempted during one, so it's ok to try again later) */
+#define NP_SHM_READ_RETRIES	1000
+int np_shm_read(const struct np_shm *shm, struct np_state *out,
+		uint32_t *seq);
+
+/* Sleeps until the sequence number differs from seq, or
+ * for timeout_ms (-1 for no timeout), returns 0 if it
+ * changed, -1 on timeout or error */
+int np_shm_wait(const struct np_shm *shm, uint32_t seq, int timeout_ms);
+
+/* Secs since the song started at now_usecs (CLOCK_MONOTONIC),
+ * clamped to its duration */
+uint32_t np_song_elapsed(const struct np_song *song, uint64_t now_usecs);
+
+#endif /* __NP_SHM_H__ */
@@ -0,0 +1,399 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * In-memory cache of decoded short clips
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcm_cache.h"
+#include "analyzer.h"
+#include "utils.h"
+#include <gst/app/gstappsink.h>
+
+/* Jingles, station IDs and promos are a handful of short files that get
+ * played over and over. Once analyzed, they are decoded (once) to the mix
+ * format and kept in memory, so the player can push them into the mixer
+ * from an appsrc, without setting up a decoder on every play. Entries are
+ * keyed by path and dropped when the file's mtime changes. */
+
+#define PCM_CACHE_PULL_TIMEOUT (100 * GST_MSECOND)
+#define PCM_CACHE_STALL_TIMEOUT (10 * GST_SECOND)
+
+struct pcm_entry
+{
+  GBytes *data;
+  time_t mtime;
+};
+
+struct pcm_job
+{
+  gchar *file;
+  time_t mtime;
+  guint64 estimate;
+};
+
+static void
+pcm_entry_free (struct pcm_entry * entry)
+{
+  g_bytes_unref (entry->data);
+  g_free (entry);
+}
+
+static void
+pcm_job_free (struct pcm_job * job)
+{
+  g_free (job->file);
+  g_free (job);
+}
+
+static GstBusSyncReply
+pcm_cache_bus_sync_handler (GstBus * bus, GstMessage * msg, gpointer data)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_STREAM_STATUS:
+      gst_message_parse_stream_status (msg, &type, &owner);
+      if (type == GST_STREAM_STATUS_TYPE_ENTER)
+        analyzer_lower_thread_priority ();
+      return GST_BUS_DROP;
+
+    case GST_MESSAGE_ERROR:
+      return GST_BUS_PASS;
+
+    default:
+      return GST_BUS_DROP;
+  }
+}
+
+static void
+decodebin_pad_added (GstElement * decodebin, GstPad * src, GstPad * sink)
+{
+  gst_pad_link (src, sink);
+}
+
+static GBytes *
+pcm_cache_decode (struct pcm_cache * self, const gchar * file,
+    guint64 estimate)
+{
+  GstElement *pipeline, *decodebin, *convert, *sink;
+  GstPad *convert_sink;
+  GstSample *sample;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  GstMessage *msg;
+  GstBus *bus;
+  GByteArray *pcm;
+  GError *error = NULL;
+  gchar *desc, *uri, *debug = NULL;
+  GstClockTime stalled = 0;
+  gboolean failed = FALSE;
+
+  uri = gst_filename_to_uri (file, &error);
+  if (error) {
+    utils_wrn (PCM, "Failed to convert filename '%s' to URI: %s\n", file,
+        error->message);
+    g_clear_error (&error);
+    return NULL;
+  }
+
+  /* this is offline, so we can afford the best resampler quality */
+  desc = g_strdup_printf ("audioconvert ! audioresample quality=10 ! "
+      "appsink name=sink caps=\"%s\" sync=false max-buffers=16",
+      self->mix_caps);
+  convert = gst_parse_bin_from_description (desc, TRUE, &error);
+  g_free (desc);
+
+  decodebin = gst_element_factory_make ("uridecodebin", NULL);
+
+  if (!convert || !decodebin) {
+    utils_err (PCM, "Your GStreamer installation is missing required "
+        "elements%s%s\n", error ? ": " : "", error ? error->message : "");
+    g_clear_error (&error);
+    g_clear_object (&convert);
+    g_clear_object (&decodebin);
+    g_free (uri);
+    return NULL;
+  }
+
+  gst_util_set_object_arg (G_OBJECT (decodebin), "caps", "audio/x-raw");
+  g_object_set (decodebin, "uri", uri, NULL);
+  g_free (uri);
+
+  pipeline = gst_pipeline_new (NULL);
+  gst_bin_add_many (GST_BIN (pipeline), decodebin, convert, NULL);
+
+  convert_sink = gst_element_get_static_pad (convert, "sink");
+  g_signal_connect_object (decodebin, "pad-added",
+      (GCallback) decodebin_pad_added, convert_sink, 0);
+  gst_object_unref (convert_sink);
+
+  sink = gst_bin_get_by_name (GST_BIN (convert), "sink");
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_set_sync_handler (bus, pcm_cache_bus_sync_handler, NULL, NULL);
+
+  pcm = g_byte_array_sized_new (estimate);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  while (!g_atomic_int_get (&self->stopping)) {
+    sample = gst_app_sink_try_pull_sample (GST_APP_SINK (sink),
+        PCM_CACHE_PULL_TIMEOUT);
+
+    if (!sample) {
+      if (gst_app_sink_is_eos (GST_APP_SINK (sink)))
+        break;
+
+      msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+      if (msg) {
+        gst_message_parse_error (msg, &error, &debug);
+        utils_wrn (PCM, "failed to decode '%s': %s\n", file, error->message);
+        utils_dbg (PCM, "ERROR debug message: %s\n", debug);
+        g_clear_error (&error);
+        g_clear_pointer (&debug, g_free);
+        gst_message_unref (msg);
+        failed = TRUE;
+        break;
+      }
+
+      stalled += PCM_CACHE_PULL_TIMEOUT;
+      if (stalled >= PCM_CACHE_STALL_TIMEOUT) {
+        utils_wrn (PCM, "failed to decode '%s': no data\n", file);
+        failed = TRUE;
+        break;
+      }
+      continue;
+    }
+    stalled = 0;
+
+    buffer = gst_sample_get_buffer (sample);
+    if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+      g_byte_array_append (pcm, map.data, map.size);
+      gst_buffer_unmap (buffer, &map);
+    }
+    gst_sample_unref (sample);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+
+  if (failed || g_atomic_int_get (&self->stopping) || pcm->len == 0) {
+    g_byte_array_unref (pcm);
+    return NULL;
+  }
+
+  return g_byte_array_free_to_bytes (pcm);
+}
+
+static void
+pcm_cache_worker (struct pcm_job * job, struct pcm_cache * self)
+{
+  struct pcm_entry *entry;
+  GBytes *data = NULL;
+  gint64 start = g_get_monotonic_time ();
+
+  analyzer_lower_thread_priority ();
+
+  if (!g_atomic_int_get (&self->stopping)) {
+    utils_dbg (PCM, "decoding '%s'\n", job->file);
+    data = pcm_cache_decode (self, job->file, job->estimate);
+  }
+
+  g_mutex_lock (&self->lock);
+  self->reserved -= job->estimate;
+  /* the estimate may have been off, don't go over the quota for it */
+  if (data && self->size + self->reserved + g_bytes_get_size (data) >
+      self->quota_bytes) {
+    utils_wrn (PCM, "no room left for '%s'\n", job->file);
+    g_clear_pointer (&data, g_bytes_unref);
+  }
+  if (data) {
+    entry = g_new0 (struct pcm_entry, 1);
+    entry->data = data;
+    entry->mtime = job->mtime;
+    g_hash_table_replace (self->entries, g_strdup (job->file), entry);
+    self->size += g_bytes_get_size (data);
+  }
+  g_hash_table_remove (self->jobs, job->file);
+  g_mutex_unlock (&self->lock);
+
+  if (data) {
+    utils_info (PCM, "cached '%s' (%" G_GSIZE_FORMAT "KB), took %.2lfs\n",
+        job->file, g_bytes_get_size (data) >> 10,
+        (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC);
+  }
+
+  pcm_job_free (job);
+}
+
+int
+pcm_cache_init (struct pcm_cache * self)
+{
+  GError *error = NULL;
+
+  stats_counter_register (&self->hits, "pcm_cache_hits",
+      "Clips played from memory");
+  stats_counter_register (&self->misses, "pcm_cache_misses",
+      "Clips that weren't in memory yet");
+
+  if (!self->max_duration || !self->quota_bytes) {
+    utils_info (PCM, "PCM cache disabled\n");
+    return 0;
+  }
+
+  g_mutex_init (&self->lock);
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) pcm_entry_free);
+  self->jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->size = self->reserved = 0;
+  self->stopping = 0;
+
+  /* same as the player's internal format, see player_init() */
+  self->mix_caps = g_strdup_printf ("audio/x-raw, format=F32LE, "
+      "layout=interleaved, rate=%i, channels=%i", self->mix_rate,
+      self->mix_channels);
+
+  /* clips are short, one decoder at a time keeps up easily */
+  self->pool = g_thread_pool_new ((GFunc) pcm_cache_worker, self, 1, FALSE,
+      &error);
+  if (!self->pool) {
+    utils_err (PCM, "Couldn't create thread pool: %s\n", error->message);
+    g_clear_error (&error);
+    return -1;
+  }
+
+  utils_dbg (PCM, "PCM cache initialized, files up to %.1lfs, quota %"
+      G_GUINT64_FORMAT "MB\n", self->max_duration / (gdouble) GST_SECOND,
+      self->quota_bytes >> 20);
+
+  return 0;
+}
+
+void
+pcm_cache_cleanup (struct pcm_cache * self)
+{
+  if (!self->entries)
+    return;
+
+  g_atomic_int_set (&self->stopping, 1);
+
+  if (self->pool)
+    g_thread_pool_free (self->pool, TRUE, TRUE);
+  self->pool = NULL;
+
+  /* items that are still playing hold their own reference to the data */
+  g_clear_pointer (&self->entries, g_hash_table_unref);
+  g_clear_pointer (&self->jobs, g_hash_table_unref);
+  g_clear_pointer (&self->mix_caps, g_free);
+  g_mutex_clear (&self->lock);
+
+  utils_dbg (PCM, "PCM cache destroyed\n");
+}
+
+GBytes *
+pcm_cache_lookup (struct pcm_cache * self, const gchar * file)
+{
+  struct pcm_entry *entry;
+  GBytes *data = NULL;
+  time_t mtime;
+
+  if (!self->pool)
+    return NULL;
+
+  mtime = utils_get_mtime ((char *) file);
+
+  g_mutex_lock (&self->lock);
+  entry = g_hash_table_lookup (self->entries, file);
+  if (entry && entry->mtime == mtime) {
+    data = g_bytes_ref (entry->data);
+    stats_counter_add (&self->hits, 1);
+  } else if (entry) {
+    /* modified since we decoded it, a new submit will replace it */
+    utils_dbg (PCM, "dropping stale copy of '%s'\n", file);
+    self->size -= g_bytes_get_size (entry->data);
+    g_hash_table_remove (self->entries, file);
+  }
+  g_mutex_unlock (&self->lock);
+
+  return data;
+}
+
+void
+pcm_cache_submit (struct pcm_cache * self, const gchar * file,
+    const struct midx_info * info)
+{
+  struct pcm_job *job;
+  time_t mtime;
+
+  if (!self->pool || info->duration_ns == 0 ||
+      info->duration_ns > self->max_duration)
+    return;
+
+  /* the player only submits what it didn't find */
+  stats_counter_add (&self->misses, 1);
+
+  mtime = utils_get_mtime ((char *) file);
+  if (!mtime)
+    return;
+
+  job = g_new0 (struct pcm_job, 1);
+  job->file = g_strdup (file);
+  job->mtime = mtime;
+  job->estimate = gst_util_uint64_scale (info->duration_ns,
+      (guint64) self->mix_rate * self->mix_channels * sizeof (gfloat),
+      GST_SECOND);
+
+  g_mutex_lock (&self->lock);
+  if (g_hash_table_contains (self->entries, file) ||
+      g_hash_table_contains (self->jobs, file) ||
+      self->size + self->reserved + job->estimate > self->quota_bytes) {
+    g_mutex_unlock (&self->lock);
+    pcm_job_free (job);
+    return;
+  }
+  self->reserved += job->estimate;
+  g_hash_table_add (self->jobs, g_strdup (file));
+  g_mutex_unlock (&self->lock);
+
+  g_thread_pool_push (self->pool, job, NULL);
+}
+
+void
+pcm_cache_dump (struct pcm_cache * self, FILE * out)
+{
+  guint entries = 0, jobs = 0;
+  guint64 size = 0, reserved = 0;
+
+  if (self->entries) {
+    g_mutex_lock (&self->lock);
+    entries = g_hash_table_size (self->entries);
+    jobs = g_hash_table_size (self->jobs);
+    size = self->size;
+    reserved = self->reserved;
+    g_mutex_unlock (&self->lock);
+  }
+
+  fprintf (out, "cache\tname=pcm\tenabled=%i\tentries=%u\tjobs=%u\t"
+      "size_mb=%.1lf\treserved_mb=%.1lf\tquota_mb=%" G_GUINT64_FORMAT
+      "\thits=%" G_GUINT64_FORMAT "\tmisses=%" G_GUINT64_FORMAT "\n",
+      self->entries != NULL, entries, jobs, size / 1048576.0,
+      reserved / 1048576.0, self->quota_bytes >> 20,
+      stats_counter_get (&self->hits), stats_counter_get (&self->misses));
+}
@@ -0,0 +1,66 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * In-memory cache of decoded short clips
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PCM_CACHE_H__
+#define __PCM_CACHE_H__
+
+#include "media_index.h"
+#include "stats.h"
+#include <gst/gst.h>
+#include <stdio.h>     /* for FILE */
+
+struct pcm_cache
+{
+  /* configuration; a max_duration of 0 disables the cache */
+  GstClockTime max_duration;
+  guint64 quota_bytes;
+  gint mix_rate;
+  gint mix_channels;
+
+  /* internal */
+  GThreadPool *pool;
+  gchar *mix_caps;
+  gint stopping;
+
+  GMutex lock;
+  GHashTable *entries;  /* file -> struct pcm_entry */
+  GHashTable *jobs;     /* files being decoded */
+  guint64 size;
+  guint64 reserved;
+
+  /* statistics; a miss is a clip we could have played from memory */
+  struct stats_counter hits;
+  struct stats_counter misses;
+};
+
+int pcm_cache_init (struct pcm_cache * self);
+void pcm_cache_cleanup (struct pcm_cache * self);
+
+/* returns the decoded file in the mix format (to be unreffed), or NULL */
+GBytes *pcm_cache_lookup (struct pcm_cache * self, const gchar * file);
+
+/* queues file for decoding, if it is short enough and fits in the quota */
+void pcm_cache_submit (struct pcm_cache * self, const gchar * file,
+    const struct midx_info * info);
+
+/* for the control socket */
+void pcm_cache_dump (struct pcm_cache * self, FILE * out);
+
+#endif /* __PCM_CACHE_H__ */
@@ -19,28 +19,104 @@
  */
 
 #include "player.h"
+#include "media_index.h"
+#include "xfade_mixer.h"
+#include "realtime.h"
+#include "stats.h"
+#include "tracepoints.h"
+#include "tracer.h"
+#include "element_stats.h"
 #include "utils.h"
-#include <gst/controller/gstdirectcontrolbinding.h>
-#include <gst/controller/gstinterpolationcontrolsource.h>
+#include <gst/app/gstappsrc.h>
+#include <glib-unix.h>  /* for g_unix_signal_add */
+#include <signal.h>     /* for SIGUSR1 */
 #include <string.h>   /* for memset */
+#include <math.h>     /* for pow, isfinite */
+
+/* headroom to keep below full scale when normalizing loudness */
+#define TRUE_PEAK_CEILING_DBTP -1.0
+/* below this there is nothing to normalize, e.g. a silent file */
+#define LOUDNESS_MIN_LUFS -70.0
+/* internal sample format, everything gets mixed in this */
+#define MIX_FORMAT "F32LE"
+/* how often to log page faults / preemptions of the realtime threads */
+#define RT_REPORT_INTERVAL_SECS 600
+/* an item that starts this far from where it was scheduled gets logged */
+#define START_ERROR_WARN (5 * GST_MSECOND)
+/* buffers further ahead of the clock than this are waiting for their
+ * item to start, they don't say anything about how full the queues are */
+#define HEADROOM_MAX GST_SECOND
+
+/* dumped on SIGUSR1 and at exit and served on /metrics; most of these
+ * are updated from the streaming threads, the stats_* calls are lock-free */
+static struct
+{
+  struct stats_hist item_setup;       /* play_queue_item_new(), us */
+  struct stats_counter items_built;
+  struct stats_counter items_reused;
+  struct stats_counter item_errors;
+  struct stats_counter items_recycled;
+  struct stats_counter failovers;
+
+  /* output path */
+  struct stats_hist start_error;      /* actual vs scheduled start, us */
+  struct stats_hist transition_gap;   /* gap or overlap between items */
+  struct stats_hist input_headroom;   /* data queued in the mixer, us */
+  struct stats_hist output_headroom;  /* data queued before the sink, us */
+  struct stats_hist silence;          /* mixer output with no input, us */
+  struct stats_counter input_late;
+  struct stats_counter output_late;
+  struct stats_counter mixer_discont;
+  struct stats_counter sink_discont;
+  struct stats_counter sink_qos;
+
+  /* only touched from the mixer's streaming thread */
+  GstClockTime mixer_next_pts;
+  GstClockTime silence_start;
+  gboolean sink_started;
+} player_stats;
+
+/* the mixer places a buffer on the output sample that its running time
+ * rounds down to; converting sample positions back to time with ceil()
+ * means they land exactly where we computed them */
+static inline guint64
+player_time_to_samples (struct player * self, GstClockTime time)
+{
+  return gst_util_uint64_scale_int_round (time, self->mix_rate, GST_SECOND);
+}
+
+static inline GstClockTime
+player_samples_to_time (struct player * self, guint64 samples)
+{
+  return gst_util_uint64_scale_int_ceil (samples, GST_SECOND, self->mix_rate);
+}
 
 static void play_queue_item_set_fade (struct play_queue_item * item,
     GstClockTime start, gdouble start_value, GstClockTime end,
     gdouble end_value);
 static gboolean player_ensure_next (struct player * self);
+static gboolean player_ensure_spare (struct player * self);
 static gboolean player_recycle_item (struct play_queue_item * item);
 static gboolean player_handle_item_eos (struct play_queue_item * item);
+static void player_queue_metadata_refresh (struct player * self);
 
 static GstPadProbeReturn
 itembin_srcpad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
     struct play_queue_item * item)
 {
+  struct player *self = item->player;
   gint64 duration;
-  GstEvent *event;
-  const GstSegment *segment;
-  GstClockTime fadeout, end;
+  GstClockTime begin, fadeout, end, length;
+  guint64 trace_start;
+
+  tracer_end (item->preroll_start, "player", "preroll", item->file);
+  trace_start = tracer_begin ();
 
-  if (!gst_pad_query_duration (pad, GST_FORMAT_TIME, &duration) ||
+  /* the analyzer counted the decoded samples, which is exactly what we
+   * need to line up transitions; container durations are often rounded */
+  if (item->indexed_duration > 0) {
+    duration = item->indexed_duration;
+  } else if (!gst_pad_query_duration (pad, GST_FORMAT_TIME, &duration) ||
             duration <= 0)
   {
     /* try querying again every 20ms; break after 100ms or
@@ -57,8 +133,8 @@ itembin_srcpad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
       utils_wrn (PLR, "item %p: unknown file duration, consider remuxing; "
           "skipping playback: %s\n", item, item->file);
 
-      /* Here we unlink the pad from the audiomixer because letting the buffer
-      * go in the GstAggregator (parent class of audiomixer) may cause some
+      /* Here we unlink the pad from the mixer because letting the buffer
+      * go in the GstAggregator (parent class of the mixer) may cause some
       * locking on this thread, which will delay freeing this item and may block
       * the main thread for significant time.
       * As a side-effect, this causes an ERROR GstMessage, which gets posted
@@ -68,61 +144,237 @@ itembin_srcpad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
       gst_pad_unlink (pad, item->mixer_sink);
 
       /* and now get out of here */
+      tracer_end (trace_start, "player", "duration", item->file);
       GST_PAD_PROBE_INFO_FLOW_RETURN (info) = GST_FLOW_NOT_LINKED;
+      item->buffer_probe_id = 0;
       return GST_PAD_PROBE_REMOVE;
     }
   }
+  tracer_end (trace_start, "player", "duration", item->file);
+
+  /* fades are placed around the audible part of the file, if the analyzer
+   * found any silence at the edges; the segment has already been trimmed
+   * accordingly in mixer_sinkpad_probe() */
+  begin = item->cue_in;
+  end = duration;
+  if (GST_CLOCK_TIME_IS_VALID (item->cue_out) && item->cue_out < end)
+    end = item->cue_out;
+
+  /* gapless items are played back to back, without any fades */
+  fadeout = end;
 
   /* schedule fade in */
-  if (item->fader.fadein_duration_secs > 0) {
-    play_queue_item_set_fade (item, 0, item->fader.min_lvl,
-        item->fader.fadein_duration_secs * GST_SECOND, item->fader.max_lvl);
+  if (item->fader.fadein_duration_ms > 0 && !item->fader.gapless) {
+    length = MIN (item->fader.fadein_duration_ms * GST_MSECOND, end - begin);
+    play_queue_item_set_fade (item, begin, item->fader.min_lvl,
+        begin + length, item->fader.max_lvl);
   }
 
   /* schedule fade out */
-  if (item->fader.fadeout_duration_secs > 0) {
-    end = duration;
-    fadeout = end - item->fader.fadeout_duration_secs * GST_SECOND;
+  if (item->fader.fadeout_duration_ms > 0 && !item->fader.gapless) {
+    length = MIN (item->fader.fadeout_duration_ms * GST_MSECOND, end - begin);
+    fadeout = end - length;
 
     play_queue_item_set_fade (item, fadeout, item->fader.max_lvl,
         end, item->fader.min_lvl);
-  } else {
-    fadeout = end = duration;
   }
 
-  event = gst_pad_get_sticky_event (item->mixer_sink, GST_EVENT_SEGMENT, 0);
-  gst_event_parse_segment (event, &segment);
-
+  /* the first audible sample (begin) is mixed at start_sample, so the
+   * rest follows by counting samples from there */
   item->duration = duration;
-  item->fadeout_rt = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
-      gst_segment_position_from_stream_time (segment, GST_FORMAT_TIME,
-          fadeout));
-  item->end_rt = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
-      gst_segment_position_from_stream_time (segment, GST_FORMAT_TIME,
-          end));
-  gst_event_unref (event);
+  item->fadeout_sample = item->start_sample +
+      player_time_to_samples (self, fadeout - begin);
+  item->end_sample = item->start_sample +
+      player_time_to_samples (self, end - begin);
 
   utils_dbg (PLR, "item %p: duration is %" GST_TIME_FORMAT "\n", item,
       GST_TIME_ARGS (duration));
-  utils_dbg (PLR, "\tfadeout starts at running time: %" GST_TIME_FORMAT "\n",
-      GST_TIME_ARGS (item->fadeout_rt));
-  utils_dbg (PLR, "\titem ends at running time: %" GST_TIME_FORMAT "\n",
-      GST_TIME_ARGS (item->end_rt));
+  if (begin > 0 || end < (GstClockTime) duration)
+    utils_dbg (PLR, "\ttrimmed to %" GST_TIME_FORMAT " - %" GST_TIME_FORMAT
+        "\n", GST_TIME_ARGS (begin), GST_TIME_ARGS (end));
+  utils_dbg (PLR, "\tfadeout starts at sample: %" G_GUINT64_FORMAT "\n",
+      item->fadeout_sample);
+  utils_dbg (PLR, "\titem ends at sample: %" G_GUINT64_FORMAT "\n",
+      item->end_sample);
 
   /* make sure we have enough items linked */
   g_idle_add ((GSourceFunc) player_ensure_next, item->player);
+  player_queue_metadata_refresh (self);
 
+  item->buffer_probe_id = 0;
   return GST_PAD_PROBE_REMOVE;
 }
 
+static GstEvent *
+play_queue_item_trim_segment (struct play_queue_item * item, GstEvent * event)
+{
+  const GstSegment *segment;
+  GstSegment trimmed;
+  GstEvent *trimmed_event;
+  guint64 start, stop;
+
+  gst_event_parse_segment (event, &segment);
+  if (segment->format != GST_FORMAT_TIME || segment->rate != 1.0)
+    return event;
+
+  start = gst_segment_position_from_stream_time (segment, GST_FORMAT_TIME,
+      item->cue_in);
+  stop = gst_segment_position_from_stream_time (segment, GST_FORMAT_TIME,
+      item->cue_out);
+  if (!GST_CLOCK_TIME_IS_VALID (start) || start < segment->start)
+    start = segment->start;
+  if (!GST_CLOCK_TIME_IS_VALID (stop) ||
+      (GST_CLOCK_TIME_IS_VALID (segment->stop) && stop > segment->stop))
+    stop = segment->stop;
+
+  /* instead of seeking in the decoder (which is not possible before it
+   * has prerolled and would race with the mixer), narrow the segment;
+   * the aggregator clips anything outside of it sample-accurately, so
+   * the first audible sample ends up at running time 0 and stream time
+   * (i.e. the fade and duration positions) stays relative to the file */
+  gst_segment_copy_into (segment, &trimmed);
+  trimmed.time = gst_segment_to_stream_time (segment, GST_FORMAT_TIME, start);
+  trimmed.start = trimmed.position = start;
+  trimmed.stop = stop;
+
+  trimmed_event = gst_event_new_segment (&trimmed);
+  gst_event_set_seqnum (trimmed_event, gst_event_get_seqnum (event));
+  gst_event_set_running_time_offset (trimmed_event,
+      gst_event_get_running_time_offset (event));
+  gst_event_unref (event);
+
+  return trimmed_event;
+}
+
+/* running time of the pipeline clock, GST_CLOCK_TIME_NONE until it runs */
+static GstClockTime
+player_get_running_time (struct player * self)
+{
+  GstClock *clock;
+  GstClockTime now, base_time;
+
+  clock = gst_element_get_clock (self->pipeline);
+  if (!clock)
+    return GST_CLOCK_TIME_NONE;
+
+  now = gst_clock_get_time (clock);
+  base_time = gst_element_get_base_time (self->pipeline);
+  gst_object_unref (clock);
+
+  /* see calculate_sched_time() */
+  if (!GST_CLOCK_TIME_IS_VALID (now) || now < base_time || base_time == 0)
+    return GST_CLOCK_TIME_NONE;
+
+  return now - base_time;
+}
+
+/* how far ahead of the clock a buffer at running time rt arrived */
+static void
+player_stats_headroom (struct player * self, GstClockTime rt,
+    struct stats_hist * headroom, struct stats_counter * late)
+{
+  GstClockTime now = player_get_running_time (self);
+
+  if (!GST_CLOCK_TIME_IS_VALID (now))
+    return;
+
+  if (rt < now)
+    stats_counter_add (late, 1);
+  else if (rt - now <= HEADROOM_MAX)
+    stats_hist_add (headroom, GST_TIME_AS_USECONDS (rt - now));
+}
+
+/* the item actually starts on its first buffer's running time, or when
+ * that buffer arrives, if it arrives after its time has come */
+static void
+play_queue_item_track_start (struct play_queue_item * item, GstClockTime rt)
+{
+  struct player *self = item->player;
+  GstClockTime scheduled, actual, now;
+  GstClockTimeDiff error;
+
+  item->started = TRUE;
+  player_queue_metadata_refresh (self);
+  tracer_instant ("player", "item_start", item->file);
+
+  scheduled = player_samples_to_time (self, item->start_sample);
+  now = player_get_running_time (self);
+  actual = GST_CLOCK_TIME_IS_VALID (now) ? MAX (rt, now) : rt;
+  error = GST_CLOCK_DIFF (scheduled, actual);
+
+  stats_hist_add (&player_stats.start_error,
+      GST_TIME_AS_USECONDS (ABS (error)));
+
+  if (ABS (error) > START_ERROR_WARN)
+    utils_wrn (PLR, "item %p: started %" GST_STIME_FORMAT " from its "
+        "scheduled time\n", item, GST_STIME_ARGS (error));
+  else
+    utils_dbg (PLR, "item %p: started %" GST_STIME_FORMAT " from its "
+        "scheduled time\n", item, GST_STIME_ARGS (error));
+}
+
+/* keeps track of the last sample of this item that the mixer is going
+ * to use, after clipping to the (trimmed) segment, and of how early
+ * the decoder delivers */
+static void
+play_queue_item_track_buffer (struct play_queue_item * item, GstPad * pad,
+    GstBuffer * buffer)
+{
+  GstEvent *event;
+  const GstSegment *segment;
+  guint64 start, stop;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) ||
+      !GST_BUFFER_DURATION_IS_VALID (buffer))
+    return;
+
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (!event)
+    return;
+
+  gst_event_parse_segment (event, &segment);
+  if (gst_segment_clip (segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer),
+          GST_BUFFER_PTS (buffer) + GST_BUFFER_DURATION (buffer), &start,
+          &stop)) {
+    start = gst_segment_to_running_time (segment, GST_FORMAT_TIME, start);
+    stop = gst_segment_to_running_time (segment, GST_FORMAT_TIME, stop);
+    item->played_end_sample = player_time_to_samples (item->player, stop);
+
+    if (!item->started)
+      play_queue_item_track_start (item, start);
+    player_stats_headroom (item->player, start, &player_stats.input_headroom,
+        &player_stats.input_late);
+  }
+  gst_event_unref (event);
+}
+
 static GstPadProbeReturn
-mixer_sinkpad_event_probe (GstPad * pad, GstPadProbeInfo * info,
+mixer_sinkpad_probe (GstPad * pad, GstPadProbeInfo * info,
     struct play_queue_item * item)
 {
-  GstEvent *event = gst_pad_probe_info_get_event (info);
+  GstEvent *event;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    play_queue_item_track_buffer (item, pad, GST_PAD_PROBE_INFO_BUFFER (info));
+    return GST_PAD_PROBE_OK;
+  }
+
+  event = gst_pad_probe_info_get_event (info);
 
   switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_SEGMENT:
+      if (item->cue_in > 0 || GST_CLOCK_TIME_IS_VALID (item->cue_out))
+        GST_PAD_PROBE_INFO_DATA (info) =
+            play_queue_item_trim_segment (item, event);
+      break;
+
+    case GST_EVENT_TAG:
+      player_queue_metadata_refresh (item->player);
+      break;
+
     case GST_EVENT_EOS:
+      item->eos = TRUE;
+      item->event_probe_id = 0;
       g_idle_add ((GSourceFunc) player_handle_item_eos, item);
       return GST_PAD_PROBE_REMOVE;
 
@@ -175,32 +427,281 @@ calculate_sched_time (GstClockTime start_rt, GstElement * pipeline)
   return gst_util_uint64_scale (sched_unix_time, GST_USECOND, GST_SECOND);
 }
 
+static gdouble
+calculate_loudness_gain (struct player * self, const struct midx_info * info)
+{
+  gdouble gain_db;
+
+  if (!isfinite (info->integrated_lufs) ||
+      info->integrated_lufs < LOUDNESS_MIN_LUFS)
+    return 1.0;
+
+  gain_db = self->loudness_target - info->integrated_lufs;
+
+  /* there is no limiter in the chain, so don't push the peaks
+   * over the ceiling; quiet tracks with loud peaks stay a bit quieter */
+  if (isfinite (info->true_peak_dbtp) &&
+      info->true_peak_dbtp + gain_db > TRUE_PEAK_CEILING_DBTP)
+    gain_db = TRUE_PEAK_CEILING_DBTP - info->true_peak_dbtp;
+
+  /* the mixer's pad volume is limited to [0, 10] */
+  return CLAMP (pow (10.0, gain_db / 20.0), 0.0, 10.0);
+}
+
+/* the index tells us in advance what the decoder is going to output,
+ * so we can leave out the elements that would only pass data through */
+static enum item_chain
+player_select_chain (struct player * self, const struct midx_info * info)
+{
+  if (info->native_rate != (guint32) self->mix_rate ||
+      info->native_channels != (guint32) self->mix_channels)
+    return ITEM_CHAIN_NORMALIZED;
+
+  if (!strcmp (info->native_format, MIX_FORMAT))
+    return ITEM_CHAIN_DIRECT;
+
+  return ITEM_CHAIN_CONVERT;
+}
+
+/* every chain ends in a capsfilter with the mix format */
+static const gchar *item_chain_desc[ITEM_CHAIN_COUNT] = {
+  [ITEM_CHAIN_DIRECT] = "",
+  [ITEM_CHAIN_CONVERT] = "audioconvert ! ",
+  [ITEM_CHAIN_NORMALIZED] = "audioconvert ! audioresample ! ",
+  [ITEM_CHAIN_REPLAYGAIN] = "audioconvert ! audioresample ! rgvolume ! ",
+};
+
+static const gchar *item_chain_name[ITEM_CHAIN_COUNT] = {
+  [ITEM_CHAIN_DIRECT] = "direct",
+  [ITEM_CHAIN_CONVERT] = "convert",
+  [ITEM_CHAIN_NORMALIZED] = "normalized",
+  [ITEM_CHAIN_REPLAYGAIN] = "replaygain",
+  [ITEM_CHAIN_PCM] = "pcm",
+};
+
+/* cached clips are fed as a single buffer, the first time appsrc asks */
+static void
+appsrc_need_data (GstAppSrc * appsrc, guint length,
+    struct play_queue_item * item)
+{
+  struct player *self = item->player;
+  GstBuffer *buffer;
+  gconstpointer data;
+  gsize size;
+
+  if (!item->pcm)
+    return;
+
+  data = g_bytes_get_data (item->pcm, &size);
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      (gpointer) data, size, 0, size, item->pcm,
+      (GDestroyNotify) g_bytes_unref);
+  item->pcm = NULL;
+
+  GST_BUFFER_PTS (buffer) = 0;
+  GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale_int (
+      size / (self->mix_channels * sizeof (gfloat)), GST_SECOND,
+      self->mix_rate);
+
+  gst_app_src_push_buffer (appsrc, buffer);
+  gst_app_src_end_of_stream (appsrc);
+}
+
+static GstAppSrcCallbacks appsrc_callbacks = {
+  .need_data = (void (*) (GstAppSrc *, guint, gpointer)) appsrc_need_data,
+};
+
+/* cached clips only need an appsrc, already producing the mix format */
+static GstPad *
+play_queue_item_build_appsrc (struct play_queue_item * item)
+{
+  struct player *self = item->player;
+  GstCaps *caps;
+
+  item->appsrc = gst_element_factory_make ("appsrc", NULL);
+  caps = gst_caps_from_string (self->mix_caps);
+  g_object_set (item->appsrc,
+      "caps", caps,
+      "format", GST_FORMAT_TIME,
+      NULL);
+  gst_caps_unref (caps);
+  gst_app_src_set_callbacks (GST_APP_SRC (item->appsrc), &appsrc_callbacks,
+      item, NULL);
+  gst_bin_add (GST_BIN (item->bin), item->appsrc);
+
+  return gst_element_get_static_pad (item->appsrc, "src");
+}
+
+static GstPad *
+play_queue_item_build_decoder (struct play_queue_item * item)
+{
+  struct player *self = item->player;
+  GstElement *audioconvert;
+  GstPad *convert_sink;
+  gchar *desc;
+
+  /* create the decodebin */
+  item->decodebin = gst_element_factory_make ("uridecodebin", NULL);
+  gst_util_set_object_arg (G_OBJECT (item->decodebin), "caps", "audio/x-raw");
+  g_object_set (item->decodebin,
+      "use-buffering", TRUE,
+      "buffer-size", 0, /* disable limiting the buffer by size */
+      "buffer-duration", 0, /* disable limiting the buffer by duration */
+      NULL);
+  gst_bin_add (GST_BIN (item->bin), item->decodebin);
+
+  /* plug audioconvert in between;
+   * the mixer cannot handle different formats on different sink pads */
+  desc = g_strdup_printf ("%scapsfilter caps=\"%s\"",
+      item_chain_desc[item->chain], self->mix_caps);
+  audioconvert = gst_parse_bin_from_description (desc, TRUE, NULL);
+  gst_bin_add (GST_BIN (item->bin), audioconvert);
+  g_free (desc);
+
+  /* link the decodebin's src pad to the audioconvert bin's sink;
+   * decodebin's pads come and go with every file, this stays connected */
+  convert_sink = gst_element_get_static_pad (audioconvert, "sink");
+  g_signal_connect_object (item->decodebin, "pad-added",
+      (GCallback) decodebin_pad_added, convert_sink, 0);
+  gst_object_unref (convert_sink);
+
+  return gst_element_get_static_pad (audioconvert, "src");
+}
+
+/* builds the part of an item that does not depend on the file: the bin,
+ * the decoder, the conversion chain and the mixer pad; the bin is left
+ * locked in NULL state, it gets started by play_queue_item_new() */
 static struct play_queue_item *
-play_queue_item_new (struct player * self, struct play_queue_item * previous)
+play_queue_item_build (struct player * self, enum item_chain chain)
 {
   struct play_queue_item *item;
+  GstPad *src;
+  guint64 trace_start = tracer_begin ();
+
+  item = g_new0 (struct play_queue_item, 1);
+  item->player = self;
+  item->chain = chain;
+
+  item->bin = gst_bin_new (NULL);
+  g_object_set_data (G_OBJECT (item->bin), ELEMENT_STATS_ITEM_KEY, item);
+  gst_element_set_locked_state (item->bin, TRUE);
+  gst_bin_add (GST_BIN (self->pipeline), item->bin);
+
+  if (chain == ITEM_CHAIN_PCM)
+    src = play_queue_item_build_appsrc (item);
+  else
+    src = play_queue_item_build_decoder (item);
+
+  /* link the bin's src pad to the mixer's sink */
+  item->mixer_sink = gst_element_get_request_pad (self->mixer, "sink_%u");
+
+  item->ghost = gst_ghost_pad_new ("src", src);
+  gst_pad_set_active (item->ghost, TRUE);
+  gst_element_add_pad (item->bin, item->ghost);
+  gst_pad_link (item->ghost, item->mixer_sink);
+  gst_object_unref (src);
+
+  self->items_created++;
+  stats_counter_add (&player_stats.items_built, 1);
+
+  utils_dbg (PLR, "item %p: built new bin, linked to %s:%s\n", item,
+      GST_DEBUG_PAD_NAME (item->mixer_sink));
+  tracer_end (trace_start, "player", "item_build", item_chain_name[chain]);
+
+  return item;
+}
+
+static struct play_queue_item *
+play_queue_item_acquire (struct player * self, enum item_chain chain)
+{
+  struct play_queue_item *item;
+
+  item = g_queue_pop_head (&self->item_pool[chain]);
+  if (!item)
+    return play_queue_item_build (self, chain);
+
+  /* the mixer pad is still EOS from the last file; a flush on the pad
+   * alone resets it without affecting the rest of the mix */
+  gst_pad_send_event (item->mixer_sink, gst_event_new_flush_start ());
+  gst_pad_send_event (item->mixer_sink, gst_event_new_flush_stop (TRUE));
+  gst_pad_set_offset (item->mixer_sink, 0);
+
+  self->items_reused++;
+  stats_counter_add (&player_stats.items_reused, 1);
+
+  utils_dbg (PLR, "item %p: reusing pooled bin, linked to %s:%s\n", item,
+      GST_DEBUG_PAD_NAME (item->mixer_sink));
+
+  return item;
+}
+
+/* holds the spare's first buffer until player_activate_spare() */
+static GstPadProbeReturn
+itembin_srcpad_spare_probe (GstPad * pad, GstPadProbeInfo * info,
+    struct play_queue_item * item)
+{
+  g_atomic_int_set (&item->spare_ready, 1);
+  return GST_PAD_PROBE_OK;
+}
+
+/* a mixer pad that gets no data holds back the whole mix, so the spare's
+ * pad is put to EOS, just like the ones in the pool, until it's needed */
+static void
+play_queue_item_park (struct play_queue_item * item)
+{
+  GstSegment segment;
+
+  if (gst_pad_is_linked (item->ghost))
+    gst_pad_unlink (item->ghost, item->mixer_sink);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_send_event (item->mixer_sink,
+      gst_event_new_stream_start ("spare"));
+  gst_pad_send_event (item->mixer_sink, gst_event_new_segment (&segment));
+  gst_pad_send_event (item->mixer_sink, gst_event_new_eos ());
+
+  g_object_set (item->mixer_sink, "volume", 0.0, NULL);
+  item->eos = TRUE;
+}
+
+static struct play_queue_item *
+play_queue_item_new (struct player * self, struct play_queue_item * previous,
+    gboolean spare)
+{
+  struct play_queue_item *item;
+  struct midx_info info;
   struct fader *fader;
+  enum item_chain chain;
   gchar *file;
   gchar *zone;
   gchar *uri;
+  gchar *cached, *cached_uri;
+  GBytes *pcm = NULL;
   GError *error = NULL;
   time_t sched_time;
-  GstElement *decodebin;
-  GstElement *audioconvert;
-  GstPad *convert_src, *convert_sink;
-  GstPad *ghost;
-  GstClockTime offset = 0;
+  gboolean analyzed;
+  gint64 setup_start, setup_time;
+  guint64 overlap;
+  gint ret;
 
   /* ask for the item that would start exactly at the end of the previous item;
    * note that in reality this item may start earlier than the requested time,
-   * if it has a fade in, but at this point we don't really care */
-  sched_time = calculate_sched_time (previous ? previous->end_rt : 0,
+   * if it has a fade in or an overlap, but at this point we don't really care */
+  sched_time = calculate_sched_time (previous ?
+      player_samples_to_time (self, previous->end_sample) : 0,
       self->pipeline);
 
 next:
   /* ask scheduler for the next item */
-  if (sched_get_next (self->scheduler, sched_time, &file, &fader, &zone) != 0) {
-    utils_err (PLR, "No more files to play!!\n");
+  if (spare)
+    ret = sched_get_fallback (self->scheduler, sched_time, &file, &fader,
+        &zone);
+  else
+    ret = sched_get_next (self->scheduler, sched_time, &file, &fader, &zone);
+
+  if (ret != 0) {
+    if (!spare)
+      utils_err (PLR, "No more files to play!!\n");
     return NULL;
   }
 
@@ -213,8 +714,43 @@ next:
     goto next;
   }
 
-  item = g_new0 (struct play_queue_item, 1);
-  item->player = self;
+  setup_start = g_get_monotonic_time ();
+
+  /* if the file has been analyzed already, normalize its loudness on the
+   * mixer pad, otherwise fall back to ReplayGain tags, if there are any */
+  analyzed = (midx_get_info (file, &info) == 0);
+  chain = analyzed ? player_select_chain (self, &info) : ITEM_CHAIN_REPLAYGAIN;
+
+  /* short clips get decoded once and then played from memory; the copy
+   * is in the mix format and has the same timeline as the file */
+  if (analyzed) {
+    pcm = pcm_cache_lookup (self->pcm_cache, file);
+    if (pcm) {
+      utils_dbg (PLR, "using cached PCM of %s\n", file);
+      chain = ITEM_CHAIN_PCM;
+    } else {
+      pcm_cache_submit (self->pcm_cache, file, &info);
+    }
+  }
+
+  /* expensive files get transcoded to the mix format in the background;
+   * play the cached copy if it's there, it has the same timeline, so the
+   * gain and cue points from the index still apply */
+  if (analyzed && chain == ITEM_CHAIN_NORMALIZED) {
+    cached = transcoder_lookup (self->transcoder, file, &info);
+    cached_uri = cached ? gst_filename_to_uri (cached, NULL) : NULL;
+    if (cached_uri) {
+      utils_dbg (PLR, "using transcoded copy %s\n", cached);
+      g_free (uri);
+      uri = cached_uri;
+      chain = ITEM_CHAIN_DIRECT;
+    } else {
+      transcoder_submit (self->transcoder, file, &info);
+    }
+    g_free (cached);
+  }
+
+  item = play_queue_item_acquire (self, chain);
   item->previous = previous;
   item->file = g_strdup (file);
 
@@ -224,86 +760,109 @@ next:
   if (fader) {
     item->fader = *fader;
   } else {
-    item->fader.fadein_duration_secs = 0;
-    item->fader.fadeout_duration_secs = 0;
+    item->fader.fadein_duration_ms = 0;
+    item->fader.fadeout_duration_ms = 0;
+    item->fader.gapless = 0;
+    item->fader.overlap_ms = -1;
   }
 
   /* configure zone */
   item->zone = g_strdup (zone);
+  if (spare)
+    item->fallback = g_strdup (sched_get_fallback_playlist (self->scheduler,
+            sched_time));
+
+  if (analyzed) {
+    item->gain = calculate_loudness_gain (self, &info);
+    item->cue_in = info.cue_in_ns;
+    item->cue_out = info.cue_out_ns > info.cue_in_ns ?
+        info.cue_out_ns : GST_CLOCK_TIME_NONE;
+    item->indexed_duration = info.duration_ns;
+    utils_dbg (PLR, "item %p: %.2f LUFS, %.2f dBTP, applying gain %lf\n",
+        item, info.integrated_lufs, info.true_peak_dbtp, item->gain);
+  } else {
+    item->gain = 1.0;
+    item->cue_in = 0;
+    item->cue_out = GST_CLOCK_TIME_NONE;
+    item->indexed_duration = 0;
+  }
 
-  item->bin = gst_bin_new (NULL);
-  gst_bin_add (GST_BIN (self->pipeline), item->bin);
-
-  /* create the decodebin and link it */
-  decodebin = gst_element_factory_make ("uridecodebin", NULL);
-  gst_util_set_object_arg (G_OBJECT (decodebin), "caps", "audio/x-raw");
-  g_object_set (decodebin,
-      "uri", uri,
-      "use-buffering", TRUE,
-      "buffer-size", 0, /* disable limiting the buffer by size */
-      "buffer-duration", 0, /* disable limiting the buffer by duration */
-      NULL);
-  gst_bin_add (GST_BIN (item->bin), decodebin);
-
-  /* plug audioconvert in between;
-   * audiomixer cannot handle different formats on different sink pads */
-  audioconvert = gst_parse_bin_from_description (
-      "audioconvert ! audioresample ! rgvolume", TRUE, NULL);
-  gst_bin_add (GST_BIN (item->bin), audioconvert);
-
-  /* link the audioconvert bin's src pad to the audiomixer's sink */
-  item->mixer_sink = gst_element_get_request_pad (self->mixer, "sink_%u");
-
-  convert_src = gst_element_get_static_pad (audioconvert, "src");
-  ghost = gst_ghost_pad_new ("src", convert_src);
-  gst_pad_set_active (ghost, TRUE);
-  gst_element_add_pad (item->bin, ghost);
-  gst_pad_link (ghost, item->mixer_sink);
-  gst_object_unref (convert_src);
+  if (pcm)
+    item->pcm = pcm;
+  else
+    g_object_set (item->decodebin, "uri", uri, NULL);
+  g_object_set (item->mixer_sink, "volume", item->gain, NULL);
 
-  /* and the decodebin's src pad to the audioconvert bin's sink */
-  convert_sink = gst_element_get_static_pad (audioconvert, "sink");
-  g_signal_connect_object (decodebin, "pad-added",
-      (GCallback) decodebin_pad_added, convert_sink, 0);
-  gst_object_unref (convert_sink);
+  /* the ghost pad gets unlinked if we give up on a file
+   * without a known duration, see itembin_srcpad_buffer_probe() */
+  if (spare)
+    play_queue_item_park (item);
+  else if (!gst_pad_is_linked (item->ghost))
+    gst_pad_link (item->ghost, item->mixer_sink);
 
   /* add probes */
-  gst_pad_add_probe (ghost,
+  item->buffer_probe_id = gst_pad_add_probe (item->ghost,
       GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BLOCK,
       (GstPadProbeCallback) itembin_srcpad_buffer_probe, item, NULL);
-  gst_pad_add_probe (item->mixer_sink, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
-      (GstPadProbeCallback) mixer_sinkpad_event_probe, item, NULL);
-
-  /* start mixing this stream in the future; if there is a fade in,
-   * start at the time the previous stream starts fading out,
-   * otherwise start at the end of the previous stream */
-  if (item->previous && item->previous->end_rt > 0) {
-    if (item->fader.fadein_duration_secs > 0)
-      offset = item->previous->fadeout_rt;
+  item->event_probe_id = gst_pad_add_probe (item->mixer_sink,
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) mixer_sinkpad_probe, item, NULL);
+  if (spare)
+    item->spare_probe_id = gst_pad_add_probe (item->ghost,
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BLOCK,
+        (GstPadProbeCallback) itembin_srcpad_spare_probe, item, NULL);
+
+  /* start mixing this stream in the future; if an overlap is configured,
+   * start that long before the previous stream ends, else if there is a
+   * fade in, start at the sample the previous stream starts fading out,
+   * otherwise on the sample right after the previous stream ends */
+  if (item->previous && item->previous->end_sample > 0) {
+    if (item->fader.overlap_ms >= 0 && !item->fader.gapless) {
+      overlap = player_time_to_samples (self,
+          item->fader.overlap_ms * GST_MSECOND);
+      overlap = MIN (overlap,
+          item->previous->end_sample - item->previous->start_sample);
+      item->start_sample = item->previous->end_sample - overlap;
+    } else if (item->fader.fadein_duration_ms > 0 && !item->fader.gapless)
+      item->start_sample = item->previous->fadeout_sample;
     else
-      offset = item->previous->end_rt;
+      item->start_sample = item->previous->end_sample;
 
-    gst_pad_set_offset (item->mixer_sink, offset);
+    gst_pad_set_offset (item->mixer_sink,
+        player_samples_to_time (self, item->start_sample));
   }
-  item->start_rt = offset;
 
+  gst_element_set_locked_state (item->bin, FALSE);
   gst_element_sync_state_with_parent (item->bin);
 
-  utils_dbg (PLR, "item %p: created, linked to %s:%s, start_rt: %"
-      GST_TIME_FORMAT "\n", item, GST_DEBUG_PAD_NAME (item->mixer_sink),
-      GST_TIME_ARGS (item->start_rt));
+  setup_time = g_get_monotonic_time () - setup_start;
+  self->setup_time_total_us += setup_time;
+  if (setup_time > self->setup_time_max_us)
+    self->setup_time_max_us = setup_time;
+  stats_hist_add (&player_stats.item_setup, setup_time);
+
+  utils_dbg (PLR, "item %p: ready after %" G_GINT64_FORMAT "us, start sample: %"
+      G_GUINT64_FORMAT "\n", item, setup_time, item->start_sample);
+  TRACE_ITEM_CREATED (item, item->file, item->zone, spare, setup_time);
+  tracer_end (setup_start, "player", "item_setup", item->file);
+
+  /* until the first buffer comes out, see itembin_srcpad_buffer_probe() */
+  item->preroll_start = tracer_begin ();
 
   g_free (uri);
   return item;
 }
 
 static void
-play_queue_item_free (struct play_queue_item * item)
+play_queue_item_destroy (struct play_queue_item * item)
 {
-  utils_dbg (PLR, "item %p: freeing item\n", item);
+  utils_dbg (PLR, "item %p: destroying item\n", item);
 
   g_free (item->file);
   g_free (item->zone);
+  g_free (item->fallback);
+  if (item->pcm)
+    g_bytes_unref (item->pcm);
 
   gst_element_set_locked_state (item->bin, TRUE);
   gst_element_set_state (item->bin, GST_STATE_NULL);
@@ -317,40 +876,179 @@ play_queue_item_free (struct play_queue_item * item)
   g_free (item);
 }
 
+static void
+play_queue_item_free (struct play_queue_item * item)
+{
+  struct player *self = item->player;
+  GQueue *pool = &self->item_pool[item->chain];
+  gboolean recycle;
+
+  /* only a mixer pad that reached EOS can stay linked to the mixer
+   * without holding it back, anything else goes away */
+  recycle = item->eos && g_queue_get_length (pool) < PLAY_QUEUE_SIZE;
+
+  utils_dbg (PLR, "item %p: freeing item\n", item);
+  TRACE_ITEM_FREED (item, item->file, recycle);
+  element_stats_item_done (item);
+
+  g_clear_pointer (&item->file, g_free);
+  g_clear_pointer (&item->zone, g_free);
+  g_clear_pointer (&item->fallback, g_free);
+
+  if (!recycle) {
+    play_queue_item_destroy (item);
+    return;
+  }
+
+  /* stop streaming first, so that no probe can fire while we clean up;
+   * READY is enough for uridecodebin to drop the source and decoders */
+  gst_element_set_locked_state (item->bin, TRUE);
+  gst_element_set_state (item->bin, GST_STATE_READY);
+  g_clear_pointer (&item->pcm, g_bytes_unref);
+
+  if (item->buffer_probe_id)
+    gst_pad_remove_probe (item->ghost, item->buffer_probe_id);
+  if (item->event_probe_id)
+    gst_pad_remove_probe (item->mixer_sink, item->event_probe_id);
+  if (item->spare_probe_id)
+    gst_pad_remove_probe (item->ghost, item->spare_probe_id);
+
+  xfade_mixer_pad_clear_fades (item->mixer_sink);
+
+  /* reset everything that play_queue_item_new() expects zeroed */
+  memset (&item->fader, 0, sizeof (struct fader));
+  item->previous = item->next = NULL;
+  item->duration = item->indexed_duration = 0;
+  item->start_sample = item->fadeout_sample = item->end_sample = 0;
+  item->played_end_sample = 0;
+  item->decode_cpu_us = 0;
+  item->buffer_probe_id = item->event_probe_id = item->spare_probe_id = 0;
+  item->spare_ready = 0;
+  item->started = item->eos = FALSE;
+
+  g_queue_push_tail (pool, item);
+}
+
 static void
 play_queue_item_set_fade (struct play_queue_item * item,
     GstClockTime start, gdouble start_value, GstClockTime end,
     gdouble end_value)
 {
-  GstControlBinding *binding;
-  GstControlSource *cs;
-  GstTimedValueControlSource *tvcs;
+  guint64 trace_start;
 
   utils_dbg (PLR, "item %p: scheduling fade from %lf (@ %" GST_TIME_FORMAT ") "
       "to %lf (@ %" GST_TIME_FORMAT ")\n", item,
       start_value, GST_TIME_ARGS (start), end_value, GST_TIME_ARGS (end));
-
-  cs = gst_interpolation_control_source_new ();
-  tvcs = GST_TIMED_VALUE_CONTROL_SOURCE (cs);
-  g_object_set (cs, "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
-  gst_timed_value_control_source_set (tvcs, start, start_value);
-  gst_timed_value_control_source_set (tvcs, end, end_value);
-
-  binding = gst_direct_control_binding_new_absolute (
-      GST_OBJECT_CAST (item->mixer_sink), "volume", cs);
-  gst_object_add_control_binding (GST_OBJECT_CAST (item->mixer_sink),
-      binding);
-  gst_object_unref (cs);
+  TRACE_FADE_SET (item, start, start_value, end, end_value);
+  trace_start = tracer_begin ();
+
+  /* the mixer multiplies the fade level with the pad's volume,
+   * which carries the loudness correction */
+  xfade_mixer_pad_set_fade (item->mixer_sink, start, start_value, end,
+      end_value, item->player->fade_shape);
+  tracer_end (trace_start, "player", "fade_set", item->file);
 }
 
 static gboolean
 player_ensure_next (struct player * self)
 {
-  if (!self->playlist->next)
-    self->playlist->next = play_queue_item_new (self, self->playlist);
+  if (!self->playlist->next) {
+    self->playlist->next = play_queue_item_new (self, self->playlist, FALSE);
+    player_queue_metadata_refresh (self);
+    /* the zone may have changed since the spare got picked */
+    player_ensure_spare (self);
+  }
   return G_SOURCE_REMOVE;
 }
 
+static gboolean
+player_ensure_spare (struct player * self)
+{
+  const gchar *fallback;
+
+  /* a spare from the previous zone's fallback playlist is no good
+   * for this one, e.g. a morning show's spare in the evening */
+  if (self->spare) {
+    fallback = sched_get_fallback_playlist (self->scheduler,
+        calculate_sched_time (0, self->pipeline));
+    if (!g_strcmp0 (fallback, self->spare->fallback))
+      return G_SOURCE_REMOVE;
+
+    utils_info (PLR, "fallback playlist changed, replacing the spare\n");
+    play_queue_item_free (self->spare);
+    self->spare = NULL;
+  }
+
+  self->spare = play_queue_item_new (self, NULL, TRUE);
+  return G_SOURCE_REMOVE;
+}
+
+/* starts the spare on the next sample the mixer is going to produce */
+static gboolean
+player_activate_spare (struct player * self)
+{
+  struct play_queue_item *spare = self->spare;
+  gint64 position = 0;
+  guint64 start;
+
+  /* not prerolled yet, or we couldn't figure out its duration */
+  if (!spare || !g_atomic_int_get (&spare->spare_ready) || !spare->end_sample)
+    return FALSE;
+
+  if (!gst_element_query_position (self->mixer, GST_FORMAT_TIME, &position) ||
+      position < 0)
+    position = 0;
+  start = player_time_to_samples (self, position);
+
+  /* it was scheduled as if it were to start at sample 0 */
+  spare->start_sample += start;
+  spare->fadeout_sample += start;
+  spare->end_sample += start;
+
+  gst_pad_send_event (spare->mixer_sink, gst_event_new_flush_start ());
+  gst_pad_send_event (spare->mixer_sink, gst_event_new_flush_stop (TRUE));
+  gst_pad_set_offset (spare->mixer_sink,
+      player_samples_to_time (self, spare->start_sample));
+  g_object_set (spare->mixer_sink, "volume", spare->gain, NULL);
+  spare->eos = FALSE;
+
+  gst_pad_link (spare->ghost, spare->mixer_sink);
+  gst_pad_remove_probe (spare->ghost, spare->spare_probe_id);
+  spare->spare_probe_id = 0;
+
+  utils_dbg (PLR, "item %p: spare started at sample %" G_GUINT64_FORMAT "\n",
+      spare, spare->start_sample);
+  tracer_instant ("player", "spare_activate", spare->file);
+
+  self->spare = NULL;
+  return TRUE;
+}
+
+/* replaces the failed current item (and whatever was queued after it)
+ * with the spare, without waiting for a new decoder to preroll */
+static gboolean
+player_failover (struct player * self)
+{
+  struct play_queue_item *failed = self->playlist;
+  struct play_queue_item *spare = self->spare;
+
+  if (!player_activate_spare (self))
+    return FALSE;
+
+  stats_counter_add (&player_stats.failovers, 1);
+
+  if (failed->next)
+    play_queue_item_free (failed->next);
+  failed->next = NULL;
+  self->playlist = spare;
+  play_queue_item_free (failed);
+
+  player_ensure_next (self);
+  g_idle_add ((GSourceFunc) player_ensure_spare, self);
+  player_queue_metadata_refresh (self);
+  return TRUE;
+}
+
 static gboolean
 player_recycle_item (struct play_queue_item * item)
 {
@@ -358,6 +1056,7 @@ player_recycle_item (struct play_queue_item * item)
   struct play_queue_item ** ptr;
 
   utils_dbg (PLR, "recycling item %p\n", item);
+  stats_counter_add (&player_stats.items_recycled, 1);
 
   /* this can happen when the very first loaded item fails to play
    * and we want to recycle it, otherwise normally it's the ->next
@@ -370,7 +1069,8 @@ player_recycle_item (struct play_queue_item * item)
   g_assert (*ptr == item);
   g_assert (item->next == NULL);
 
-  *ptr = play_queue_item_new (self, item->previous);
+  *ptr = play_queue_item_new (self, item->previous, FALSE);
+  player_queue_metadata_refresh (self);
 
   play_queue_item_free (item);
   return G_SOURCE_REMOVE;
@@ -380,8 +1080,11 @@ static gboolean
 player_handle_item_eos (struct play_queue_item * item)
 {
   struct player * self = item->player;
+  struct play_queue_item *next;
+  gint64 gap;
 
   utils_dbg (PLR, "item %p EOS\n", item);
+  tracer_instant ("player", "item_eos", item->file);
 
   if (G_UNLIKELY (item == self->playlist->next)) {
     utils_wrn (PLR, "next item finished before the current; corrupt file?\n");
@@ -391,13 +1094,51 @@ player_handle_item_eos (struct play_queue_item * item)
 
   g_assert (item == self->playlist);
 
+  /* see how the next item lines up with what actually got mixed
+   * of this one; back to back transitions should show no gap at all */
+  next = self->playlist->next;
+  if (next) {
+    gap = (gint64) next->start_sample - (gint64) item->played_end_sample;
+    stats_hist_add (&player_stats.transition_gap, ABS (gap));
+    if (next->fader.gapless || gap != 0)
+      utils_info (PLR, "item %p: %s of %" G_GINT64_FORMAT " samples "
+          "to the next item\n", item, gap < 0 ? "overlap" : "gap", ABS (gap));
+  }
+
   self->playlist = self->playlist->next;
   player_ensure_next (self);
+  player_queue_metadata_refresh (self);
 
   play_queue_item_free (item);
   return G_SOURCE_REMOVE;
 }
 
+/* files that failed to play get skipped for a while */
+static void
+play_queue_item_failed (struct play_queue_item * item)
+{
+  stats_counter_add (&player_stats.item_errors, 1);
+  midx_quarantine (item->file, utils_get_mtime (item->file));
+}
+
+static gboolean
+player_pool_owns_object (struct player * self, GstObject * object)
+{
+  struct play_queue_item *item;
+  GList *l;
+  gint i;
+
+  for (i = 0; i < ITEM_CHAIN_COUNT; i++) {
+    for (l = self->item_pool[i].head; l; l = l->next) {
+      item = l->data;
+      if (gst_object_has_as_ancestor (object, GST_OBJECT (item->bin)))
+        return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
 static gboolean
 player_bus_watch (GstBus *bus, GstMessage *msg, struct player *self)
 {
@@ -406,7 +1147,7 @@ player_bus_watch (GstBus *bus, GstMessage *msg, struct player *self)
 
   switch (GST_MESSAGE_TYPE (msg)) {
     case GST_MESSAGE_EOS:
-      /* EOS can only be received when audiomixer receives GST_EVENT_EOS
+      /* EOS can only be received when the mixer receives GST_EVENT_EOS
        * on a sink and has no other sink with more data available at that
        * moment, which can only happen if the scheduler stopped giving
        * us new files to enqueue */
@@ -415,6 +1156,18 @@ player_bus_watch (GstBus *bus, GstMessage *msg, struct player *self)
       g_main_loop_quit (self->loop);
       break;
 
+    case GST_MESSAGE_QOS:
+      /* the audio sink posts these when it had to drop or skip samples
+       * to stay in sync with the clock, i.e. when it underran */
+      if (GST_MESSAGE_SRC (msg) == GST_OBJECT (self->sink) ||
+          gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg),
+              GST_OBJECT (self->sink))) {
+        stats_counter_add (&player_stats.sink_qos, 1);
+        utils_dbg (PLR, "QoS from %s\n",
+            GST_OBJECT_NAME (GST_MESSAGE_SRC (msg)));
+      }
+      break;
+
     case GST_MESSAGE_INFO:
       gst_message_parse_info (msg, &error, &debug);
       utils_info (PLR, "INFO from element %s: %s\n",
@@ -457,16 +1210,37 @@ player_bus_watch (GstBus *bus, GstMessage *msg, struct player *self)
       /* check if the message came from an item's bin and attempt to recover;
        * it is possible to get an error there, in case of an unsupported
        * codec for example, or maybe a file read error... */
-      if (gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg),
+      if (self->spare && gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg),
+                GST_OBJECT (self->spare->bin))) {
+        /*
+         * the spare is not in the mix yet, just get another one
+         */
+        utils_info (PLR, "error message originated from the spare "
+              "item's bin; replacing it\n");
+
+        play_queue_item_failed (self->spare);
+        play_queue_item_free (self->spare);
+        self->spare = NULL;
+        g_idle_add ((GSourceFunc) player_ensure_spare, self);
+
+      } else if (gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg),
                 GST_OBJECT (item->bin))) {
         /*
          * this is the last item in the queue; for this case we can recover
-         * by calling the recycle function
+         * by calling the recycle function, unless it is also the one
+         * that is currently playing, in which case the spare takes over
          */
-        utils_info (PLR, "error message originated from the next "
-              "item's bin; recycling item\n");
+        play_queue_item_failed (item);
 
-        player_recycle_item (item);
+        if (item == self->playlist && player_failover (self)) {
+          utils_info (PLR, "error message originated from the current "
+              "item's bin; switched to the spare item\n");
+        } else {
+          utils_info (PLR, "error message originated from the next "
+                "item's bin; recycling item\n");
+
+          player_recycle_item (item);
+        }
 
         /* ensure the pipeline is PLAYING state;
          * error messages tamper with it */
@@ -477,26 +1251,36 @@ player_bus_watch (GstBus *bus, GstMessage *msg, struct player *self)
                 GST_OBJECT (self->playlist->bin))) {
         /*
          * this is the decodebin of the currently playing item, but we
-         * have already linked the next item; no graceful recover here...
-         * we need to get rid of the next item, then recycle the current one;
-         * there *will* be an audio glitch here.
+         * have already linked the next item; the spare can take over
+         * right away, otherwise we need to get rid of the next item,
+         * then recycle the current one; there *will* be an audio glitch
+         * in that case.
          */
-        utils_info (PLR, "error message originated from the current "
-            "item's bin; recycling the whole playlist\n");
+        play_queue_item_failed (self->playlist);
+
+        if (player_failover (self)) {
+          utils_info (PLR, "error message originated from the current "
+              "item's bin; switched to the spare item\n");
+        } else {
+          utils_info (PLR, "error message originated from the current "
+              "item's bin; recycling the whole playlist\n");
 
-        play_queue_item_free (self->playlist->next);
-        self->playlist->next = NULL;
-        player_recycle_item (self->playlist);
+          play_queue_item_free (self->playlist->next);
+          self->playlist->next = NULL;
+          player_recycle_item (self->playlist);
+        }
 
         /* ensure the pipeline is PLAYING state;
          * error messages tamper with it */
         gst_element_set_state (self->pipeline, GST_STATE_PLAYING);
 
       } else if (!gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg),
-                GST_OBJECT (self->pipeline))) {
+                GST_OBJECT (self->pipeline)) ||
+          player_pool_owns_object (self, GST_MESSAGE_SRC (msg))) {
         /*
-         * this is an element that we have already removed from the pipeline.
-         * this can happen for example when a decodebin posts 2 errors in a row
+         * this is an element that we have already removed from the pipeline,
+         * or one that is sitting in the pool. this can happen for example
+         * when a decodebin posts 2 errors in a row
          */
         utils_info (PLR, "error message originated from already removed item; "
             "ignoring\n");
@@ -516,58 +1300,84 @@ player_bus_watch (GstBus *bus, GstMessage *msg, struct player *self)
   return G_SOURCE_CONTINUE;
 }
 
-/* this function replaces all occurencies of the double quote character (")
- * with a single quote character (') in order to allow the string to be used
- * as a JSON value without the need for escaping */
-static inline void
-string_replace_quotes (char * str)
+/* copies a tag to its slot in song_info, making sure that if it
+ * gets truncated it doesn't end in the middle of a UTF-8 character;
+ * the metadata server escapes it, but it has to be valid UTF-8 */
+static void
+copy_song_string (char * dst, const gchar * src, gsize len)
 {
-  char *c;
-  if (str != NULL)
-    for (c = str; *c != '\0'; c++)
-      if (*c == '"')
-        *c = '\'';
+  const gchar *end;
+
+  if (!src)
+    return;
+
+  g_strlcpy (dst, src, len);
+  if (!g_utf8_validate (dst, -1, &end))
+    *(gchar *) end = '\0';
+}
+
+/* when whatever the mixer outputs at running time rt gets heard, in
+ * monotonic time; the pipeline clock is sampled together with the
+ * monotonic clock, so the two don't need to run at the same rate for
+ * more than the length of a song, and the sink renders everything the
+ * pipeline latency after its running time */
+static guint64
+player_rt_to_usecs (GstClockTimeDiff rt, GstClockTime now_rt,
+    GstClockTime latency, guint64 now_usecs)
+{
+  GstClockTimeDiff offset;
+
+  /* the pipeline didn't start yet, we'll be back when the item does */
+  if (!GST_CLOCK_TIME_IS_VALID (now_rt))
+    return 0;
+
+  offset = rt + (GstClockTimeDiff) latency - (GstClockTimeDiff) now_rt;
+  if (offset < 0 && (guint64) GST_TIME_AS_USECONDS (-offset) >= now_usecs)
+    return 0;
+
+  return now_usecs + GST_TIME_AS_USECONDS (offset);
 }
 
 static void
-populate_song_info (struct play_queue_item * item, struct song_info * song)
+populate_song_info (struct play_queue_item * item, struct song_info * song,
+    GstClockTime now_rt, GstClockTime latency, guint64 now_usecs)
 {
   GstEvent *tag_event;
   GstTagList *taglist = NULL;
-  gint64 pos = GST_CLOCK_TIME_NONE;
+  gchar *tag;
 
-  /* cleanup song_info */
-  g_clear_pointer (&song->artist, g_free);
-  g_clear_pointer (&song->album, g_free);
-  g_clear_pointer (&song->title, g_free);
-  g_clear_pointer (&song->path, g_free);
-  g_clear_pointer (&song->zone, g_free);
-  song->duration_sec = song->elapsed_sec = 0;
+  memset (song, 0, sizeof (struct song_info));
 
   if (!item)
     return;
 
-  song->path = g_strdup (item->file);
-  string_replace_quotes (song->path);
-  song->zone = g_strdup (item->zone);
-  string_replace_quotes (song->zone);
+  copy_song_string (song->path, item->file, sizeof (song->path));
+  copy_song_string (song->zone, item->zone, sizeof (song->zone));
 
   tag_event = gst_pad_get_sticky_event (item->mixer_sink, GST_EVENT_TAG, 0);
   if (tag_event)
     gst_event_parse_tag (tag_event, &taglist);
 
   if (taglist) {
-    gst_tag_list_get_string (taglist, GST_TAG_ARTIST, &song->artist);
-    string_replace_quotes (song->artist);
-    gst_tag_list_get_string (taglist, GST_TAG_ALBUM, &song->album);
-    string_replace_quotes (song->album);
-    gst_tag_list_get_string (taglist, GST_TAG_TITLE, &song->title);
-    string_replace_quotes (song->title);
+    if (gst_tag_list_get_string (taglist, GST_TAG_ARTIST, &tag)) {
+      copy_song_string (song->artist, tag, sizeof (song->artist));
+      g_free (tag);
+    }
+    if (gst_tag_list_get_string (taglist, GST_TAG_ALBUM, &tag)) {
+      copy_song_string (song->album, tag, sizeof (song->album));
+      g_free (tag);
+    }
+    if (gst_tag_list_get_string (taglist, GST_TAG_TITLE, &tag)) {
+      copy_song_string (song->title, tag, sizeof (song->title));
+      g_free (tag);
+    }
   }
 
-  if (gst_pad_peer_query_position (item->mixer_sink, GST_FORMAT_TIME, &pos))
-    song->elapsed_sec =
-        (uint32_t) gst_util_uint64_scale_round (pos, 1, GST_SECOND);
+  /* the first sample of the file, not just of its audible part */
+  song->start_usecs = player_rt_to_usecs (
+      (GstClockTimeDiff) player_samples_to_time (item->player,
+          item->start_sample) - (GstClockTimeDiff) item->cue_in,
+      now_rt, latency, now_usecs);
   song->duration_sec =
       (uint32_t) gst_util_uint64_scale_round (item->duration, 1, GST_SECOND);
 
@@ -575,58 +1385,263 @@ populate_song_info (struct play_queue_item * item, struct song_info * song)
     gst_event_unref (tag_event);
 }
 
+/* the song info is filled in here and only handed to the metadata
+ * handler at the end, so that readers never wait on our queries; this
+ * only runs when something changed, readers work out the elapsed time
+ * on their own from the start time */
 static gboolean
 refresh_metadata (struct player * self)
 {
-  struct current_state *mstate;
+  struct song_info *current = &self->meta_current;
+  struct song_info *next = &self->meta_next;
+  GstClockTime now_rt, latency = 0;
+  GstQuery *query;
+  gboolean live;
+  guint64 now_usecs;
+  uint32_t overlap_sec = 0;
+  guint64 fade_usecs = 0;
+
+  g_atomic_int_set (&self->meta_refresh_pending, FALSE);
 
-  mstate = meta_get_state (self->mh);
-  pthread_mutex_lock (&mstate->proc_mutex);
+  query = gst_query_new_latency ();
+  if (gst_element_query (self->pipeline, query))
+    gst_query_parse_latency (query, &live, &latency, NULL);
+  gst_query_unref (query);
 
-  populate_song_info (self->playlist, &mstate->current);
-  populate_song_info (self->playlist->next, &mstate->next);
+  now_rt = player_get_running_time (self);
+  now_usecs = stats_get_usecs ();
+
+  populate_song_info (self->playlist, current, now_rt, latency, now_usecs);
+  populate_song_info (self->playlist->next, next, now_rt, latency, now_usecs);
 
   if (self->playlist->next &&
-      self->playlist->next->fader.fadein_duration_secs > 0)
-    mstate->overlap_sec = self->playlist->fader.fadeout_duration_secs;
-  else
-    mstate->overlap_sec = 0;
+      self->playlist->next->start_sample < self->playlist->end_sample)
+    overlap_sec = (uint32_t) gst_util_uint64_scale_int_round (
+        self->playlist->end_sample - self->playlist->next->start_sample,
+        1, self->mix_rate);
 
-  pthread_mutex_unlock (&mstate->proc_mutex);
+  /* known once we know the duration */
+  if (self->playlist->fadeout_sample > 0)
+    fade_usecs = player_rt_to_usecs (player_samples_to_time (self,
+            self->playlist->fadeout_sample), now_rt, latency, now_usecs);
 
-  return G_SOURCE_CONTINUE;
+  meta_state_update (self->mh, current, next, overlap_sec, fade_usecs);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* can be called from any thread, refreshes that pile up before
+ * the main loop gets to them are done only once */
+static void
+player_queue_metadata_refresh (struct player * self)
+{
+  if (g_atomic_int_compare_and_exchange (&self->meta_refresh_pending,
+          FALSE, TRUE))
+    self->meta_refresh_id =
+        g_idle_add ((GSourceFunc) refresh_metadata, self);
+}
+
+static void
+cleanup_metadata (struct player * self)
+{
+  if (g_atomic_int_get (&self->meta_refresh_pending))
+    g_source_remove (self->meta_refresh_id);
+  g_atomic_int_set (&self->meta_refresh_pending, FALSE);
+
+  populate_song_info (NULL, &self->meta_current, GST_CLOCK_TIME_NONE, 0, 0);
+  populate_song_info (NULL, &self->meta_next, GST_CLOCK_TIME_NONE, 0, 0);
+  meta_state_update (self->mh, &self->meta_current, &self->meta_next, 0, 0);
+}
+
+/* the mixer outputs silence flagged as GAP when none of its inputs
+ * has any data, which is what a transition that left a gap sounds like */
+static GstPadProbeReturn
+mixer_srcpad_probe (GstPad * pad, GstPadProbeInfo * info,
+    struct player * self)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  GstClockTime next_pts = player_stats.mixer_next_pts;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  /* allow for the rounding of buffer durations */
+  if (GST_CLOCK_TIME_IS_VALID (next_pts) &&
+      (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DISCONT) ||
+          ABS (GST_CLOCK_DIFF (next_pts, pts)) > GST_SECOND / self->mix_rate))
+  {
+    stats_counter_add (&player_stats.mixer_discont, 1);
+    utils_dbg (PLR, "mixer output discontinuity at %" GST_TIME_FORMAT
+        ", expected %" GST_TIME_FORMAT "\n", GST_TIME_ARGS (pts),
+        GST_TIME_ARGS (next_pts));
+  }
+  player_stats.mixer_next_pts = GST_BUFFER_DURATION_IS_VALID (buffer) ?
+      pts + GST_BUFFER_DURATION (buffer) : GST_CLOCK_TIME_NONE;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_GAP)) {
+    if (!GST_CLOCK_TIME_IS_VALID (player_stats.silence_start))
+      player_stats.silence_start = pts;
+  } else if (GST_CLOCK_TIME_IS_VALID (player_stats.silence_start)) {
+    stats_hist_add (&player_stats.silence,
+        GST_TIME_AS_USECONDS (pts - player_stats.silence_start));
+    utils_info (PLR, "mixer output was silent for %" GST_TIME_FORMAT "\n",
+        GST_TIME_ARGS (pts - player_stats.silence_start));
+    player_stats.silence_start = GST_CLOCK_TIME_NONE;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* runs in the same thread as the one above, after the output conversion */
+static GstPadProbeReturn
+sink_sinkpad_probe (GstPad * pad, GstPadProbeInfo * info,
+    struct player * self)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstEvent *event;
+  const GstSegment *segment;
+
+  /* the first buffer is always a discontinuity */
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DISCONT) &&
+      player_stats.sink_started)
+    stats_counter_add (&player_stats.sink_discont, 1);
+  player_stats.sink_started = TRUE;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (!event)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_segment (event, &segment);
+  player_stats_headroom (self, gst_segment_to_running_time (segment,
+          GST_FORMAT_TIME, GST_BUFFER_PTS (buffer)),
+      &player_stats.output_headroom, &player_stats.output_late);
+  gst_event_unref (event);
+
+  return GST_PAD_PROBE_OK;
 }
 
+/* the audio sink's own buffering, if we can find it */
 static void
-cleanup_metadata (struct meta_handler *mh)
+player_report_sink (struct player * self)
+{
+  GstElement *sink = NULL;
+  GstIterator *it;
+  GValue value = G_VALUE_INIT;
+  GstQuery *query;
+  GstClockTime min_latency, max_latency;
+  gboolean live;
+  gint64 buffer_time, latency_time;
+
+  if (GST_IS_BIN (self->sink)) {
+    it = gst_bin_iterate_sinks (GST_BIN (self->sink));
+    if (gst_iterator_next (it, &value) == GST_ITERATOR_OK) {
+      sink = g_value_dup_object (&value);
+      g_value_unset (&value);
+    }
+    gst_iterator_free (it);
+  } else {
+    sink = gst_object_ref (self->sink);
+  }
+
+  if (sink && g_object_class_find_property (G_OBJECT_GET_CLASS (sink),
+          "buffer-time")) {
+    g_object_get (sink, "buffer-time", &buffer_time, "latency-time",
+        &latency_time, NULL);
+    utils_info (STATS, "%s: buffer %" G_GINT64_FORMAT "us, period %"
+        G_GINT64_FORMAT "us\n", GST_OBJECT_NAME (sink), buffer_time,
+        latency_time);
+  }
+  g_clear_object (&sink);
+
+  query = gst_query_new_latency ();
+  if (gst_element_query (self->pipeline, query)) {
+    gst_query_parse_latency (query, &live, &min_latency, &max_latency);
+    utils_info (STATS, "pipeline latency: %" GST_TIME_FORMAT "%s\n",
+        GST_TIME_ARGS (min_latency), live ? " (live)" : "");
+  }
+  gst_query_unref (query);
+}
+
+static gboolean
+report_stats (struct player * self)
 {
-  struct current_state *mstate;
+  stats_report ();
+  player_report_sink (self);
+  return G_SOURCE_CONTINUE;
+}
 
-  mstate = meta_get_state (mh);
-  pthread_mutex_lock (&mstate->proc_mutex);
+/* Runs in the thread that posted the message; the ones that keep the
+ * audio device fed (the mixer's aggregate loop and the sink's ring
+ * buffer thread) go realtime, everything upstream of the mixer stays
+ * as it is, an underrun there is covered by the mixer's latency */
+static GstBusSyncReply
+player_bus_sync_handler (GstBus * bus, GstMessage * msg, struct player * self)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
 
-  populate_song_info (NULL, &mstate->current);
-  populate_song_info (NULL, &mstate->next);
-  mstate->overlap_sec = 0;
+  if (GST_MESSAGE_TYPE (msg) != GST_MESSAGE_STREAM_STATUS)
+    return GST_BUS_PASS;
 
-  pthread_mutex_unlock (&mstate->proc_mutex);
+  gst_message_parse_stream_status (msg, &type, &owner);
+  if (owner != self->mixer && owner != self->sink &&
+      !gst_object_has_as_ancestor (GST_OBJECT (owner),
+          GST_OBJECT (self->sink)))
+    return GST_BUS_PASS;
+
+  if (type == GST_STREAM_STATUS_TYPE_ENTER)
+    rt_thread_enter (GST_OBJECT_NAME (owner));
+  else if (type == GST_STREAM_STATUS_TYPE_LEAVE)
+    rt_thread_leave ();
+
+  return GST_BUS_PASS;
+}
+
+static gboolean
+report_realtime (struct player * self)
+{
+  rt_report ();
+  return G_SOURCE_CONTINUE;
 }
 
 int
 player_init (struct player* self, struct scheduler* scheduler,
-    struct meta_handler *mh, const char *audiosink)
+    struct meta_handler *mh, struct transcoder *transcoder,
+    struct pcm_cache *pcm_cache, const char *audiosink)
 {
   GstElement *sink = NULL;
   GstElement *convert = NULL;
+  GstElement *resample = NULL;
+  GstCaps *caps;
+  GstPad *pad;
+  gint i;
 
   gst_init (NULL, NULL);
 
+  /* everything gets converted to this before the mixer, so that
+   * the mixer never has to negotiate and the output conversion
+   * only does any work if the sink can't take it as is */
+  self->mix_caps = g_strdup_printf ("audio/x-raw, format=%s, "
+      "layout=interleaved, rate=%i, channels=%i", MIX_FORMAT,
+      self->mix_rate, self->mix_channels);
+
+  for (i = 0; i < ITEM_CHAIN_COUNT; i++)
+    g_queue_init (&self->item_pool[i]);
+
   self->scheduler = scheduler;
   self->mh = mh;
+  self->transcoder = transcoder;
+  self->pcm_cache = pcm_cache;
   self->loop = g_main_loop_new (NULL, FALSE);
   self->pipeline = gst_pipeline_new ("player");
-  self->mixer = gst_element_factory_make ("audiomixer", NULL);
+  xfade_mixer_register ();
+  self->mixer = gst_element_factory_make ("xfademixer", NULL);
   convert = gst_element_factory_make ("audioconvert", NULL);
+  resample = gst_element_factory_make ("audioresample", NULL);
   if (audiosink) {
     GError *error = NULL;
     sink = gst_parse_bin_from_description (audiosink, TRUE, &error);
@@ -639,21 +1654,86 @@ player_init (struct player* self, struct scheduler* scheduler,
   if (!sink)
     sink = gst_element_factory_make ("autoaudiosink", NULL);
 
-  if (!self->mixer || !convert || !sink) {
+  if (!self->mixer || !convert || !resample || !sink) {
     utils_err (PLR, "Your GStreamer installation is missing required elements\n");
     g_clear_object (&self->mixer);
     g_clear_object (&convert);
+    g_clear_object (&resample);
     g_clear_object (&sink);
     return -1;
   }
 
-  gst_bin_add_many (GST_BIN (self->pipeline), self->mixer, convert, sink, NULL);
-  if (!gst_element_link_many (self->mixer, convert, sink, NULL)) {
-    utils_err (PLR, "Failed to link audiomixer to audio sink. Check caps\n");
+  gst_bin_add_many (GST_BIN (self->pipeline), self->mixer, convert, resample,
+      sink, NULL);
+
+  caps = gst_caps_from_string (self->mix_caps);
+  if (!caps || !gst_element_link_filtered (self->mixer, convert, caps) ||
+      !gst_element_link_many (convert, resample, sink, NULL)) {
+    utils_err (PLR, "Failed to link the mixer to audio sink. Check caps\n");
+    if (caps)
+      gst_caps_unref (caps);
     return -1;
   }
+  gst_caps_unref (caps);
+
+  self->sink = sink;
+
+  stats_hist_register (&player_stats.item_setup, "item_setup",
+      "Time to set up an item for playback", "us");
+  stats_counter_register (&player_stats.items_built, "items_built",
+      "Items built from scratch");
+  stats_counter_register (&player_stats.items_reused, "items_reused",
+      "Items reused from the pool");
+  stats_counter_register (&player_stats.item_errors, "item_errors",
+      "Items that failed to decode");
+  stats_counter_register (&player_stats.items_recycled, "items_recycled",
+      "Items replaced before they started playing");
+  stats_counter_register (&player_stats.failovers, "failovers",
+      "Times the spare item took over");
+
+  stats_hist_register (&player_stats.start_error, "item_start_error",
+      "Distance of item starts from their scheduled time", "us");
+  stats_hist_register (&player_stats.transition_gap, "transition_gap",
+      "Gap or overlap between consecutive items", "samples");
+  stats_hist_register (&player_stats.input_headroom, "mixer_input_headroom",
+      "How far ahead of the clock data reaches the mixer", "us");
+  stats_hist_register (&player_stats.output_headroom, "sink_input_headroom",
+      "How far ahead of the clock data reaches the sink", "us");
+  stats_hist_register (&player_stats.silence, "mixer_silence",
+      "Runs of mixer output with no input", "us");
+  stats_counter_register (&player_stats.input_late, "mixer_late_buffers",
+      "Buffers that reached the mixer after their time");
+  stats_counter_register (&player_stats.output_late, "sink_late_buffers",
+      "Buffers that reached the sink after their time");
+  stats_counter_register (&player_stats.mixer_discont, "mixer_discont",
+      "Discontinuities in the mixer's output");
+  stats_counter_register (&player_stats.sink_discont, "sink_discont",
+      "Discontinuities at the sink's input");
+  stats_counter_register (&player_stats.sink_qos, "sink_qos",
+      "QoS events from the sink, i.e. dropped or skipped samples");
+  player_stats.mixer_next_pts = GST_CLOCK_TIME_NONE;
+  player_stats.silence_start = GST_CLOCK_TIME_NONE;
+
+  pad = gst_element_get_static_pad (self->mixer, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) mixer_srcpad_probe, self, NULL);
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (sink, "sink");
+  if (pad) {
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) sink_sinkpad_probe, self, NULL);
+    gst_object_unref (pad);
+  }
 
-  utils_dbg (PLR, "player initialized\n");
+  if (rt_is_enabled ()) {
+    GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (self->pipeline));
+    gst_bus_set_sync_handler (bus, (GstBusSyncHandler) player_bus_sync_handler,
+        self, NULL);
+    gst_object_unref (bus);
+  }
+
+  utils_dbg (PLR, "player initialized, mixing in %s\n", self->mix_caps);
 
   return 0;
 }
@@ -663,6 +1743,7 @@ player_cleanup (struct player* self)
 {
   g_clear_object (&self->pipeline);
   g_clear_pointer (&self->loop, g_main_loop_unref);
+  g_clear_pointer (&self->mix_caps, g_free);
 
   memset (self, 0, sizeof (struct player));
 
@@ -672,15 +1753,23 @@ player_cleanup (struct player* self)
 void
 player_loop (struct player* self)
 {
+  struct play_queue_item *item;
   GstBus *bus;
-  guint timeout_id;
+  guint rt_timeout_id = 0;
+  guint signal_id;
+  gint i;
 
-  self->playlist = play_queue_item_new (self, NULL);
+  self->playlist = play_queue_item_new (self, NULL, FALSE);
+  self->spare = play_queue_item_new (self, NULL, TRUE);
 
   bus = gst_pipeline_get_bus (GST_PIPELINE (self->pipeline));
   gst_bus_add_watch (bus, (GstBusFunc) player_bus_watch, self);
 
-  timeout_id = g_timeout_add_seconds (1, (GSourceFunc) refresh_metadata, self);
+  player_queue_metadata_refresh (self);
+  if (rt_is_enabled ())
+    rt_timeout_id = g_timeout_add_seconds (RT_REPORT_INTERVAL_SECS,
+        (GSourceFunc) report_realtime, self);
+  signal_id = g_unix_signal_add (SIGUSR1, (GSourceFunc) report_stats, self);
 
   utils_dbg (PLR, "Beginning playback\n");
   gst_element_set_state (self->pipeline, GST_STATE_PLAYING);
@@ -690,15 +1779,32 @@ player_loop (struct player* self)
   gst_element_set_state (self->pipeline, GST_STATE_NULL);
   utils_dbg (PLR, "Playback stopped\n");
 
-  g_source_remove (timeout_id);
-  cleanup_metadata (self->mh);
+  if (rt_timeout_id)
+    g_source_remove (rt_timeout_id);
+  g_source_remove (signal_id);
+  cleanup_metadata (self);
 
   gst_bus_remove_watch (bus);
   g_object_unref (bus);
 
   if (self->playlist->next)
-    play_queue_item_free (self->playlist->next);
-  play_queue_item_free (self->playlist);
+    play_queue_item_destroy (self->playlist->next);
+  play_queue_item_destroy (self->playlist);
+  if (self->spare)
+    play_queue_item_destroy (self->spare);
+  self->spare = NULL;
+
+  for (i = 0; i < ITEM_CHAIN_COUNT; i++) {
+    while ((item = g_queue_pop_head (&self->item_pool[i])) != NULL)
+      play_queue_item_destroy (item);
+  }
+
+  utils_info (PLR, "item setup: %u built, %u reused, avg %" G_GINT64_FORMAT
+      "us, max %" G_GINT64_FORMAT "us\n", self->items_created,
+      self->items_reused, self->setup_time_total_us /
+      MAX (self->items_created + self->items_reused, 1),
+      self->setup_time_max_us);
+  stats_report ();
 }
 
 void
@@ -706,3 +1812,57 @@ player_loop_quit (struct player* self)
 {
   g_main_loop_quit (self->loop);
 }
+
+static void
+player_dump_item (struct player * self, FILE * out, const gchar * type,
+    gint pos, struct play_queue_item * item)
+{
+  const gchar *state;
+
+  if (item->eos)
+    state = "finished";
+  else if (item->started)
+    state = "playing";
+  else if (item == self->spare)
+    state = g_atomic_int_get (&item->spare_ready) ? "ready" : "prerolling";
+  else
+    state = "prerolling";
+
+  /* transition points are 0 until the duration is known */
+  fprintf (out, "%s\tpos=%i\tstate=%s\tfile=%s\tzone=%s\tchain=%s\t"
+      "gain=%.2lf\tduration=%.3lf\tstart=%.3lf\tfadeout=%.3lf\t"
+      "end=%.3lf\tdecode_cpu=%.3lf\n", type, pos, state,
+      item->file ? item->file : "",
+      item->zone ? item->zone : "", item_chain_name[item->chain], item->gain,
+      item->duration / (gdouble) GST_SECOND,
+      item->start_sample / (gdouble) self->mix_rate,
+      item->fadeout_sample / (gdouble) self->mix_rate,
+      item->end_sample / (gdouble) self->mix_rate,
+      item->decode_cpu_us / (gdouble) G_USEC_PER_SEC);
+}
+
+/* runs in the main loop, like everything else that touches the queue */
+void
+player_dump (struct player * self, FILE * out)
+{
+  struct play_queue_item *item;
+  gint64 position = 0;
+  gint i;
+
+  if (!self->mixer || !gst_element_query_position (self->mixer,
+          GST_FORMAT_TIME, &position) || position < 0)
+    position = 0;
+  fprintf (out, "mixer\tposition=%.3lf\trate=%i\tchannels=%i\n",
+      position / (gdouble) GST_SECOND, self->mix_rate, self->mix_channels);
+
+  for (item = self->playlist, i = 0; item; item = item->next, i++)
+    player_dump_item (self, out, "item", i, item);
+  if (self->spare)
+    player_dump_item (self, out, "spare", 0, self->spare);
+
+  for (i = 0; i < ITEM_CHAIN_COUNT; i++)
+    fprintf (out, "pool\tchain=%s\titems=%u\n", item_chain_name[i],
+        g_queue_get_length (&self->item_pool[i]));
+  fprintf (out, "setup\tbuilt=%u\treused=%u\tmax_us=%" G_GINT64_FORMAT
+      "\n", self->items_created, self->items_reused, self->setup_time_max_us);
+}
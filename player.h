@@ -23,12 +23,29 @@
 
 #include "scheduler.h"
 #include "meta_handler.h"
+#include "transcoder.h"
+#include "pcm_cache.h"
+#include "xfade_mixer.h"
 #include <gst/gst.h>
+#include <stdio.h>     /* for FILE */
 
 #define PLAY_QUEUE_SIZE 3
 
 struct player;
 
+/* the filter chain between the decoder and the mixer depends on what we
+ * know about the file from the media index; item bins are pooled per
+ * chain flavour */
+enum item_chain
+{
+  ITEM_CHAIN_DIRECT = 0,      /* decoder output matches the mix format */
+  ITEM_CHAIN_CONVERT,         /* same rate and channels, other sample format */
+  ITEM_CHAIN_NORMALIZED,      /* gain comes from the media index */
+  ITEM_CHAIN_REPLAYGAIN,      /* fall back to ReplayGain tags */
+  ITEM_CHAIN_PCM,             /* decoded copy from the PCM cache, no decoder */
+  ITEM_CHAIN_COUNT
+};
+
 struct play_queue_item
 {
   struct player *player;
@@ -37,16 +54,40 @@ struct play_queue_item
   gchar *file;
   struct fader fader;
   gchar *zone;
+  gchar *fallback;        /* only for the spare, the playlist it came from */
 
-  /* info we discovered; rt = running time */
-  guint64 duration;
-  GstClockTime start_rt;
-  GstClockTime fadeout_rt;
-  GstClockTime end_rt;
+  /* info we got from the media index; cue points are in stream time,
+   * cue_out is GST_CLOCK_TIME_NONE if unknown */
+  gdouble gain;
+  GstClockTime cue_in;
+  GstClockTime cue_out;
+  GstClockTime indexed_duration;  /* 0 if unknown */
+  GBytes *pcm;                    /* until handed to the appsrc */
 
-  /* operational variables */
+  /* info we discovered; the duration is in ns, transition points are in
+   * samples at the mix rate, counted in the mixer's running time, so that
+   * consecutive items can be lined up without any rounding in between */
+  guint64 duration;           /* ns */
+  guint64 start_sample;
+  guint64 fadeout_sample;
+  guint64 end_sample;
+  guint64 played_end_sample;  /* one past the last sample that got mixed */
+  guint64 decode_cpu_us;      /* only counted with the element stats on */
+
+  /* operational variables; these survive in the pool */
+  enum item_chain chain;
   GstElement *bin;
+  GstElement *decodebin;         /* NULL for ITEM_CHAIN_PCM */
+  GstElement *appsrc;            /* only for ITEM_CHAIN_PCM */
+  GstPad *ghost;
   GstPad *mixer_sink;
+  gulong buffer_probe_id;
+  gulong event_probe_id;
+  gulong spare_probe_id;
+  guint64 preroll_start;         /* for the tracer, 0 if it's off */
+  gint spare_ready;
+  gboolean started;              /* the mixer got its first buffer */
+  gboolean eos;
 
   struct play_queue_item *previous;
   struct play_queue_item *next;
@@ -54,23 +95,55 @@ struct play_queue_item
 
 struct player
 {
+  /* configuration */
+  gdouble loudness_target;
+  gint mix_rate;
+  gint mix_channels;
+  XFadeShape fade_shape;
+
   /* external objects */
   struct scheduler *scheduler;
   struct meta_handler *mh;
+  struct transcoder *transcoder;
+  struct pcm_cache *pcm_cache;
 
   /* internal objects */
   GMainLoop *loop;
   GstElement *pipeline;
   GstElement *mixer;
+  GstElement *sink;
+  gchar *mix_caps;
+  /* filled in by refresh_metadata() before handing them to mh */
+  struct song_info meta_current;
+  struct song_info meta_next;
+  gint meta_refresh_pending;
+  guint meta_refresh_id;
 
   struct play_queue_item *playlist;
+
+  /* prerolled item from the fallback playlist, held just before
+   * the mixer, that takes over if the current item fails */
+  struct play_queue_item *spare;
+
+  /* finished items, kept around with their bins and mixer pads */
+  GQueue item_pool[ITEM_CHAIN_COUNT];
+
+  /* statistics */
+  guint items_created;
+  guint items_reused;
+  gint64 setup_time_total_us;
+  gint64 setup_time_max_us;
 };
 
 int player_init (struct player* self, struct scheduler* scheduler,
-    struct meta_handler *mh, const char *audiosink);
+    struct meta_handler *mh, struct transcoder *transcoder,
+    struct pcm_cache *pcm_cache, const char *audiosink);
 void player_cleanup (struct player* self);
 
 void player_loop (struct player* self);
 void player_loop_quit (struct player* self);
 
+/* for the control socket, one record per line */
+void player_dump (struct player* self, FILE * out);
+
 #endif /* __PLAYER_H__ */
@@ -19,6 +19,9 @@
  */
 
 #include "scheduler.h"
+#include "media_index.h"
+#include "tracepoints.h"
+#include "tracer.h"
 #include "utils.h"
 #include <stdlib.h>	/* For malloc/realloc/free */
 #include <string.h>	/* For strncmp() and strchr() */
@@ -111,6 +114,9 @@ pls_add_file(char* filepath, char ***files, int *num_files)
 	utils_dbg(PLS, "Added file: %s\n", (*files)[(*num_files)]);
 	(*num_files)++;
 
+	/* Let the analyzer know about it */
+	midx_register_file(file);
+
 cleanup:
 	if(ret < 0) {
 		pls_files_cleanup_internal(*files, (*num_files));
@@ -137,6 +143,7 @@ pls_shuffle(struct playlist* pls)
 {
 	unsigned int next_file_idx = 0;
 	int target_slot = 0;
+	uint64_t trace_start = tracer_begin();
 
 	/* Shuffle playlist using Durstenfeld's algorithm:
 	 * Pick a random number from the remaining ones,
@@ -145,8 +152,9 @@ pls_shuffle(struct playlist* pls)
 		next_file_idx = utils_get_random_uint() % target_slot;
 		pls_file_swap(pls->items, next_file_idx, target_slot);
 	}
+	tracer_end(trace_start, "playlist", "pls_shuffle", pls->filepath);
 
-	if(utils_is_debug_enabled(SHUF)) {
+	if(utils_log_enabled(DBG, SHUF)) {
 		utils_dbg(SHUF, "--== Shuffled list ==--\n");
 		int i = 0;
 		for(i = 0; i < pls->num_items; i++)
@@ -285,6 +293,8 @@ cleanup:
 int
 pls_reload_if_needed(struct playlist* pls)
 {
+	int ret = 0;
+	uint64_t trace_start = 0;
 	time_t mtime = utils_get_mtime(pls->filepath);
 	if(!mtime) {
 		utils_err(PLS, "Unable to check mtime for %s\n", pls->filepath);
@@ -298,6 +308,11 @@ pls_reload_if_needed(struct playlist* pls)
 	utils_info(PLS, "Got different mtime, reloading %s\n", pls->filepath);
 
 	/* Re-load playlist */
+	TRACE_RELOAD_START("playlist", pls->filepath);
+	trace_start = tracer_begin();
 	pls_files_cleanup(pls);
-	return pls_process(pls);
+	ret = pls_process(pls);
+	tracer_end(trace_start, "playlist", "pls_reload", pls->filepath);
+	TRACE_RELOAD_END("playlist", pls->filepath, ret);
+	return ret;
 }
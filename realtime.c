@@ -0,0 +1,368 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Realtime scheduling for the playback threads
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE	/* For pthread_setaffinity_np() / RUSAGE_THREAD */
+#include "realtime.h"
+#include "utils.h"
+#include <stdio.h>		/* For FILE handling / snprintf() */
+#include <stdlib.h>		/* For strtol() */
+#include <string.h>		/* For strncpy() / strrchr() / memcpy() */
+#include <errno.h>		/* For errno */
+#include <unistd.h>		/* For syscall() / sysconf() */
+#include <sched.h>		/* For SCHED_FIFO / cpu_set_t */
+#include <malloc.h>		/* For mallopt() */
+#include <pthread.h>		/* For pthread_setschedparam() etc */
+#include <sys/mman.h>		/* For mlockall() */
+#include <sys/resource.h>	/* For getrusage() / getrlimit() */
+#include <sys/syscall.h>	/* For SYS_gettid */
+
+/* Only the threads that feed the audio device (the mixer's
+ * and the sink's) run as SCHED_FIFO, pinned to the given
+ * cpus if any, decoders / scheduler / metadata handler stay
+ * where they are. With all memory locked and the stack
+ * faulted in beforehand, they shouldn't hit a page fault
+ * once they are running. */
+
+#define RT_MAX_THREADS		16
+#define RT_STACK_PREFAULT	(64 * 1024)
+
+/* On top of the caches, for decoders, GStreamer, buffers etc */
+#define RT_MEMLOCK_HEADROOM	(256ULL << 20)
+
+struct rt_thread {
+	pid_t	tid;
+	char	name[16];
+	/* Counters when the thread entered realtime mode */
+	long	minflt;
+	long	majflt;
+	long	nivcsw;
+};
+
+struct realtime {
+	int	enabled;
+	int	priority;
+	int	pinned;
+	cpu_set_t cpus;
+	struct	rt_thread threads[RT_MAX_THREADS];
+	pthread_mutex_t lock;
+};
+
+static struct realtime rt = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Slot of the calling thread in rt.threads */
+static __thread int rt_slot = -1;
+
+
+/*********\
+* HELPERS *
+\*********/
+
+static int
+rt_parse_cpu_list(const char* cpu_list, cpu_set_t *cpus)
+{
+	const char* str = cpu_list;
+	char* end_ptr = NULL;
+	long first = 0;
+	long last = 0;
+	long i = 0;
+
+	CPU_ZERO(cpus);
+
+	while(*str) {
+		first = strtol(str, &end_ptr, 10);
+		if(end_ptr == str)
+			goto malformed;
+		last = first;
+		str = end_ptr;
+
+		if(*str == '-') {
+			str++;
+			last = strtol(str, &end_ptr, 10);
+			if(end_ptr == str)
+				goto malformed;
+			str = end_ptr;
+		}
+
+		if(first < 0 || last < first || last >= CPU_SETSIZE)
+			goto malformed;
+		for(i = first; i <= last; i++)
+			CPU_SET(i, cpus);
+
+		if(*str == ',')
+			str++;
+		else if(*str)
+			goto malformed;
+	}
+
+	return CPU_COUNT(cpus) ? 0 : -1;
+
+malformed:
+	utils_err(RT, "Malformed cpu list: %s\n", cpu_list);
+	return -1;
+}
+
+/* Touch every page of the stack we might use, so that
+ * it's already there (and locked) when we need it */
+static void
+rt_prefault_stack(void)
+{
+	unsigned char stack[RT_STACK_PREFAULT];
+	volatile unsigned char *page = stack;
+	long page_size = sysconf(_SC_PAGESIZE);
+	int i = 0;
+
+	if(page_size <= 0)
+		page_size = 4096;
+
+	for(i = 0; i < RT_STACK_PREFAULT; i += page_size)
+		page[i] = 0;
+}
+
+static int
+rt_read_thread_counters(pid_t tid, long *minflt, long *majflt, long *nivcsw)
+{
+	char path[64] = {0};
+	char line[512] = {0};
+	char* stat = NULL;
+	FILE *file = NULL;
+	int ret = 0;
+
+	/* Fields 10 and 12 of stat, after the command name
+	 * (that may contain spaces, hence the strrchr) */
+	snprintf(path, sizeof(path), "/proc/self/task/%i/stat", tid);
+	file = fopen(path, "r");
+	if(!file)
+		return -1;
+	if(fgets(line, sizeof(line), file))
+		stat = strrchr(line, ')');
+	fclose(file);
+	if(!stat || sscanf(stat + 2, "%*c %*d %*d %*d %*d %*d %*u %ld %*d %ld",
+			   minflt, majflt) != 2)
+		return -1;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%i/status", tid);
+	file = fopen(path, "r");
+	if(!file)
+		return -1;
+	ret = -1;
+	while(fgets(line, sizeof(line), file) != NULL)
+		if(sscanf(line, "nonvoluntary_ctxt_switches: %ld", nivcsw) == 1) {
+			ret = 0;
+			break;
+		}
+	fclose(file);
+
+	return ret;
+}
+
+static void
+rt_log_thread(const struct rt_thread *thread, long minflt, long majflt,
+	      long nivcsw)
+{
+	utils_info(RT, "Thread %s (%i): %li minor / %li major page faults, "
+		   "%li involuntary context switches\n", thread->name,
+		   thread->tid, minflt - thread->minflt,
+		   majflt - thread->majflt, nivcsw - thread->nivcsw);
+}
+
+
+/**************\
+* ENTRY POINTS *
+\**************/
+
+int
+rt_init(int priority, const char* cpu_list, uint64_t cache_bytes)
+{
+	struct rlimit lim = {0};
+	int min_prio = sched_get_priority_min(SCHED_FIFO);
+	int max_prio = sched_get_priority_max(SCHED_FIFO);
+	int flags = MCL_CURRENT;
+
+	if(priority <= 0) {
+		utils_info(RT, "Realtime mode disabled\n");
+		return 0;
+	}
+
+	if(priority < min_prio || priority > max_prio) {
+		utils_wrn(RT, "Realtime priority %i out of range, clamping\n",
+			  priority);
+		priority = priority < min_prio ? min_prio : max_prio;
+	}
+
+	if(cpu_list) {
+		if(rt_parse_cpu_list(cpu_list, &rt.cpus) < 0)
+			return -1;
+		rt.pinned = 1;
+	}
+
+	/* Keep everything we have in RAM, and everything we'll get
+	 * if RLIMIT_MEMLOCK allows it. With MCL_FUTURE every
+	 * brk() / mmap() past the limit fails, and GLib aborts
+	 * when an allocation fails, so only ask for it if the
+	 * caches and then some fit in there. */
+	if(getrlimit(RLIMIT_MEMLOCK, &lim) < 0)
+		utils_pwrn(RT, "Couldn't get RLIMIT_MEMLOCK");
+	else if(lim.rlim_cur == RLIM_INFINITY ||
+		lim.rlim_cur >= cache_bytes + RT_MEMLOCK_HEADROOM)
+		flags |= MCL_FUTURE;
+	else
+		utils_info(RT, "RLIMIT_MEMLOCK is %lluMB, need %lluMB to "
+			   "lock future allocations, only locking current "
+			   "ones\n", (unsigned long long) lim.rlim_cur >> 20,
+			   (cache_bytes + RT_MEMLOCK_HEADROOM) >> 20);
+
+	if(mlockall(flags) < 0)
+		utils_pwrn(RT, "Couldn't lock memory");
+
+	/* Don't give freed memory back to the system, we'd
+	 * just fault it in again on the next allocation. Big
+	 * allocations (PCM cache entries etc) still go to mmap()
+	 * instead of fragmenting the heap. */
+	mallopt(M_TRIM_THRESHOLD, -1);
+
+	rt.priority = priority;
+	rt.enabled = 1;
+
+	utils_info(RT, "Realtime mode enabled, priority %i%s%s\n", priority,
+		   cpu_list ? ", cpus " : "", cpu_list ? cpu_list : "");
+	return 0;
+}
+
+void
+rt_cleanup(void)
+{
+	if(!rt.enabled)
+		return;
+
+	munlockall();
+	rt.enabled = 0;
+}
+
+int
+rt_is_enabled(void)
+{
+	return rt.enabled;
+}
+
+void
+rt_thread_enter(const char* name)
+{
+	struct sched_param param = {0};
+	struct rusage usage = {0};
+	struct rt_thread *thread = NULL;
+	int ret = 0;
+	int i = 0;
+
+	if(!rt.enabled)
+		return;
+
+	param.sched_priority = rt.priority;
+	ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if(ret != 0) {
+		errno = ret;
+		utils_pwrn(RT, "Couldn't switch %s to SCHED_FIFO", name);
+	}
+
+	if(rt.pinned) {
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+					     &rt.cpus);
+		if(ret != 0) {
+			errno = ret;
+			utils_pwrn(RT, "Couldn't pin %s", name);
+		}
+	}
+
+	rt_prefault_stack();
+	getrusage(RUSAGE_THREAD, &usage);
+
+	pthread_mutex_lock(&rt.lock);
+	for(i = 0; i < RT_MAX_THREADS; i++) {
+		if(rt.threads[i].tid)
+			continue;
+		thread = &rt.threads[i];
+		thread->tid = (pid_t) syscall(SYS_gettid);
+		strncpy(thread->name, name, sizeof(thread->name) - 1);
+		thread->minflt = usage.ru_minflt;
+		thread->majflt = usage.ru_majflt;
+		thread->nivcsw = usage.ru_nivcsw;
+		rt_slot = i;
+		break;
+	}
+	pthread_mutex_unlock(&rt.lock);
+
+	utils_dbg(RT, "Thread %s (%i) is now realtime\n", name,
+		  thread ? thread->tid : -1);
+}
+
+void
+rt_thread_leave(void)
+{
+	struct rusage usage = {0};
+	struct rt_thread thread = {0};
+
+	if(rt_slot < 0)
+		return;
+
+	getrusage(RUSAGE_THREAD, &usage);
+
+	pthread_mutex_lock(&rt.lock);
+	thread = rt.threads[rt_slot];
+	memset(&rt.threads[rt_slot], 0, sizeof(struct rt_thread));
+	rt_slot = -1;
+	pthread_mutex_unlock(&rt.lock);
+
+	rt_log_thread(&thread, usage.ru_minflt, usage.ru_majflt,
+		      usage.ru_nivcsw);
+}
+
+void
+rt_report(void)
+{
+	struct rt_thread threads[RT_MAX_THREADS];
+	struct rt_thread *thread = NULL;
+	long minflt = 0;
+	long majflt = 0;
+	long nivcsw = 0;
+	int i = 0;
+
+	if(!rt.enabled)
+		return;
+
+	/* The realtime threads take the lock too, only hold
+	 * it for the copy, not while going through /proc */
+	pthread_mutex_lock(&rt.lock);
+	memcpy(threads, rt.threads, sizeof(threads));
+	pthread_mutex_unlock(&rt.lock);
+
+	for(i = 0; i < RT_MAX_THREADS; i++) {
+		thread = &threads[i];
+		if(!thread->tid)
+			continue;
+		if(rt_read_thread_counters(thread->tid, &minflt, &majflt,
+					   &nivcsw) < 0) {
+			utils_dbg(RT, "Couldn't read counters of %s (%i)\n",
+				  thread->name, thread->tid);
+			continue;
+		}
+		rt_log_thread(thread, minflt, majflt, nivcsw);
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Realtime scheduling for the playback threads
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#include <stdint.h>	/* For typed ints */
+
+/* A priority of 0 leaves realtime mode disabled, cpu_list
+ * is something like "2,3" or "2-3", NULL for no pinning,
+ * cache_bytes is how much the in-memory caches may grow */
+int rt_init(int priority, const char* cpu_list, uint64_t cache_bytes);
+void rt_cleanup(void);
+int rt_is_enabled(void);
+
+/* Called from within the streaming threads of the mixer and
+ * the audio sink, when they start and right before they exit */
+void rt_thread_enter(const char* name);
+void rt_thread_leave(void);
+
+/* Logs page faults and involuntary context switches of
+ * the realtime threads that are still running */
+void rt_report(void);
+
+#endif /* __REALTIME_H__ */
@@ -19,8 +19,21 @@
  */
 
 #include "scheduler.h"
+#include "media_index.h"
+#include "stats.h"
+#include "tracepoints.h"
+#include "tracer.h"
 #include "utils.h"
 #include <stdlib.h>	/* For malloc */
+#include <string.h>	/* For strncpy() / memset() */
+
+static struct {
+	struct stats_hist get_next;
+	struct stats_hist cfg_reload;
+	struct stats_hist pls_reload;
+	struct stats_counter cfg_reload_failures;
+	struct stats_counter pls_reload_failures;
+} sched_stats;
 
 /*********\
 * HELPERS *
@@ -53,10 +66,16 @@ sched_get_next_item(struct playlist* pls)
 	int ret = 0;
 	int idx = 0;
 	char* next = NULL;
+	time_t last_mtime = pls->last_mtime;
+	uint64_t start = stats_get_usecs();
 
 	/* Re-load playlist if needed */
 	ret = pls_reload_if_needed(pls);
+	if(ret < 0 || pls->last_mtime != last_mtime)
+		stats_hist_add(&sched_stats.pls_reload,
+			       stats_get_usecs() - start);
 	if(ret < 0) {
+		stats_counter_add(&sched_stats.pls_reload_failures, 1);
 		utils_wrn(SCHED, "Re-loading playlist %s failed\n", pls->filepath);
 		return NULL;
 	}
@@ -79,11 +98,20 @@ sched_get_next_item(struct playlist* pls)
 	/* Check if next item is readable, if not
 	 * loop until we find a readable one. If we
 	 * don't find any readable file on the playlist
-	 * return NULL */
+	 * return NULL. Files that failed to decode
+	 * before are skipped as well. */
 	for(idx = pls->curr_idx; idx < pls->num_items; idx++) {
 		next = pls->items[idx];
+		if(midx_is_quarantined(next)) {
+			utils_dbg(SCHED, "File quarantined %s\n", next);
+			continue;
+		}
 		if(utils_is_readable_file(next)) {
 			pls->curr_idx = idx + 1;
+			/* Make sure the one after this gets
+			 * checked before we get to it */
+			if(pls->curr_idx < pls->num_items)
+				midx_expedite(pls->items[pls->curr_idx]);
 			return next;
 		}
 		utils_wrn(SCHED, "File unreadable %s\n", next);
@@ -92,6 +120,117 @@ sched_get_next_item(struct playlist* pls)
 	return NULL;
 }
 
+static struct zone*
+sched_get_zone(struct scheduler* sched, struct tm *tm)
+{
+	struct zone *zn = NULL;
+	struct day_schedule *ds = NULL;
+	struct week_schedule *ws = NULL;
+	int i = 0;
+	int ret = 0;
+	char datestr[26];
+
+	/* Get current day */
+	ws = sched->cfg->ws;
+	ds = ws->days[tm->tm_wday];
+
+	/* Find a zone with a start time less
+	 * than the current time. In order to
+	 * get the latest one and since the zones
+	 * are stored in ascending order, do
+	 * the lookup backwards */
+	for(i = ds->num_zones - 1; i >= 0; i--) {
+		zn = ds->zones[i];
+		ret = utils_compare_time(tm, &zn->start_time, 1);
+
+		if (utils_log_enabled (DBG, SCHED)) {
+			strftime (datestr, 26, "%H:%M:%S", &zn->start_time);
+			utils_dbg (SCHED, "considering zone '%s' at: %s -> %i\n",
+					zn->name, datestr, ret);
+		}
+		if(ret > 0)
+			break;
+	}
+
+	if(i < 0) {
+		utils_wrn(SCHED, "Nothing is scheduled for now ");
+		utils_wrn(SCHED|SKIP, "using first zone of the day\n");
+	}
+
+	return zn;
+}
+
+static const char*
+sched_source_name(int source)
+{
+	switch(source) {
+	case SCHED_SRC_INTERMEDIATE:
+		return "intermediate";
+	case SCHED_SRC_MAIN:
+		return "main";
+	case SCHED_SRC_FALLBACK:
+		return "fallback";
+	case SCHED_SRC_SPARE:
+		return "spare";
+	default:
+		return "none";
+	}
+}
+
+static void
+sched_record_decision(struct scheduler* sched, time_t sched_time,
+		      uint64_t start, int source, struct zone *zn,
+		      struct playlist *pls, const char* item)
+{
+	struct sched_decision *dec = NULL;
+	struct intermediate_playlist *ipls = NULL;
+
+	if(!sched->decisions)
+		return;
+
+	dec = &sched->decisions[sched->num_decisions % SCHED_DECISIONS];
+	sched->num_decisions++;
+
+	dec->sched_time = sched_time;
+	dec->took_usecs = stats_get_usecs() - start;
+	dec->source = source;
+	dec->curr_idx = pls ? pls->curr_idx : 0;
+	dec->num_items = pls ? pls->num_items : 0;
+
+	/* Copy everything, the config may get re-loaded
+	 * (and the strings freed) before anyone asks */
+	strncpy(dec->zone, zn->name ? zn->name : "", sizeof(dec->zone) - 1);
+	dec->zone[sizeof(dec->zone) - 1] = '\0';
+
+	if(source == SCHED_SRC_INTERMEDIATE) {
+		ipls = (struct intermediate_playlist*) pls;
+		strncpy(dec->playlist, ipls->name, sizeof(dec->playlist) - 1);
+	} else
+		strncpy(dec->playlist, pls && pls->filepath ? pls->filepath : "",
+			sizeof(dec->playlist) - 1);
+	dec->playlist[sizeof(dec->playlist) - 1] = '\0';
+
+	strncpy(dec->item, item ? item : "", sizeof(dec->item) - 1);
+	dec->item[sizeof(dec->item) - 1] = '\0';
+
+	TRACE_SCHED_DECISION(sched_time, source, dec->zone, dec->playlist,
+			     dec->item, dec->took_usecs);
+	tracer_end(start, "sched", source == SCHED_SRC_SPARE ?
+		   "sched_get_fallback" : "sched_get_next", dec->item);
+}
+
+static void
+sched_dump_playlist(FILE* out, struct zone *zn, const char* type,
+		    struct playlist *pls)
+{
+	if(!pls)
+		return;
+
+	fprintf(out, "playlist\tzone=%s\ttype=%s\tpath=%s\titems=%i\t"
+		"cursor=%i\tshuffle=%i\n", zn->name, type, pls->filepath,
+		pls->num_items, pls->curr_idx, pls->shuffle);
+}
+
 
 /**************\
 * ENTRY POINTS *
@@ -110,52 +249,38 @@ sched_get_next(struct scheduler* sched, time_t sched_time, char** next,
 	struct playlist *pls = NULL;
 	struct intermediate_playlist *ipls = NULL;
 	struct zone *zn = NULL;
-	struct day_schedule *ds = NULL;
-	struct week_schedule *ws = NULL;
 	int i = 0;
 	int ret = 0;
+	int source = SCHED_SRC_NONE;
 	struct tm tm = *localtime(&sched_time);
 	char datestr[26];
+	time_t last_mtime = 0;
+	uint64_t start = stats_get_usecs();
+	uint64_t reload_start = 0;
 
 	if (!sched)
 		return -1;
 
 	/* format: Day DD Mon YYYY, HH:MM:SS */
-	strftime (datestr, 26, "%a %d %b %Y, %H:%M:%S", &tm);
-	utils_info (SCHED, "Scheduling item for: %s\n", datestr);
+	if (utils_log_enabled (INFO, SCHED)) {
+		strftime (datestr, 26, "%a %d %b %Y, %H:%M:%S", &tm);
+		utils_info (SCHED, "Scheduling item for: %s\n", datestr);
+	}
 
 	/* Reload config if needed */
+	last_mtime = sched->cfg->last_mtime;
+	reload_start = stats_get_usecs();
 	ret = cfg_reload_if_needed(sched->cfg);
-	if(ret < 0)
+	if(ret < 0 || sched->cfg->last_mtime != last_mtime)
+		stats_hist_add(&sched_stats.cfg_reload,
+			       stats_get_usecs() - reload_start);
+	if(ret < 0) {
+		stats_counter_add(&sched_stats.cfg_reload_failures, 1);
 		utils_wrn(SCHED, "Re-loading config failed\n");
-
-	/* Get current day */
-	ws = sched->cfg->ws;
-	ds = ws->days[tm.tm_wday];
-
-	/* Find a zone with a start time less
-	 * than the current time. In order to
-	 * get the latest one and since the zones
-	 * are stored in ascending order, do
-	 * the lookup backwards */
-	for(i = ds->num_zones - 1; i >= 0; i--) {
-		zn = ds->zones[i];
-		ret = utils_compare_time(&tm, &zn->start_time, 1);
-
-		if (utils_is_debug_enabled (SCHED)) {
-			strftime (datestr, 26, "%H:%M:%S", &zn->start_time);
-			utils_dbg (SCHED, "considering zone '%s' at: %s -> %i\n",
-					zn->name, datestr, ret);
-		}
-		if(ret > 0)
-			break;
 	}
-	(*zone) = zn->name;
 
-	if(i < 0) {
-		utils_wrn(SCHED, "Nothing is scheduled for now ");
-		utils_wrn(SCHED|SKIP, "using first zone of the day\n");
-	}
+	zn = sched_get_zone(sched, &tm);
+	(*zone) = zn->name;
 
 	/* Is it time to load an item from an intermediate
 	 * playlist ? Note: We assume here that intermediate
@@ -220,6 +345,17 @@ sched_get_next(struct scheduler* sched, time_t sched_time, char** next,
 	}
 
 done:
+	stats_hist_add(&sched_stats.get_next, stats_get_usecs() - start);
+	if((*next) == NULL)
+		source = SCHED_SRC_NONE;
+	else if(pls == zn->main_pls)
+		source = SCHED_SRC_MAIN;
+	else if(pls == zn->fallback_pls)
+		source = SCHED_SRC_FALLBACK;
+	else
+		source = SCHED_SRC_INTERMEDIATE;
+	sched_record_decision(sched, sched_time, start, source, zn, pls, (*next));
+
 	if((*next) != NULL) {
 		utils_info(SCHED, "Got next item from zone '%s': %s (fader: %s)\n",
 			zn->name, (*next), (*fader) ? "true" : "false");
@@ -230,6 +366,60 @@ done:
 	return -1;
 }
 
+/* Used by the player to keep a spare item around, ready to
+ * take over if the current one fails. This doesn't reload
+ * the config, sched_get_next() takes care of that. */
+int
+sched_get_fallback(struct scheduler* sched, time_t sched_time, char** next,
+		   struct fader** fader, char** zone)
+{
+	struct playlist *pls = NULL;
+	struct zone *zn = NULL;
+	struct tm tm = *localtime(&sched_time);
+	uint64_t start = stats_get_usecs();
+
+	if (!sched)
+		return -1;
+
+	zn = sched_get_zone(sched, &tm);
+	(*zone) = zn->name;
+
+	pls = zn->fallback_pls;
+	if(!pls)
+		return -1;
+
+	(*next) = sched_get_next_item(pls);
+	sched_record_decision(sched, sched_time, start, (*next) ?
+			      SCHED_SRC_SPARE : SCHED_SRC_NONE, zn, pls, (*next));
+	if((*next) == NULL)
+		return -1;
+
+	(*fader) = pls->fader;
+
+	utils_dbg(SCHED, "Got spare item from zone '%s': %s\n",
+		  zn->name, (*next));
+	return 0;
+}
+
+/* The fallback playlist sched_get_fallback() would pick from,
+ * so that the player can tell when its spare is out of date.
+ * Only valid until the next config reload. */
+const char*
+sched_get_fallback_playlist(struct scheduler* sched, time_t sched_time)
+{
+	struct zone *zn = NULL;
+	struct tm tm = *localtime(&sched_time);
+
+	if (!sched)
+		return NULL;
+
+	zn = sched_get_zone(sched, &tm);
+	if(!zn || !zn->fallback_pls)
+		return NULL;
+
+	return zn->fallback_pls->filepath;
+}
+
 int
 sched_init(struct scheduler* sched, char* config_filepath)
 {
@@ -242,11 +432,32 @@ sched_init(struct scheduler* sched, char* config_filepath)
 		return -1;
 	}
 
+	memset(cfg, 0, sizeof(struct config));
 	cfg->filepath = config_filepath;
 
+	sched->decisions = calloc(SCHED_DECISIONS, sizeof(struct sched_decision));
+	if(!sched->decisions)
+		utils_wrn(SCHED, "Could not allocate decision log\n");
+	sched->num_decisions = 0;
+
+	stats_hist_register(&sched_stats.get_next, "sched_get_next",
+			    "Time to pick the next item", "us");
+	stats_hist_register(&sched_stats.cfg_reload, "config_reload",
+			    "Time to re-load the config", "us");
+	stats_hist_register(&sched_stats.pls_reload, "playlist_reload",
+			    "Time to re-load a playlist", "us");
+	stats_counter_register(&sched_stats.cfg_reload_failures,
+			       "config_reload_failures",
+			       "Config re-loads that failed");
+	stats_counter_register(&sched_stats.pls_reload_failures,
+			       "playlist_reload_failures",
+			       "Playlist re-loads that failed");
+
 	ret = cfg_process(cfg);
-	if (ret < 0)
+	if (ret < 0) {
+		cfg_cleanup(cfg);
 		return -1;
+	}
 
 	sched->cfg = cfg;
 	return 0;
@@ -258,4 +469,81 @@ sched_cleanup(struct scheduler* sched)
 	if(sched->cfg!=NULL)
 		cfg_cleanup(sched->cfg);
 	sched->cfg=NULL;
+	free(sched->decisions);
+	sched->decisions = NULL;
+}
+
+void
+sched_dump_playlists(struct scheduler* sched, time_t sched_time, FILE* out)
+{
+	struct tm tm = *localtime(&sched_time);
+	struct day_schedule *ds = NULL;
+	struct intermediate_playlist *ipls = NULL;
+	struct zone *curr = NULL;
+	struct zone *zn = NULL;
+	char datestr[26];
+	int i = 0;
+	int j = 0;
+
+	if(!sched || !sched->cfg)
+		return;
+
+	curr = sched_get_zone(sched, &tm);
+	ds = sched->cfg->ws->days[tm.tm_wday];
+
+	/* Only today's zones, that's where the cursors move */
+	for(i = 0; i < ds->num_zones; i++) {
+		zn = ds->zones[i];
+		strftime(datestr, 26, "%H:%M:%S", &zn->start_time);
+		fprintf(out, "zone\tname=%s\tstart=%s\tactive=%i\n",
+			zn->name, datestr, zn == curr);
+
+		sched_dump_playlist(out, zn, "main", zn->main_pls);
+		sched_dump_playlist(out, zn, "fallback", zn->fallback_pls);
+
+		for(j = 0; j < zn->num_others && zn->others; j++) {
+			ipls = zn->others[j];
+			sched_dump_playlist(out, zn, "intermediate",
+					    (struct playlist*) ipls);
+			if(ipls->last_scheduled)
+				strftime(datestr, 26, "%H:%M:%S",
+					 localtime(&ipls->last_scheduled));
+			else
+				strncpy(datestr, "never", sizeof(datestr));
+			fprintf(out, "intermediate\tzone=%s\tname=%s\t"
+				"interval_mins=%i\tlast_scheduled=%s\t"
+				"items_per_slot=%i\tpending=%i\n", zn->name,
+				ipls->name, ipls->sched_interval_mins, datestr,
+				ipls->num_sched_items,
+				ipls->sched_items_pending);
+		}
+	}
+}
+
+void
+sched_dump_decisions(struct scheduler* sched, FILE* out)
+{
+	struct sched_decision *dec = NULL;
+	unsigned int first = 0;
+	unsigned int i = 0;
+	char datestr[26];
+
+	if(!sched || !sched->decisions)
+		return;
+
+	if(sched->num_decisions > SCHED_DECISIONS)
+		first = sched->num_decisions - SCHED_DECISIONS;
+
+	/* Oldest first */
+	for(i = first; i < sched->num_decisions; i++) {
+		dec = &sched->decisions[i % SCHED_DECISIONS];
+		strftime(datestr, 26, "%a %d %b %Y, %H:%M:%S",
+			 localtime(&dec->sched_time));
+		fprintf(out, "decision\tseq=%u\ttime=%s\ttook_us=%llu\t"
+			"zone=%s\tsource=%s\tplaylist=%s\tcursor=%i/%i\t"
+			"item=%s\n", i, datestr,
+			(unsigned long long) dec->took_usecs, dec->zone,
+			sched_source_name(dec->source), dec->playlist,
+			dec->curr_idx, dec->num_items, dec->item);
+	}
 }
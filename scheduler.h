@@ -22,12 +22,17 @@
 #define __SCHEDULER_H__
 
 #include <time.h> /* For time_t */
+#include <stdint.h> /* For typed ints */
+#include <stdio.h> /* For FILE */
+#include <linux/limits.h> /* For PATH_MAX */
 
 struct fader {
-	int	fadein_duration_secs;
-	int	fadeout_duration_secs;
+	int	fadein_duration_ms;
+	int	fadeout_duration_ms;
 	float	min_lvl;
 	float	max_lvl;
+	int	gapless;
+	int	overlap_ms;	/* -1: follow the fade out */
 };
 
 struct playlist {
@@ -84,9 +89,37 @@ struct config {
 	struct week_schedule *ws;
 };
 
+/* What sched_get_next() / sched_get_fallback() picked and
+ * where it came from, the last SCHED_DECISIONS of them are
+ * kept around for the control socket (see control.c) */
+#define SCHED_DECISIONS	32
+
+enum sched_source {
+	SCHED_SRC_NONE = 0,
+	SCHED_SRC_INTERMEDIATE,
+	SCHED_SRC_MAIN,
+	SCHED_SRC_FALLBACK,
+	SCHED_SRC_SPARE,
+};
+
+struct sched_decision {
+	time_t	sched_time;
+	uint64_t took_usecs;
+	int	source;
+	/* Playlist cursor after the pick */
+	int	curr_idx;
+	int	num_items;
+	char	zone[64];
+	char	playlist[PATH_MAX];
+	char	item[PATH_MAX];
+};
+
 struct scheduler {
 	struct config *cfg;
 	int state_flags;
+	/* Ring buffer, num_decisions keeps counting */
+	struct sched_decision *decisions;
+	unsigned int num_decisions;
 };
 
 enum state_flags {
@@ -108,7 +141,13 @@ int cfg_reload_if_needed(struct config *cfg);
 
 /* Scheduler entry points */
 int sched_get_next(struct scheduler* sched, time_t sched_time, char** next, struct fader** fader, char ** zone);
+int sched_get_fallback(struct scheduler* sched, time_t sched_time, char** next, struct fader** fader, char ** zone);
+const char* sched_get_fallback_playlist(struct scheduler* sched, time_t sched_time);
 int sched_init(struct scheduler* sched, char* config_filepath);
 void sched_cleanup(struct scheduler* sched);
 
+/* For the control socket, one record per line */
+void sched_dump_playlists(struct scheduler* sched, time_t sched_time, FILE* out);
+void sched_dump_decisions(struct scheduler* sched, FILE* out);
+
 #endif /* __SCHEDULER_H__ */
@@ -0,0 +1,183 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Leading / trailing silence detector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "silence.h"
+#include "utils.h"
+#include <stdlib.h>	/* For calloc/free */
+#include <string.h>	/* For memcpy() */
+#include <math.h>	/* For pow() */
+
+/* Unlike the loudness meter there is no state carried between
+ * samples here, so we vectorize along time instead, regardless
+ * of the channel layout. With GCC's vector extensions this
+ * becomes AVX (if enabled) or a pair of SSE / NEON registers. */
+typedef float v8sf __attribute__ ((vector_size (8 * sizeof(float))));
+
+/* RMS is measured over 10ms windows */
+#define WINDOWS_PER_SEC	100
+
+struct silence_detector {
+	int	channels;
+	size_t	window_frames;
+	/* Thresholds as mean square values */
+	double	lead_threshold;
+	double	trail_threshold;
+	/* Current window */
+	size_t	window_pos;
+	double	window_acc;
+	/* Results, in windows */
+	int64_t	num_windows;
+	int64_t	first_loud;
+	int64_t	last_loud;
+	uint64_t total_frames;
+};
+
+
+/*********\
+* HELPERS *
+\*********/
+
+static double
+silence_sum_squares(const float *samples, size_t num_samples)
+{
+	v8sf acc = {0};
+	v8sf vec;
+	double sum = 0.0;
+	size_t i = 0;
+	int lane = 0;
+
+	/* memcpy lets the compiler emit unaligned vector loads */
+	for(i = 0; i + 8 <= num_samples; i += 8) {
+		memcpy(&vec, samples + i, sizeof(v8sf));
+		acc += vec * vec;
+	}
+
+	for(lane = 0; lane < 8; lane++)
+		sum += acc[lane];
+
+	for(; i < num_samples; i++)
+		sum += samples[i] * samples[i];
+
+	return sum;
+}
+
+static void
+silence_end_window(struct silence_detector *sd)
+{
+	double mean_square = sd->window_acc /
+			     (double) (sd->window_pos * sd->channels);
+
+	if(sd->first_loud < 0 && mean_square > sd->lead_threshold)
+		sd->first_loud = sd->num_windows;
+
+	if(mean_square > sd->trail_threshold)
+		sd->last_loud = sd->num_windows;
+
+	sd->num_windows++;
+	sd->window_acc = 0.0;
+	sd->window_pos = 0;
+}
+
+
+/**************\
+* ENTRY POINTS *
+\**************/
+
+struct silence_detector*
+silence_detector_new(int rate, int channels, float lead_threshold_db,
+		     float trail_threshold_db)
+{
+	struct silence_detector *sd = NULL;
+
+	if(rate < WINDOWS_PER_SEC || channels <= 0) {
+		utils_err(ANL, "Unsupported format: %i channels @ %iHz\n",
+			  channels, rate);
+		return NULL;
+	}
+
+	sd = calloc(1, sizeof(struct silence_detector));
+	if(!sd) {
+		utils_err(ANL, "Could not allocate silence detector\n");
+		return NULL;
+	}
+
+	sd->channels = channels;
+	sd->window_frames = rate / WINDOWS_PER_SEC;
+	sd->lead_threshold = pow(10.0, lead_threshold_db / 10.0);
+	sd->trail_threshold = pow(10.0, trail_threshold_db / 10.0);
+	sd->first_loud = -1;
+	sd->last_loud = -1;
+
+	return sd;
+}
+
+void
+silence_detector_free(struct silence_detector *sd)
+{
+	free(sd);
+}
+
+void
+silence_detector_process(struct silence_detector *sd, const float *frames,
+			 size_t num_frames)
+{
+	size_t len = 0;
+
+	while(num_frames > 0) {
+		len = sd->window_frames - sd->window_pos;
+		if(len > num_frames)
+			len = num_frames;
+
+		sd->window_acc += silence_sum_squares(frames, len * sd->channels);
+		sd->window_pos += len;
+		sd->total_frames += len;
+
+		frames += len * sd->channels;
+		num_frames -= len;
+
+		if(sd->window_pos == sd->window_frames)
+			silence_end_window(sd);
+	}
+}
+
+/* Note: This flushes any partial window, call it once at the end */
+void
+silence_detector_get_cue_points(struct silence_detector *sd,
+				uint64_t *cue_in, uint64_t *cue_out,
+				uint64_t *total)
+{
+	if(sd->window_pos > 0)
+		silence_end_window(sd);
+
+	(*total) = sd->total_frames;
+
+	/* Nothing above the thresholds, don't trim anything,
+	 * it's probably meant to be quiet */
+	if(sd->first_loud < 0 || sd->last_loud < sd->first_loud) {
+		(*cue_in) = 0;
+		(*cue_out) = sd->total_frames;
+		return;
+	}
+
+	(*cue_in) = sd->first_loud * sd->window_frames;
+	(*cue_out) = (sd->last_loud + 1) * sd->window_frames;
+	if((*cue_out) > sd->total_frames)
+		(*cue_out) = sd->total_frames;
+}
@@ -0,0 +1,43 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Leading / trailing silence detector
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SILENCE_H__
+#define __SILENCE_H__
+
+#include <stddef.h>	/* For size_t */
+#include <stdint.h>	/* For uint64_t */
+
+struct silence_detector;
+
+struct silence_detector* silence_detector_new(int rate, int channels,
+					      float lead_threshold_db,
+					      float trail_threshold_db);
+void silence_detector_free(struct silence_detector *sd);
+
+/* Input is interleaved 32bit float samples */
+void silence_detector_process(struct silence_detector *sd, const float *frames,
+			      size_t num_frames);
+
+/* Results in frames, since the beginning of the stream */
+void silence_detector_get_cue_points(struct silence_detector *sd,
+				     uint64_t *cue_in, uint64_t *cue_out,
+				     uint64_t *total);
+
+#endif /* __SILENCE_H__ */
@@ -0,0 +1,377 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Runtime statistics
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "utils.h"
+#include <stdio.h>		/* For snprintf() */
+#include <stdarg.h>		/* For va_list handling */
+#include <string.h>		/* For memset() / strcmp() */
+#include <pthread.h>		/* For pthread_mutex_* */
+
+/* Histograms keep two windows, new values go to the current one
+ * and when it expires the older one gets cleared and takes its
+ * place, so that what we report covers the last 10 - 20 minutes
+ * instead of everything since startup. Updates only use atomics,
+ * so they can be done from the streaming threads, readers may see
+ * a window being cleared but that's fine for statistics. Metrics
+ * in exposition format come from the totals instead. */
+
+static struct stats_hist *hist_list = NULL;
+static struct stats_counter *counter_list = NULL;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t start_usecs = 0;
+static int next_shard = 0;
+
+__thread int stats_thread_shard = -1;
+
+
+/*********\
+* HELPERS *
+\*********/
+
+static time_t
+stats_get_monotonic_secs(void)
+{
+	struct timespec ts = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/* Appends to buf at *off, fails if it doesn't fit */
+static int
+stats_append(char* buf, size_t len, size_t *off, const char* fmt, ...)
+{
+	va_list args;
+	int ret = 0;
+
+	if(*off >= len)
+		return -1;
+
+	va_start(args, fmt);
+	ret = vsnprintf(buf + *off, len - *off, fmt, args);
+	va_end(args);
+
+	if(ret < 0 || (size_t) ret >= len - *off)
+		return -1;
+
+	*off += ret;
+	return 0;
+}
+
+static int
+stats_get_bucket(uint64_t value)
+{
+	int bucket = 0;
+
+	if(!value)
+		return 0;
+
+	bucket = 64 - __builtin_clzll(value);
+	if(bucket >= STATS_HIST_BUCKETS)
+		bucket = STATS_HIST_BUCKETS - 1;
+
+	return bucket;
+}
+
+static void
+stats_window_add(struct stats_window *win, uint64_t value)
+{
+	uint64_t max = 0;
+
+	__atomic_add_fetch(&win->buckets[stats_get_bucket(value)], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&win->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&win->sum, value, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&win->max, __ATOMIC_RELAXED);
+	while(value > max &&
+	      !__atomic_compare_exchange_n(&win->max, &max, value, 1,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Merges win into out */
+static void
+stats_window_merge(struct stats_window *out, struct stats_window *win)
+{
+	uint64_t max = 0;
+	int i = 0;
+
+	for(i = 0; i < STATS_HIST_BUCKETS; i++)
+		out->buckets[i] += __atomic_load_n(&win->buckets[i],
+						   __ATOMIC_RELAXED);
+	out->count += __atomic_load_n(&win->count, __ATOMIC_RELAXED);
+	out->sum += __atomic_load_n(&win->sum, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&win->max, __ATOMIC_RELAXED);
+	if(max > out->max)
+		out->max = max;
+}
+
+static void
+stats_hist_rotate(struct stats_hist *hist, time_t now)
+{
+	time_t start = __atomic_load_n(&hist->window_start, __ATOMIC_RELAXED);
+	int next = 0;
+
+	if(now - start < STATS_WINDOW_SECS)
+		return;
+
+	/* Only one of the callers gets to rotate */
+	if(!__atomic_compare_exchange_n(&hist->window_start, &start, now, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return;
+
+	next = !__atomic_load_n(&hist->current, __ATOMIC_ACQUIRE);
+	memset(&hist->windows[next], 0, sizeof(struct stats_window));
+	__atomic_store_n(&hist->current, next, __ATOMIC_RELEASE);
+}
+
+/* Buckets are cumulative in exposition format */
+static int
+stats_render_hist(struct stats_hist *hist, char* buf, size_t len, size_t *off)
+{
+	struct stats_window win = {0};
+	const char* unit = hist->unit;
+	double scale = 1.0;
+	uint64_t cumulative = 0;
+	int ret = 0;
+	int i = 0;
+
+	/* Prometheus wants base units */
+	if(!strcmp(unit, "us")) {
+		unit = "seconds";
+		scale = 1e-6;
+	}
+
+	stats_window_merge(&win, &hist->total);
+
+	ret = stats_append(buf, len, off, "# HELP audio_scheduler_%s_%s %s\n"
+			   "# TYPE audio_scheduler_%s_%s histogram\n",
+			   hist->name, unit, hist->help, hist->name, unit);
+	for(i = 0; i < STATS_HIST_BUCKETS - 1 && !ret; i++) {
+		cumulative += win.buckets[i];
+		ret = stats_append(buf, len, off,
+				   "audio_scheduler_%s_%s_bucket{le=\"%g\"} %llu\n",
+				   hist->name, unit,
+				   (double) (i ? (1ULL << i) - 1 : 0) * scale,
+				   (unsigned long long) cumulative);
+	}
+	if(ret < 0)
+		return -1;
+
+	return stats_append(buf, len, off,
+			    "audio_scheduler_%s_%s_bucket{le=\"+Inf\"} %llu\n"
+			    "audio_scheduler_%s_%s_sum %g\n"
+			    "audio_scheduler_%s_%s_count %llu\n",
+			    hist->name, unit, (unsigned long long) win.count,
+			    hist->name, unit, (double) win.sum * scale,
+			    hist->name, unit, (unsigned long long) win.count);
+}
+
+
+/**************\
+* ENTRY POINTS *
+\**************/
+
+void
+stats_init(void)
+{
+	start_usecs = stats_get_usecs();
+}
+
+uint64_t
+stats_get_usecs(void)
+{
+	struct timespec ts = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int
+stats_assign_shard(void)
+{
+	stats_thread_shard = __atomic_fetch_add(&next_shard, 1,
+						__ATOMIC_RELAXED) % STATS_SHARDS;
+	return stats_thread_shard;
+}
+
+void
+stats_hist_register(struct stats_hist *hist, const char* name,
+		    const char* help, const char* unit)
+{
+	memset(hist, 0, sizeof(struct stats_hist));
+	hist->name = name;
+	hist->help = help;
+	hist->unit = unit;
+	hist->window_start = stats_get_monotonic_secs();
+
+	pthread_mutex_lock(&stats_lock);
+	hist->next = hist_list;
+	hist_list = hist;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void
+stats_counter_register(struct stats_counter *counter, const char* name,
+		       const char* help)
+{
+	memset(counter, 0, sizeof(struct stats_counter));
+	counter->name = name;
+	counter->help = help;
+
+	pthread_mutex_lock(&stats_lock);
+	counter->next = counter_list;
+	counter_list = counter;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+uint64_t
+stats_counter_get(struct stats_counter *counter)
+{
+	uint64_t value = 0;
+	int i = 0;
+
+	for(i = 0; i < STATS_SHARDS; i++)
+		value += __atomic_load_n(&counter->shards[i].value,
+					 __ATOMIC_RELAXED);
+	return value;
+}
+
+void
+stats_hist_add(struct stats_hist *hist, uint64_t value)
+{
+	stats_hist_rotate(hist, stats_get_monotonic_secs());
+
+	stats_window_add(&hist->windows[__atomic_load_n(&hist->current,
+							__ATOMIC_ACQUIRE)],
+			 value);
+	stats_window_add(&hist->total, value);
+}
+
+void
+stats_hist_get(struct stats_hist *hist, struct stats_window *out)
+{
+	memset(out, 0, sizeof(struct stats_window));
+
+	/* Don't report a window that should have been rotated
+	 * out, if nothing got added for a while */
+	stats_hist_rotate(hist, stats_get_monotonic_secs());
+
+	stats_window_merge(out, &hist->windows[0]);
+	stats_window_merge(out, &hist->windows[1]);
+}
+
+uint64_t
+stats_window_percentile(const struct stats_window *win, int pct)
+{
+	uint64_t target = 0;
+	uint64_t seen = 0;
+	uint64_t bound = 0;
+	int i = 0;
+
+	if(!win->count)
+		return 0;
+
+	target = (win->count * pct + 99) / 100;
+	for(i = 0; i < STATS_HIST_BUCKETS; i++) {
+		seen += win->buckets[i];
+		if(seen >= target)
+			break;
+	}
+
+	if(i >= STATS_HIST_BUCKETS - 1)
+		return win->max;
+
+	bound = i ? (1ULL << i) - 1 : 0;
+	return bound < win->max ? bound : win->max;
+}
+
+void
+stats_report(void)
+{
+	struct stats_hist *hist = NULL;
+	struct stats_counter *counter = NULL;
+	struct stats_window win = {0};
+
+	pthread_mutex_lock(&stats_lock);
+
+	for(hist = hist_list; hist; hist = hist->next) {
+		stats_hist_get(hist, &win);
+		if(!win.count) {
+			utils_info(STATS, "%s: no samples\n", hist->name);
+			continue;
+		}
+		utils_info(STATS, "%s: %llu samples, avg %llu, p50 %llu, "
+			   "p90 %llu, p99 %llu, max %llu %s\n", hist->name,
+			   (unsigned long long) win.count,
+			   (unsigned long long) (win.sum / win.count),
+			   (unsigned long long) stats_window_percentile(&win, 50),
+			   (unsigned long long) stats_window_percentile(&win, 90),
+			   (unsigned long long) stats_window_percentile(&win, 99),
+			   (unsigned long long) win.max, hist->unit);
+	}
+
+	for(counter = counter_list; counter; counter = counter->next)
+		utils_info(STATS, "%s: %llu\n", counter->name,
+			   (unsigned long long) stats_counter_get(counter));
+
+	pthread_mutex_unlock(&stats_lock);
+}
+
+int
+stats_render(char* buf, size_t len)
+{
+	struct stats_hist *hist = NULL;
+	struct stats_counter *counter = NULL;
+	size_t off = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&stats_lock);
+
+	ret = stats_append(buf, len, &off,
+			   "# HELP audio_scheduler_uptime_seconds "
+			   "Time since startup\n"
+			   "# TYPE audio_scheduler_uptime_seconds gauge\n"
+			   "audio_scheduler_uptime_seconds %llu\n",
+			   (unsigned long long) ((stats_get_usecs() -
+						  start_usecs) / 1000000));
+
+	for(counter = counter_list; counter && !ret; counter = counter->next)
+		ret = stats_append(buf, len, &off,
+				   "# HELP audio_scheduler_%s_total %s\n"
+				   "# TYPE audio_scheduler_%s_total counter\n"
+				   "audio_scheduler_%s_total %llu\n",
+				   counter->name, counter->help, counter->name,
+				   counter->name, (unsigned long long)
+				   stats_counter_get(counter));
+
+	for(hist = hist_list; hist && !ret; hist = hist->next)
+		ret = stats_render_hist(hist, buf, len, &off);
+
+	pthread_mutex_unlock(&stats_lock);
+
+	if(ret < 0) {
+		utils_wrn(STATS, "Metrics didn't fit in %zu bytes\n", len);
+		return -1;
+	}
+
+	return (int) off;
+}
@@ -0,0 +1,120 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Runtime statistics
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>		/* For typed ints */
+#include <stddef.h>		/* For size_t */
+#include <time.h>		/* For time_t */
+
+/* Bucket i holds values in [2^(i-1), 2^i), bucket 0 holds
+ * zeroes and the last one everything that doesn't fit */
+#define STATS_HIST_BUCKETS	32
+
+/* A histogram covers the last one to two windows */
+#define STATS_WINDOW_SECS	600
+
+/* Counters are split in per-thread shards, each on its own cache
+ * line, so that threads updating the same counter don't fight over
+ * it. Threads get a shard the first time they update a counter. */
+#define STATS_SHARDS		16
+#define STATS_CACHELINE		64
+
+/* Enough for everything we register in exposition format */
+#define STATS_RENDER_LEN	(128 * 1024)
+
+struct stats_window {
+	uint64_t buckets[STATS_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct stats_hist {
+	const char* name;
+	const char* help;
+	const char* unit;
+	time_t window_start;
+	int current;
+	struct stats_window windows[2];
+	/* Everything since startup, for stats_render(), since
+	 * scrapers expect histograms to only ever go up */
+	struct stats_window total;
+	struct stats_hist *next;
+};
+
+struct stats_shard {
+	uint64_t value;
+} __attribute__((aligned(STATS_CACHELINE)));
+
+struct stats_counter {
+	struct stats_shard shards[STATS_SHARDS];
+	const char* name;
+	const char* help;
+	struct stats_counter *next;
+};
+
+extern __thread int stats_thread_shard;
+int stats_assign_shard(void);
+
+/* Names are in snake case, they show up as audio_scheduler_<name>
+ * in stats_render(), with the unit ("us" becomes seconds) appended
+ * for histograms and _total for counters. Registered histograms /
+ * counters must stay around until the program exits. */
+void stats_init(void);
+void stats_hist_register(struct stats_hist *hist, const char* name,
+			 const char* help, const char* unit);
+void stats_counter_register(struct stats_counter *counter, const char* name,
+			    const char* help);
+
+/* These are lock-free and safe to call from streaming threads */
+void stats_hist_add(struct stats_hist *hist, uint64_t value);
+
+static inline void
+stats_counter_add(struct stats_counter *counter, uint64_t value)
+{
+	int shard = stats_thread_shard;
+
+	if(shard < 0)
+		shard = stats_assign_shard();
+
+	__atomic_add_fetch(&counter->shards[shard].value, value,
+			   __ATOMIC_RELAXED);
+}
+
+uint64_t stats_counter_get(struct stats_counter *counter);
+
+/* Monotonic time in usecs, for timing things */
+uint64_t stats_get_usecs(void);
+
+/* Both windows of hist merged into out */
+void stats_hist_get(struct stats_hist *hist, struct stats_window *out);
+/* Upper bound of the bucket where the pct percentile falls */
+uint64_t stats_window_percentile(const struct stats_window *win, int pct);
+
+/* Logs everything registered */
+void stats_report(void);
+
+/* Everything registered in Prometheus text exposition format,
+ * returns the length or -1 if it didn't fit in len */
+int stats_render(char* buf, size_t len);
+
+#endif /* __STATS_H__ */
@@ -0,0 +1,77 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Static tracepoints
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRACEPOINTS_H__
+#define __TRACEPOINTS_H__
+
+#include "config.h"
+
+/* USDT probes, as in systemtap / DTrace. Each one is a nop in the
+ * code plus a note in the binary saying where it is and where to
+ * find its arguments, a tracer that attaches to it swaps the nop
+ * for a breakpoint. So they are always there, on release builds
+ * too, e.g.:
+ *
+ * bpftrace -l 'usdt:/usr/bin/audio_scheduler:*'
+ * bpftrace -e 'usdt:/usr/bin/audio_scheduler:audio_scheduler:sched_decision
+ *	{ printf("%s %s\n", str(arg2), str(arg4)); }'
+ * perf buildid-cache --add /usr/bin/audio_scheduler && perf list sdt*
+ *
+ * The arguments still get evaluated, so only pass things that are
+ * already at hand (no formatting, no lookups). Floating point ones
+ * are passed as integers (x1000), tracers don't handle them well.
+ * Without <sys/sdt.h> at build time they all compile to nothing. */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define AS_TRACE(name, ...)	STAP_PROBEV(audio_scheduler, name, ##__VA_ARGS__)
+#else
+#define AS_TRACE(name, ...)	do {} while(0)
+#endif
+
+/* Scheduler picked an item (or none), source is enum sched_source */
+#define TRACE_SCHED_DECISION(sched_time, source, zone, playlist, item, \
+			     took_usecs) \
+	AS_TRACE(sched_decision, (long long) (sched_time), (int) (source), \
+		 (zone), (playlist), (item), \
+		 (unsigned long long) (took_usecs))
+
+/* A play queue item is set up and linked to the mixer */
+#define TRACE_ITEM_CREATED(item, file, zone, spare, setup_usecs) \
+	AS_TRACE(item_created, (item), (file), (zone), (int) (spare), \
+		 (long long) (setup_usecs))
+
+/* A play queue item is done, recycled means it went back to the pool */
+#define TRACE_ITEM_FREED(item, file, recycled) \
+	AS_TRACE(item_freed, (item), (file), (int) (recycled))
+
+/* A fade got scheduled on an item, times in ns, levels x1000 */
+#define TRACE_FADE_SET(item, start, start_level, end, end_level) \
+	AS_TRACE(fade_set, (item), (unsigned long long) (start), \
+		 (int) ((start_level) * 1000), (unsigned long long) (end), \
+		 (int) ((end_level) * 1000))
+
+/* Config / playlist file reload, what is "config" or "playlist" */
+#define TRACE_RELOAD_START(what, filepath) \
+	AS_TRACE(reload_start, (what), (filepath))
+#define TRACE_RELOAD_END(what, filepath, ret) \
+	AS_TRACE(reload_end, (what), (filepath), (int) (ret))
+
+#endif /* __TRACEPOINTS_H__ */
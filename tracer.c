@@ -0,0 +1,284 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Event tracer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tracer.h"
+#include "json_writer.h"
+#include "utils.h"
+#include <stdlib.h>		/* For calloc() / free() */
+#include <string.h>		/* For strlen() / memcpy() */
+#include <errno.h>		/* For errno */
+#include <unistd.h>		/* For getpid() / syscall() */
+#include <sys/syscall.h>	/* For SYS_gettid */
+#include <linux/limits.h>	/* For PATH_MAX */
+
+int tracer_enabled = 0;
+
+static struct {
+	struct	tracer_event *ring;
+	uint32_t size;
+	/* Next position to fill */
+	uint64_t head __attribute__((aligned(64)));
+	struct	stats_counter events;
+	struct	stats_counter dumps;
+} tracer;
+
+static __thread uint32_t tracer_tid = 0;
+
+/*********\
+* HELPERS *
+\*********/
+
+static uint32_t
+tracer_get_tid(void)
+{
+	if(!tracer_tid)
+		tracer_tid = (uint32_t) syscall(SYS_gettid);
+	return tracer_tid;
+}
+
+/* Keeps the tail of long arguments, that's where
+ * the file name is on paths */
+static void
+tracer_copy_arg(char* dst, const char* arg)
+{
+	size_t len = 0;
+
+	if(!arg) {
+		dst[0] = '\0';
+		return;
+	}
+
+	len = strlen(arg);
+	if(len < TRACER_ARG_LEN) {
+		memcpy(dst, arg, len + 1);
+		return;
+	}
+
+	memcpy(dst, arg + len - (TRACER_ARG_LEN - 1), TRACER_ARG_LEN);
+	memcpy(dst, "...", 3);
+}
+
+/* Copies out the event at pos, returns 0 if it got
+ * overwritten (or is still being written) */
+static int
+tracer_read_event(uint64_t pos, struct tracer_event *out)
+{
+	struct tracer_event *ev = &tracer.ring[pos & (tracer.size - 1)];
+	uint64_t seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+
+	if(seq != 2 * pos + 2)
+		return 0;
+
+	memcpy(out, ev, sizeof(struct tracer_event));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&ev->seq, __ATOMIC_RELAXED) == seq;
+}
+
+static void
+tracer_write_event(struct json_writer *jw, struct tracer_event *ev, int pid)
+{
+	char phase[2] = {ev->phase, '\0'};
+
+	json_begin_object(jw);
+	json_kv_string(jw, "name", ev->name);
+	json_kv_string(jw, "cat", ev->cat);
+	json_kv_string(jw, "ph", phase);
+	json_kv_uint(jw, "ts", ev->ts);
+	if(ev->phase == 'X')
+		json_kv_uint(jw, "dur", ev->dur);
+	else
+		json_kv_string(jw, "s", "t");
+	json_kv_int(jw, "pid", pid);
+	json_kv_uint(jw, "tid", ev->tid);
+	if(ev->arg[0]) {
+		json_key(jw, "args");
+		json_begin_object(jw);
+		json_kv_string(jw, "arg", ev->arg);
+		json_end_object(jw);
+	}
+	json_end_object(jw);
+}
+
+
+/**************\
+* ENTRY POINTS *
+\**************/
+
+void
+tracer_record(char phase, const char* cat, const char* name,
+	      uint64_t start, const char* arg)
+{
+	struct tracer_event *ev = NULL;
+	uint64_t now = stats_get_usecs();
+	uint64_t pos = 0;
+
+	if(!tracer.ring)
+		return;
+
+	pos = __atomic_fetch_add(&tracer.head, 1, __ATOMIC_RELAXED);
+	ev = &tracer.ring[pos & (tracer.size - 1)];
+
+	/* Readers skip it until it's complete */
+	__atomic_store_n(&ev->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	ev->ts = phase == 'X' ? start : now;
+	ev->dur = phase == 'X' ? now - start : 0;
+	ev->name = name;
+	ev->cat = cat;
+	ev->tid = tracer_get_tid();
+	ev->phase = phase;
+	tracer_copy_arg(ev->arg, arg);
+
+	__atomic_store_n(&ev->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+	stats_counter_add(&tracer.events, 1);
+}
+
+int
+tracer_dump(FILE* out)
+{
+	struct json_writer jw;
+	struct tracer_event ev;
+	uint64_t head = 0;
+	uint64_t pos = 0;
+	int pid = getpid();
+	int ret = 0;
+
+	if(!tracer.ring)
+		return -1;
+
+	json_init(&jw, 0);
+	json_begin_object(&jw);
+	json_kv_string(&jw, "displayTimeUnit", "ms");
+	json_key(&jw, "traceEvents");
+	json_begin_array(&jw);
+
+	json_begin_object(&jw);
+	json_kv_string(&jw, "name", "process_name");
+	json_kv_string(&jw, "ph", "M");
+	json_kv_int(&jw, "pid", pid);
+	json_key(&jw, "args");
+	json_begin_object(&jw);
+	json_kv_string(&jw, "name", "audio-scheduler");
+	json_end_object(&jw);
+	json_end_object(&jw);
+
+	/* Oldest first, whatever gets overwritten while
+	 * we are at it is skipped */
+	head = __atomic_load_n(&tracer.head, __ATOMIC_ACQUIRE);
+	pos = head > tracer.size ? head - tracer.size : 0;
+	for(; pos < head; pos++)
+		if(tracer_read_event(pos, &ev))
+			tracer_write_event(&jw, &ev, pid);
+
+	json_end_array(&jw);
+	json_end_object(&jw);
+	json_raw(&jw, "\n", 1);
+
+	ret = json_finish(&jw);
+	if(ret < 0) {
+		utils_err(TRACER, "Could not allocate trace dump\n");
+		goto cleanup;
+	}
+
+	if(fwrite(jw.buf, 1, ret, out) != (size_t) ret)
+		ret = -1;
+	else
+		stats_counter_add(&tracer.dumps, 1);
+
+ cleanup:
+	json_free(&jw);
+	return ret;
+}
+
+/* Written next to it and renamed, so that a viewer
+ * never sees half of it */
+int
+tracer_dump_file(const char* filepath)
+{
+	char tmppath[PATH_MAX];
+	FILE* out = NULL;
+	int ret = 0;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", filepath);
+
+	out = fopen(tmppath, "w");
+	if(!out) {
+		utils_perr(TRACER, "Could not open %s", tmppath);
+		return -errno;
+	}
+
+	ret = tracer_dump(out);
+	if(fclose(out) != 0 || ret < 0) {
+		utils_err(TRACER, "Could not write trace to %s\n", tmppath);
+		unlink(tmppath);
+		return -1;
+	}
+
+	if(rename(tmppath, filepath) < 0) {
+		utils_perr(TRACER, "Could not rename %s", tmppath);
+		unlink(tmppath);
+		return -errno;
+	}
+
+	utils_info(TRACER, "Trace written to %s\n", filepath);
+	return 0;
+}
+
+int
+tracer_init(uint32_t num_events)
+{
+	uint32_t size = 1;
+
+	stats_counter_register(&tracer.events, "trace_events",
+			       "Events recorded by the tracer");
+	stats_counter_register(&tracer.dumps, "trace_dumps",
+			       "Times the trace ring got dumped");
+
+	if(!num_events) {
+		utils_dbg(TRACER, "Tracer disabled\n");
+		return 0;
+	}
+
+	/* Round up to a power of 2, so that positions wrap cleanly */
+	while(size < num_events)
+		size <<= 1;
+
+	tracer.ring = calloc(size, sizeof(struct tracer_event));
+	if(!tracer.ring) {
+		utils_perr(TRACER, "Could not allocate trace ring");
+		return -ENOMEM;
+	}
+	tracer.size = size;
+	tracer.head = 0;
+	tracer_enabled = 1;
+
+	utils_info(TRACER, "Tracing the last %u events\n", size);
+	return 0;
+}
+
+void
+tracer_cleanup(void)
+{
+	tracer_enabled = 0;
+	free(tracer.ring);
+	tracer.ring = NULL;
+}
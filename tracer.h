@@ -0,0 +1,98 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Event tracer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRACER_H__
+#define __TRACER_H__
+
+#include "stats.h"	/* For stats_get_usecs() */
+#include <stdint.h>	/* For typed ints */
+#include <stdio.h>	/* For FILE */
+
+/* Keeps the last N spans / instant events (scheduling, reloads,
+ * item setup, preroll etc) in a ring, to be dumped as Chrome trace
+ * event JSON (chrome://tracing, ui.perfetto.dev) when something
+ * went wrong. Recording an event is a copy into a fixed-size slot,
+ * the oldest ones get overwritten, nothing blocks and nothing gets
+ * allocated. Off by default, then it's just a check. */
+
+#define TRACER_DEFAULT_FILE	"/tmp/audio-scheduler-trace.json"
+/* Longer arguments keep their tail, e.g. the file name of a path */
+#define TRACER_ARG_LEN		64
+
+struct tracer_event {
+	/* Seqlock, 2 * pos + 1 while being written, 2 * pos + 2 after */
+	uint64_t seq;
+	/* Monotonic, in usecs */
+	uint64_t ts;
+	uint64_t dur;
+	/* Name and category must be static strings */
+	const char* name;
+	const char* cat;
+	uint32_t tid;
+	/* 'X' for spans, 'i' for instant events */
+	char	phase;
+	char	arg[TRACER_ARG_LEN];
+};
+
+/* Only to be read through the inlines below */
+extern int tracer_enabled;
+
+/* num_events is the size of the ring, 0 leaves it disabled */
+int tracer_init(uint32_t num_events);
+void tracer_cleanup(void);
+
+void tracer_record(char phase, const char* cat, const char* name,
+		   uint64_t start, const char* arg);
+
+/* Returns the start of a span, to be passed on to tracer_end(),
+ * 0 if the tracer is disabled */
+static inline uint64_t
+tracer_begin(void)
+{
+	if(__builtin_expect(!tracer_enabled, 1))
+		return 0;
+	return stats_get_usecs();
+}
+
+/* start may also come from stats_get_usecs() (or anything else on
+ * CLOCK_MONOTONIC in usecs) if it's there already, arg may be NULL */
+static inline void
+tracer_end(uint64_t start, const char* cat, const char* name,
+	   const char* arg)
+{
+	if(__builtin_expect(!tracer_enabled || !start, 1))
+		return;
+	tracer_record('X', cat, name, start, arg);
+}
+
+static inline void
+tracer_instant(const char* cat, const char* name, const char* arg)
+{
+	if(__builtin_expect(!tracer_enabled, 1))
+		return;
+	tracer_record('i', cat, name, 0, arg);
+}
+
+/* The events currently in the ring, oldest first, as a single line
+ * of JSON */
+int tracer_dump(FILE* out);
+int tracer_dump_file(const char* filepath);
+
+#endif /* __TRACER_H__ */
@@ -0,0 +1,529 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Background transcoder for expensive source formats
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "transcoder.h"
+#include "analyzer.h"
+#include "utils.h"
+#include <sys/stat.h> /* for struct stat */
+#include <sys/time.h> /* for utimes */
+#include <unistd.h>   /* for unlink */
+#include <stdio.h>    /* for rename */
+#include <string.h>   /* for strcmp */
+
+/* Files that need resampling or go through one of the planar (libav)
+ * decoders are transcoded, once, to a WAV file in the mix format, which
+ * the player can then feed to the mixer without any conversion. The
+ * cache is a flat directory; files are named after a hash of the source's
+ * path and the mtime the media index has for it (plus the mix format), so
+ * that a lookup doesn't have to touch the source and a modified source gets
+ * a new entry once it is re-analyzed; the stale one eventually falls off
+ * the LRU end. */
+
+#define TRANSCODER_POLL_TIMEOUT (100 * GST_MSECOND)
+#define TRANSCODER_PART_SUFFIX ".part"
+
+struct cache_entry
+{
+  gchar *name;
+  guint64 size;
+  GList link;
+};
+
+struct transcode_job
+{
+  gchar *file;
+  gchar *name;
+  guint64 estimate;
+};
+
+static void
+cache_entry_free (struct cache_entry * entry)
+{
+  g_free (entry->name);
+  g_free (entry);
+}
+
+static void
+transcode_job_free (struct transcode_job * job)
+{
+  g_free (job->file);
+  g_free (job->name);
+  g_free (job);
+}
+
+static gchar *
+transcoder_cache_name (struct transcoder * self, const gchar * file,
+    const struct midx_info * info)
+{
+  gchar *hash, *name;
+
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, file, -1);
+  name = g_strdup_printf ("%s-%lx-%ix%i.wav", hash,
+      (unsigned long) info->mtime, self->mix_rate, self->mix_channels);
+  g_free (hash);
+
+  return name;
+}
+
+/* must be called with the lock held */
+static void
+transcoder_add_entry (struct transcoder * self, const gchar * name,
+    guint64 size)
+{
+  struct cache_entry *entry;
+
+  entry = g_new0 (struct cache_entry, 1);
+  entry->name = g_strdup (name);
+  entry->size = size;
+  entry->link.data = entry;
+
+  g_hash_table_replace (self->entries, entry->name, entry);
+  g_queue_push_tail_link (&self->lru, &entry->link);
+  self->cache_size += size;
+}
+
+/* must be called with the lock held */
+static gboolean
+transcoder_make_room (struct transcoder * self, guint64 bytes)
+{
+  struct cache_entry *entry;
+  GList *link;
+  gchar *path;
+
+  if (bytes > self->quota_bytes)
+    return FALSE;
+
+  while (self->cache_size + self->reserved + bytes > self->quota_bytes) {
+    link = g_queue_pop_head_link (&self->lru);
+    if (!link)
+      return FALSE;
+
+    entry = link->data;
+    path = g_build_filename (self->cache_dir, entry->name, NULL);
+    if (unlink (path) < 0)
+      utils_perr (TRC, "Couldn't remove %s", path);
+    else
+      utils_dbg (TRC, "evicted %s\n", entry->name);
+    g_free (path);
+
+    self->cache_size -= entry->size;
+    g_hash_table_remove (self->entries, entry->name);
+  }
+
+  return TRUE;
+}
+
+static gint
+compare_mtime (gconstpointer a, gconstpointer b, gpointer mtimes)
+{
+  time_t ta = GPOINTER_TO_SIZE (g_hash_table_lookup (mtimes, a));
+  time_t tb = GPOINTER_TO_SIZE (g_hash_table_lookup (mtimes, b));
+
+  return (ta > tb) - (ta < tb);
+}
+
+/* rebuilds the LRU from what is on disk; lookups touch the files,
+ * so their mtime is a good enough approximation of the last use */
+static int
+transcoder_scan_cache (struct transcoder * self)
+{
+  GHashTable *mtimes;
+  GSList *names = NULL, *l;
+  struct stat st;
+  const gchar *name;
+  gchar *path;
+  GError *error = NULL;
+  GDir *dir;
+
+  dir = g_dir_open (self->cache_dir, 0, &error);
+  if (!dir) {
+    utils_err (TRC, "Couldn't open cache directory %s: %s\n",
+        self->cache_dir, error->message);
+    g_clear_error (&error);
+    return -1;
+  }
+
+  mtimes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    path = g_build_filename (self->cache_dir, name, NULL);
+
+    /* leftovers of jobs that got interrupted */
+    if (g_str_has_suffix (name, TRANSCODER_PART_SUFFIX)) {
+      unlink (path);
+    } else if (g_str_has_suffix (name, ".wav") &&
+        utils_stat (path, &st) == 0) {
+      g_hash_table_insert (mtimes, g_strdup (name),
+          GSIZE_TO_POINTER (st.st_mtime));
+      names = g_slist_prepend (names, g_strdup (name));
+    }
+
+    g_free (path);
+  }
+  g_dir_close (dir);
+
+  names = g_slist_sort_with_data (names, compare_mtime, mtimes);
+  for (l = names; l; l = l->next) {
+    path = g_build_filename (self->cache_dir, l->data, NULL);
+    if (utils_stat (path, &st) == 0)
+      transcoder_add_entry (self, l->data, st.st_size);
+    g_free (path);
+  }
+
+  g_slist_free_full (names, g_free);
+  g_hash_table_unref (mtimes);
+
+  utils_info (TRC, "Cache at %s holds %u files, %" G_GUINT64_FORMAT "MB\n",
+      self->cache_dir, g_hash_table_size (self->entries),
+      self->cache_size >> 20);
+
+  /* the quota may have been lowered since last time */
+  g_mutex_lock (&self->lock);
+  transcoder_make_room (self, 0);
+  g_mutex_unlock (&self->lock);
+
+  return 0;
+}
+
+static GstBusSyncReply
+transcoder_bus_sync_handler (GstBus * bus, GstMessage * msg, gpointer data)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_STREAM_STATUS:
+      gst_message_parse_stream_status (msg, &type, &owner);
+      if (type == GST_STREAM_STATUS_TYPE_ENTER)
+        analyzer_lower_thread_priority ();
+      return GST_BUS_DROP;
+
+    case GST_MESSAGE_ERROR:
+    case GST_MESSAGE_EOS:
+      return GST_BUS_PASS;
+
+    default:
+      return GST_BUS_DROP;
+  }
+}
+
+static void
+decodebin_pad_added (GstElement * decodebin, GstPad * src, GstPad * sink)
+{
+  gst_pad_link (src, sink);
+}
+
+static gboolean
+transcoder_run_pipeline (struct transcoder * self, const gchar * file,
+    const gchar * location)
+{
+  GstElement *pipeline, *decodebin, *encoder, *sink;
+  GstPad *encoder_sink;
+  GstMessage *msg = NULL;
+  GError *error = NULL;
+  GstBus *bus;
+  gchar *desc, *uri, *debug = NULL;
+  gboolean ret = FALSE;
+
+  uri = gst_filename_to_uri (file, &error);
+  if (error) {
+    utils_wrn (TRC, "Failed to convert filename '%s' to URI: %s\n", file,
+        error->message);
+    g_clear_error (&error);
+    return FALSE;
+  }
+
+  /* this is offline, so we can afford the best resampler quality */
+  desc = g_strdup_printf ("audioconvert ! audioresample quality=10 ! "
+      "capsfilter caps=\"%s\" ! wavenc ! filesink name=sink", self->mix_caps);
+  encoder = gst_parse_bin_from_description (desc, TRUE, &error);
+  g_free (desc);
+
+  decodebin = gst_element_factory_make ("uridecodebin", NULL);
+
+  if (!encoder || !decodebin) {
+    utils_err (TRC, "Your GStreamer installation is missing required "
+        "elements%s%s\n", error ? ": " : "", error ? error->message : "");
+    g_clear_error (&error);
+    g_clear_object (&encoder);
+    g_clear_object (&decodebin);
+    g_free (uri);
+    return FALSE;
+  }
+
+  gst_util_set_object_arg (G_OBJECT (decodebin), "caps", "audio/x-raw");
+  g_object_set (decodebin, "uri", uri, NULL);
+  g_free (uri);
+
+  sink = gst_bin_get_by_name (GST_BIN (encoder), "sink");
+  g_object_set (sink, "location", location, NULL);
+  gst_object_unref (sink);
+
+  pipeline = gst_pipeline_new (NULL);
+  gst_bin_add_many (GST_BIN (pipeline), decodebin, encoder, NULL);
+
+  encoder_sink = gst_element_get_static_pad (encoder, "sink");
+  g_signal_connect_object (decodebin, "pad-added",
+      (GCallback) decodebin_pad_added, encoder_sink, 0);
+  gst_object_unref (encoder_sink);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_set_sync_handler (bus, transcoder_bus_sync_handler, NULL, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  while (!g_atomic_int_get (&self->stopping)) {
+    msg = gst_bus_timed_pop_filtered (bus, TRANSCODER_POLL_TIMEOUT,
+        GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (msg)
+      break;
+  }
+
+  if (msg && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS) {
+    ret = TRUE;
+  } else if (msg) {
+    gst_message_parse_error (msg, &error, &debug);
+    utils_wrn (TRC, "failed to transcode '%s': %s\n", file, error->message);
+    utils_dbg (TRC, "ERROR debug message: %s\n", debug);
+    g_clear_error (&error);
+    g_free (debug);
+  }
+
+  if (msg)
+    gst_message_unref (msg);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+
+  return ret;
+}
+
+static void
+transcoder_worker (struct transcode_job * job, struct transcoder * self)
+{
+  struct stat st;
+  gchar *path, *part;
+  gboolean done = FALSE;
+  gint64 start = g_get_monotonic_time ();
+
+  analyzer_lower_thread_priority ();
+
+  path = g_build_filename (self->cache_dir, job->name, NULL);
+  part = g_strconcat (path, TRANSCODER_PART_SUFFIX, NULL);
+
+  if (!g_atomic_int_get (&self->stopping)) {
+    utils_dbg (TRC, "transcoding '%s' to %s\n", job->file, job->name);
+    done = transcoder_run_pipeline (self, job->file, part) &&
+        utils_stat (part, &st) == 0 && rename (part, path) == 0;
+  }
+
+  g_mutex_lock (&self->lock);
+  self->reserved -= job->estimate;
+  if (done) {
+    transcoder_add_entry (self, job->name, st.st_size);
+    /* the estimate may have been off */
+    transcoder_make_room (self, 0);
+  }
+  g_hash_table_remove (self->jobs, job->name);
+  g_mutex_unlock (&self->lock);
+
+  if (done) {
+    utils_info (TRC, "transcoded '%s' (%" G_GUINT64_FORMAT "MB), "
+        "took %.2lfs\n", job->file, (guint64) st.st_size >> 20,
+        (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC);
+  } else {
+    unlink (part);
+  }
+
+  g_free (part);
+  g_free (path);
+  transcode_job_free (job);
+}
+
+int
+transcoder_init (struct transcoder * self)
+{
+  GError *error = NULL;
+
+  stats_counter_register (&self->hits, "transcode_cache_hits",
+      "Files played from their transcoded copy");
+  stats_counter_register (&self->misses, "transcode_cache_misses",
+      "Files that weren't transcoded yet");
+
+  if (!self->cache_dir) {
+    utils_info (TRC, "Transcoding disabled\n");
+    return 0;
+  }
+
+  if (g_mkdir_with_parents (self->cache_dir, 0755) < 0) {
+    utils_perr (TRC, "Couldn't create cache directory %s", self->cache_dir);
+    return -1;
+  }
+
+  g_mutex_init (&self->lock);
+  g_queue_init (&self->lru);
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) cache_entry_free);
+  self->jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->cache_size = self->reserved = 0;
+  self->stopping = 0;
+
+  /* same as the player's internal format, see player_init() */
+  self->mix_caps = g_strdup_printf ("audio/x-raw, format=F32LE, "
+      "layout=interleaved, rate=%i, channels=%i", self->mix_rate,
+      self->mix_channels);
+
+  if (transcoder_scan_cache (self) < 0)
+    return -1;
+
+  self->pool = g_thread_pool_new ((GFunc) transcoder_worker, self,
+      MAX (self->max_jobs, 1), FALSE, &error);
+  if (!self->pool) {
+    utils_err (TRC, "Couldn't create thread pool: %s\n", error->message);
+    g_clear_error (&error);
+    return -1;
+  }
+
+  utils_dbg (TRC, "transcoder initialized, up to %i jobs, quota %"
+      G_GUINT64_FORMAT "MB\n", MAX (self->max_jobs, 1),
+      self->quota_bytes >> 20);
+
+  return 0;
+}
+
+void
+transcoder_cleanup (struct transcoder * self)
+{
+  if (!self->entries)
+    return;
+
+  g_atomic_int_set (&self->stopping, 1);
+
+  /* let the workers go through whatever is still queued, the jobs
+   * notice the flag above and bail out early (or don't even start),
+   * freeing themselves on the way */
+  if (self->pool)
+    g_thread_pool_free (self->pool, FALSE, TRUE);
+  self->pool = NULL;
+
+  g_queue_init (&self->lru);
+  g_clear_pointer (&self->entries, g_hash_table_unref);
+  g_clear_pointer (&self->jobs, g_hash_table_unref);
+  g_clear_pointer (&self->mix_caps, g_free);
+  g_mutex_clear (&self->lock);
+
+  utils_dbg (TRC, "transcoder destroyed\n");
+}
+
+gchar *
+transcoder_lookup (struct transcoder * self, const gchar * file,
+    const struct midx_info * info)
+{
+  struct cache_entry *entry;
+  gchar *name, *path = NULL;
+
+  if (!self->pool)
+    return NULL;
+
+  name = transcoder_cache_name (self, file, info);
+
+  g_mutex_lock (&self->lock);
+  entry = g_hash_table_lookup (self->entries, name);
+  if (entry) {
+    g_queue_unlink (&self->lru, &entry->link);
+    g_queue_push_tail_link (&self->lru, &entry->link);
+
+    path = g_build_filename (self->cache_dir, name, NULL);
+    /* remember the last use across restarts */
+    utimes (path, NULL);
+    stats_counter_add (&self->hits, 1);
+  }
+  g_mutex_unlock (&self->lock);
+
+  g_free (name);
+  return path;
+}
+
+void
+transcoder_submit (struct transcoder * self, const gchar * file,
+    const struct midx_info * info)
+{
+  struct transcode_job *job;
+  gchar *name;
+
+  if (!self->pool)
+    return;
+
+  /* decoding and resampling is where the cpu goes; a file that is only
+   * off in channels or sample format is cheap to convert on the fly */
+  if (info->native_rate <= (guint32) self->mix_rate &&
+      strcmp (info->native_format, "-") != 0)
+    return;
+
+  /* the player only submits what it didn't find */
+  stats_counter_add (&self->misses, 1);
+
+  name = transcoder_cache_name (self, file, info);
+
+  job = g_new0 (struct transcode_job, 1);
+  job->file = g_strdup (file);
+  job->name = name;
+  job->estimate = gst_util_uint64_scale (info->duration_ns,
+      (guint64) self->mix_rate * self->mix_channels * sizeof (gfloat),
+      GST_SECOND);
+
+  g_mutex_lock (&self->lock);
+  if (g_hash_table_contains (self->entries, name) ||
+      g_hash_table_contains (self->jobs, name) ||
+      !transcoder_make_room (self, job->estimate)) {
+    g_mutex_unlock (&self->lock);
+    transcode_job_free (job);
+    return;
+  }
+  self->reserved += job->estimate;
+  g_hash_table_add (self->jobs, g_strdup (name));
+  g_mutex_unlock (&self->lock);
+
+  g_thread_pool_push (self->pool, job, NULL);
+}
+
+void
+transcoder_dump (struct transcoder * self, FILE * out)
+{
+  guint entries = 0, jobs = 0;
+  guint64 size = 0, reserved = 0;
+
+  if (self->entries) {
+    g_mutex_lock (&self->lock);
+    entries = g_hash_table_size (self->entries);
+    jobs = g_hash_table_size (self->jobs);
+    size = self->cache_size;
+    reserved = self->reserved;
+    g_mutex_unlock (&self->lock);
+  }
+
+  fprintf (out, "cache\tname=transcoder\tenabled=%i\tentries=%u\tjobs=%u\t"
+      "size_mb=%.1lf\treserved_mb=%.1lf\tquota_mb=%" G_GUINT64_FORMAT
+      "\thits=%" G_GUINT64_FORMAT "\tmisses=%" G_GUINT64_FORMAT "\n",
+      self->entries != NULL, entries, jobs, size / 1048576.0,
+      reserved / 1048576.0, self->quota_bytes >> 20,
+      stats_counter_get (&self->hits), stats_counter_get (&self->misses));
+}
@@ -0,0 +1,70 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Background transcoder for expensive source formats
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSCODER_H__
+#define __TRANSCODER_H__
+
+#include "media_index.h"
+#include "stats.h"
+#include <gst/gst.h>
+#include <stdio.h>     /* for FILE */
+
+struct transcoder
+{
+  /* configuration; a NULL cache_dir disables the transcoder */
+  gchar *cache_dir;
+  guint64 quota_bytes;
+  gint max_jobs;
+  gint mix_rate;
+  gint mix_channels;
+
+  /* internal */
+  GThreadPool *pool;
+  gchar *mix_caps;
+  gint stopping;
+
+  GMutex lock;
+  GHashTable *entries;  /* cache file name -> struct cache_entry */
+  GQueue lru;           /* struct cache_entry, least recently used first */
+  GHashTable *jobs;     /* cache file names being produced */
+  guint64 cache_size;
+  guint64 reserved;
+
+  /* statistics; a miss is a file we could have played transcoded */
+  struct stats_counter hits;
+  struct stats_counter misses;
+};
+
+int transcoder_init (struct transcoder * self);
+void transcoder_cleanup (struct transcoder * self);
+
+/* returns the path of the cached copy of file (to be freed), or NULL;
+ * info is what the media index has on it */
+gchar *transcoder_lookup (struct transcoder * self, const gchar * file,
+    const struct midx_info * info);
+
+/* queues file for transcoding, if it is worth it and fits in the quota */
+void transcoder_submit (struct transcoder * self, const gchar * file,
+    const struct midx_info * info);
+
+/* for the control socket */
+void transcoder_dump (struct transcoder * self, FILE * out);
+
+#endif /* __TRANSCODER_H__ */
@@ -18,9 +18,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#define _GNU_SOURCE	/* Needed for vasprintf() */
 #include "utils.h"
-#include <stdio.h>	/* For v/printf() */
+#include "stats.h"
+#include "logger.h"
+#include <stdio.h>	/* For fopen()/fread() */
 #include <stdlib.h>	/* For free()/random() */
 #include <errno.h>	/* For errno */
 #include <string.h>	/* For strerror()/memmove() */
@@ -36,34 +37,30 @@
 	#endif
 #endif
 
+/* The real functions behind the macros in utils.h */
+#undef utils_info
+#undef utils_dbg
 
-/* Some codes for prety output on the terminal */
-#define NORMAL	"\x1B[0m"
-#define	BRIGHT	"\x1B[1m"
-#define	DIM	"\x1B[2m"
-#define RED	"\x1B[31m"
-#define GREEN	"\x1B[32m"
-#define YELLOW	"\x1B[33m"
-#define BLUE	"\x1B[34m"
-#define MAGENTA	"\x1B[35m"
-#define CYAN	"\x1B[36m"
-#define WHITE	"\x1B[37m"
 
-static int log_level = 0;
+int utils_log_level = 0;
+
+/* The scheduler checks files on every item, keep an eye on it */
+static struct stats_counter stat_calls;
+static struct stats_counter access_calls;
 
 #ifdef DEBUG
-static int debug_mask = 0;
+int utils_debug_mask = 0;
 
 void
 utils_set_debug_mask(int debug_msk)
 {
-	debug_mask = debug_msk;
+	utils_debug_mask = debug_msk;
 }
 
 int
 utils_is_debug_enabled(int facility)
 {
-	return ((debug_mask & facility) == facility ? 1 : 0);
+	return ((utils_debug_mask & facility) == facility ? 1 : 0);
 }
 
 #else
@@ -74,7 +71,7 @@ int utils_is_debug_enabled(int facility) {return 0;}
 void
 utils_set_log_level(int log_lvl)
 {
-	log_level = log_lvl;
+	utils_log_level = log_lvl;
 }
 
 static const char*
@@ -83,7 +80,7 @@ utils_get_facility_name(int facility)
 	if(facility & SKIP)
 		return "";
 
-	switch(facility & 0xFF) {
+	switch(facility & ~SKIP) {
 	case NONE:
 		return "";
 	case SCHED:
@@ -100,6 +97,22 @@ utils_get_facility_name(int facility)
 		return "[META] ";
 	case UTILS:
 		return "[UTILS] ";
+	case IDX:
+		return "[IDX] ";
+	case ANL:
+		return "[ANL] ";
+	case TRC:
+		return "[TRC] ";
+	case PCM:
+		return "[PCM] ";
+	case RT:
+		return "[RT] ";
+	case STATS:
+		return "[STATS] ";
+	case CTL:
+		return "[CTL] ";
+	case TRACER:
+		return "[TRACER] ";
 	default:
 		return "[UNK] ";
 	}
@@ -109,27 +122,17 @@ utils_get_facility_name(int facility)
 void
 utils_verr(int facility, const char* fmt, va_list args)
 {
-	char *msg = NULL;
-	int ret = 0;
-
-	if(log_level < ERROR)
-		return;
-
-	ret = vasprintf(&msg, fmt, args);
-	if(ret < 0)
+	if(utils_log_level < ERROR)
 		return;
 
-	fprintf(stderr, RED"%s%s"NORMAL,
-		utils_get_facility_name(facility), msg);
-	fflush(stderr);
-	free(msg);
+	logger_vlog(ERROR, utils_get_facility_name(facility), 0, fmt, args);
 }
 
 void
 utils_err(int facility, const char* fmt,...)
 {
 	va_list args;
-	if(log_level < ERROR)
+	if(utils_log_level < ERROR)
 		return;
 	va_start(args, fmt);
 	utils_verr(facility, fmt, args);
@@ -140,29 +143,21 @@ utils_err(int facility, const char* fmt,...)
 void
 utils_vperr(int facility, const char* fmt, va_list args)
 {
-	char *msg = NULL;
-	int ret = 0;
-
-	if(log_level < ERROR)
-		return;
-
-	ret = vasprintf(&msg, fmt, args);
-	if(ret < 0)
+	if(utils_log_level < ERROR)
 		return;
 
-	fprintf(stderr, RED"%s%s: %s"NORMAL"\n",
-		utils_get_facility_name(facility), msg, strerror(errno));
-	fflush(stderr);
-	free(msg);
+	logger_vlog(ERROR, utils_get_facility_name(facility), errno, fmt, args);
 }
 
 void
 utils_perr(int facility, const char* fmt,...)
 {
 	va_list args;
-	if(log_level < ERROR)
+	int err = errno;
+	if(utils_log_level < ERROR)
 		return;
 	va_start(args, fmt);
+	errno = err;
 	utils_vperr(facility, fmt, args);
 	va_end(args);
 }
@@ -171,26 +166,17 @@ utils_perr(int facility, const char* fmt,...)
 void
 utils_vwrn(int facility, const char* fmt, va_list args)
 {
-	char *msg = NULL;
-	int ret = 0;
-
-	if(log_level < WARN)
-		return;
-
-	ret = vasprintf(&msg, fmt, args);
-	if(ret < 0)
+	if(utils_log_level < WARN)
 		return;
 
-	fprintf(stderr, YELLOW"%s%s"NORMAL, utils_get_facility_name(facility), msg);
-	fflush(stderr);
-	free(msg);
+	logger_vlog(WARN, utils_get_facility_name(facility), 0, fmt, args);
 }
 
 void
 utils_wrn(int facility, const char* fmt,...)
 {
 	va_list args;
-	if(log_level < WARN)
+	if(utils_log_level < WARN)
 		return;
 	va_start(args, fmt);
 	utils_vwrn(facility, fmt, args);
@@ -201,29 +187,21 @@ utils_wrn(int facility, const char* fmt,...)
 void
 utils_vpwrn(int facility, const char* fmt, va_list args)
 {
-	char *msg = NULL;;
-	int ret = 0;
-
-	if(log_level < WARN)
-		return;
-
-	ret = vasprintf(&msg, fmt, args);
-	if(ret < 0)
+	if(utils_log_level < WARN)
 		return;
 
-	fprintf(stderr, YELLOW"%s%s: %s"NORMAL"\n",
-		utils_get_facility_name(facility), msg, strerror(errno));
-	fflush(stderr);
-	free(msg);
+	logger_vlog(WARN, utils_get_facility_name(facility), errno, fmt, args);
 }
 
 void
 utils_pwrn(int facility, const char* fmt,...)
 {
 	va_list args;
-	if(log_level < WARN)
+	int err = errno;
+	if(utils_log_level < WARN)
 		return;
 	va_start(args, fmt);
+	errno = err;
 	utils_vpwrn(facility, fmt, args);
 	va_end(args);
 }
@@ -232,26 +210,17 @@ utils_pwrn(int facility, const char* fmt,...)
 void
 utils_vinfo(int facility, const char* fmt, va_list args)
 {
-	char *msg = NULL;
-	int ret = 0;
-
-	if(log_level < INFO)
-		return;
-
-	ret = vasprintf(&msg, fmt, args);
-	if(ret < 0)
+	if(utils_log_level < INFO)
 		return;
 
-	printf(CYAN"%s%s"NORMAL, utils_get_facility_name(facility), msg);
-	fflush(stdout);
-	free(msg);
+	logger_vlog(INFO, utils_get_facility_name(facility), 0, fmt, args);
 }
 
 void
 utils_info(int facility, const char* fmt,...)
 {
 	va_list args;
-	if(log_level < INFO)
+	if(utils_log_level < INFO)
 		return;
 	va_start(args, fmt);
 	utils_vinfo(facility, fmt, args);
@@ -263,30 +232,20 @@ utils_info(int facility, const char* fmt,...)
 void
 utils_vdbg(int facility, const char* fmt, va_list args)
 {
-	char *msg = NULL;
-	int ret = 0;
-
-	if(log_level < DBG)
-		return;
-
-	if(!(facility & debug_mask))
+	if(utils_log_level < DBG)
 		return;
 
-	ret = vasprintf(&msg, fmt, args);
-	if(ret < 0)
+	if(!(facility & utils_debug_mask))
 		return;
 
-	fprintf(stderr, MAGENTA"%s%s"NORMAL,
-		utils_get_facility_name(facility), msg);
-	fflush(stderr);
-	free(msg);
+	logger_vlog(DBG, utils_get_facility_name(facility), 0, fmt, args);
 }
 
 void
 utils_dbg(int facility, const char* fmt,...)
 {
 	va_list args;
-	if(log_level < DBG)
+	if(utils_log_level < DBG)
 		return;
 	va_start(args, fmt);
 	utils_vdbg(facility, fmt, args);
@@ -390,11 +349,28 @@ utils_get_random_uint()
 	return value;
 }
 
+void
+utils_register_stats(void)
+{
+	stats_counter_register(&stat_calls, "stat_calls",
+			       "stat() calls on files");
+	stats_counter_register(&access_calls, "access_calls",
+			       "access() calls on files");
+}
+
+int
+utils_stat(const char* filepath, struct stat *st)
+{
+	stats_counter_add(&stat_calls, 1);
+	return stat(filepath, st);
+}
+
 time_t
 utils_get_mtime(char* filepath)
 {
 	struct stat st;
 
+	stats_counter_add(&stat_calls, 1);
 	if (stat(filepath, &st) < 0) {
 		utils_perr(UTILS, "Could not stat(%s)", filepath);
 		return 0;
@@ -409,6 +385,7 @@ utils_is_regular_file(char* filepath)
 	struct stat st;
 	int ret = 1;
 
+	stats_counter_add(&stat_calls, 1);
 	ret = stat(filepath, &st);
 	if (!S_ISREG(st.st_mode)) {
 		utils_wrn(UTILS, "Not a regular file: %s\n", filepath);
@@ -430,6 +407,7 @@ utils_is_readable_file(char*filepath)
 	if(!utils_is_regular_file(filepath))
 		return 0;
 
+	stats_counter_add(&access_calls, 1);
 	ret = access(filepath, R_OK);
 	if(ret < 0) {
 		utils_pwrn(UTILS, "access(%s) failed", filepath);
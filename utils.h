@@ -23,6 +23,7 @@
 
 #include <stdarg.h>		/* For va_list handling */
 #include <time.h>		/* For time_t */
+#include <sys/stat.h>		/* For struct stat */
 #include "config.h"
 
 enum facilities {
@@ -35,6 +36,14 @@ enum facilities {
 	UTILS	= 0x40,
 	META	= 0x80,
 	SKIP	= 0x100,
+	IDX	= 0x200,
+	ANL	= 0x400,
+	TRC	= 0x800,
+	PCM	= 0x1000,
+	RT	= 0x2000,
+	STATS	= 0x4000,
+	CTL	= 0x8000,
+	TRACER	= 0x10000,
 };
 
 enum log_levels {
@@ -50,6 +59,28 @@ void utils_set_debug_mask(int debug_msk);
 int utils_is_debug_enabled(int facility);
 void utils_set_log_level(int log_lvl);
 
+/* Only to be read through utils_log_enabled() */
+extern int utils_log_level;
+#ifdef DEBUG
+extern int utils_debug_mask;
+#endif
+
+/* For call sites that need to do some work just to log
+ * something, e.g. format a date */
+static inline int
+utils_log_enabled(int level, int facility)
+{
+	if(__builtin_expect(utils_log_level < level, 1))
+		return 0;
+	if(level < DBG)
+		return 1;
+#ifdef DEBUG
+	return (utils_debug_mask & facility) ? 1 : 0;
+#else
+	return 0;
+#endif
+}
+
 /* Log output */
 void utils_verr(int facility, const char* fmt, va_list args);
 void utils_vperr(int facility, const char* fmt, va_list args);
@@ -65,8 +96,35 @@ void utils_pwrn(int facility, const char* fmt,...);
 void utils_info(int facility, const char* fmt,...);
 void utils_dbg(int facility, const char* fmt,...);
 
+/* Info and debug messages are the ones that get filtered out in
+ * production, so check before evaluating the arguments (and
+ * making a call). Without DEBUG, debug messages are compiled
+ * out but their arguments still get type-checked. */
+#define utils_info(facility, ...)					\
+	do {								\
+		if(utils_log_enabled(INFO, (facility)))			\
+			utils_info((facility), __VA_ARGS__);		\
+	} while(0)
+
+#ifdef DEBUG
+#define utils_dbg(facility, ...)					\
+	do {								\
+		if(utils_log_enabled(DBG, (facility)))			\
+			utils_dbg((facility), __VA_ARGS__);		\
+	} while(0)
+#else
+#define utils_dbg(facility, ...)					\
+	do {								\
+		if(0)							\
+			utils_dbg((facility), __VA_ARGS__);		\
+	} while(0)
+#endif
+
 /* File operations */
+void utils_register_stats(void);
 time_t utils_get_mtime(char* filepath);
+/* stat() that shows up in the stats, doesn't log anything */
+int utils_stat(const char* filepath, struct stat *st);
 int utils_is_regular_file(char* filepath);
 int utils_is_readable_file(char*filepath);
 
@@ -0,0 +1,525 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Crossfading mixer element
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "xfade_mixer.h"
+#include <gst/audio/audio.h>
+#include <gst/audio/gstaudioaggregator.h>
+#include <string.h>   /* for memcpy */
+#include <math.h>     /* for sin, cos */
+
+/* An audiomixer replacement that only does what we need: it sums F32
+ * streams (the player pins the mix format anyway) and applies the pad
+ * volume and the fade envelope on the way, sample-accurately and in one
+ * pass, instead of syncing a control binding on every buffer. */
+
+/* kernels are built for AVX2 / AVX / SSE on x86 and picked at load time;
+ * on ARM the default build already vectorizes them for NEON */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define XFADE_KERNEL __attribute__ ((target_clones ("avx2", "avx", "default")))
+#else
+#define XFADE_KERNEL
+#endif
+
+typedef float v8sf __attribute__ ((vector_size (8 * sizeof (float))));
+
+#define XFADE_MAX_FADES 4
+#define XFADE_LUT_SIZE 1024
+/* during a fade, the envelope is evaluated this often (and at the edges
+ * of the fades) and ramped linearly in between, well below what the
+ * LUT resolves on anything but the shortest fades */
+#define XFADE_RAMP_FRAMES 64
+
+#define XFADE_CAPS \
+    "audio/x-raw, format = (string) " GST_AUDIO_NE (F32) ", " \
+    "layout = (string) interleaved, rate = (int) [ 1, MAX ], " \
+    "channels = (int) [ 1, " G_STRINGIFY (XFADE_MAX_CHANNELS) " ]"
+
+struct xfade
+{
+  GstClockTime start;
+  GstClockTime end;
+  gfloat start_level;
+  gfloat end_level;
+  XFadeShape shape;
+};
+
+/* shape curves, rising from 0 to 1; falling fades use them mirrored, so
+ * that an equal power fade out and fade in add up to constant power */
+static gfloat xfade_lut[XFADE_SHAPE_S_CURVE + 1][XFADE_LUT_SIZE + 1];
+
+/*
+ * Pad
+ */
+
+#define XFADE_TYPE_MIXER_PAD (xfade_mixer_pad_get_type ())
+#define XFADE_MIXER_PAD(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), XFADE_TYPE_MIXER_PAD, XFadeMixerPad))
+#define XFADE_IS_MIXER_PAD(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), XFADE_TYPE_MIXER_PAD))
+
+typedef struct
+{
+  GstAudioAggregatorPad parent;
+
+  /* protected by the object lock */
+  gdouble volume;
+  struct xfade fades[XFADE_MAX_FADES];
+  guint num_fades;
+} XFadeMixerPad;
+
+typedef struct
+{
+  GstAudioAggregatorPadClass parent_class;
+} XFadeMixerPadClass;
+
+GType xfade_mixer_pad_get_type (void);
+G_DEFINE_TYPE (XFadeMixerPad, xfade_mixer_pad, GST_TYPE_AUDIO_AGGREGATOR_PAD);
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_VOLUME,
+};
+
+static void
+xfade_mixer_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  XFadeMixerPad *pad = XFADE_MIXER_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_VOLUME:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_double (value, pad->volume);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+xfade_mixer_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  XFadeMixerPad *pad = XFADE_MIXER_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_VOLUME:
+      GST_OBJECT_LOCK (pad);
+      pad->volume = g_value_get_double (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+xfade_mixer_pad_class_init (XFadeMixerPadClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->set_property = xfade_mixer_pad_set_property;
+  gobject_class->get_property = xfade_mixer_pad_get_property;
+
+  /* same range as audiomixer's */
+  g_object_class_install_property (gobject_class, PROP_PAD_VOLUME,
+      g_param_spec_double ("volume", "Volume", "Volume of this pad",
+          0.0, 10.0, 1.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+xfade_mixer_pad_init (XFadeMixerPad * pad)
+{
+  pad->volume = 1.0;
+  pad->num_fades = 0;
+}
+
+void
+xfade_mixer_pad_set_fade (GstPad * gpad, GstClockTime start,
+    gdouble start_level, GstClockTime end, gdouble end_level,
+    XFadeShape shape)
+{
+  XFadeMixerPad *pad;
+  struct xfade fade;
+  guint i;
+
+  g_return_if_fail (XFADE_IS_MIXER_PAD (gpad));
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (start));
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (end) && end >= start);
+
+  pad = XFADE_MIXER_PAD (gpad);
+  fade.start = start;
+  fade.end = end;
+  fade.start_level = start_level;
+  fade.end_level = end_level;
+  fade.shape = MIN (shape, XFADE_SHAPE_S_CURVE);
+
+  GST_OBJECT_LOCK (pad);
+
+  /* an item has a fade in and a fade out at most,
+   * if this ever fills up, forget the earliest one */
+  if (pad->num_fades == XFADE_MAX_FADES) {
+    memmove (&pad->fades[0], &pad->fades[1],
+        (XFADE_MAX_FADES - 1) * sizeof (struct xfade));
+    pad->num_fades--;
+  }
+
+  /* keep them sorted by start time */
+  for (i = pad->num_fades; i > 0 && pad->fades[i - 1].start > start; i--)
+    pad->fades[i] = pad->fades[i - 1];
+  pad->fades[i] = fade;
+  pad->num_fades++;
+
+  GST_OBJECT_UNLOCK (pad);
+}
+
+void
+xfade_mixer_pad_clear_fades (GstPad * gpad)
+{
+  XFadeMixerPad *pad;
+
+  g_return_if_fail (XFADE_IS_MIXER_PAD (gpad));
+
+  pad = XFADE_MIXER_PAD (gpad);
+  GST_OBJECT_LOCK (pad);
+  pad->num_fades = 0;
+  GST_OBJECT_UNLOCK (pad);
+}
+
+/*
+ * Envelope
+ */
+
+static inline gfloat
+xfade_shape_eval (XFadeShape shape, gdouble x)
+{
+  gdouble pos;
+  guint idx;
+
+  if (shape == XFADE_SHAPE_LINEAR)
+    return x;
+
+  pos = x * XFADE_LUT_SIZE;
+  idx = MIN ((guint) pos, XFADE_LUT_SIZE - 1);
+
+  return xfade_lut[shape][idx] +
+      (xfade_lut[shape][idx + 1] - xfade_lut[shape][idx]) * (pos - idx);
+}
+
+static gfloat
+xfade_eval (const struct xfade *fade, GstClockTime ts)
+{
+  gdouble x;
+  gfloat y;
+
+  if (ts <= fade->start)
+    return fade->start_level;
+  if (ts >= fade->end)
+    return fade->end_level;
+
+  x = (gdouble) (ts - fade->start) / (gdouble) (fade->end - fade->start);
+
+  if (fade->end_level >= fade->start_level)
+    y = xfade_shape_eval (fade->shape, x);
+  else
+    y = 1.0f - xfade_shape_eval (fade->shape, 1.0 - x);
+
+  return fade->start_level + (fade->end_level - fade->start_level) * y;
+}
+
+/* like an interpolation control source: before the first fade the level
+ * is where it starts, between fades it stays where the last one ended */
+static gfloat
+xfade_envelope (const struct xfade *fades, guint num_fades, GstClockTime ts)
+{
+  guint i;
+
+  if (num_fades == 0)
+    return 1.0f;
+
+  for (i = num_fades; i > 0; i--) {
+    if (fades[i - 1].start <= ts)
+      return xfade_eval (&fades[i - 1], ts);
+  }
+
+  return fades[0].start_level;
+}
+
+static gboolean
+xfade_envelope_is_flat (const struct xfade *fades, guint num_fades,
+    GstClockTime start, GstClockTime end)
+{
+  guint i;
+
+  for (i = 0; i < num_fades; i++) {
+    if (fades[i].start < end && fades[i].end > start)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/*
+ * Kernels
+ */
+
+XFADE_KERNEL static void
+xfade_mix_add (gfloat * out, const gfloat * in, gsize n)
+{
+  v8sf vo, vi;
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    memcpy (&vo, out + i, sizeof (v8sf));
+    memcpy (&vi, in + i, sizeof (v8sf));
+    vo += vi;
+    memcpy (out + i, &vo, sizeof (v8sf));
+  }
+  for (; i < n; i++)
+    out[i] += in[i];
+}
+
+XFADE_KERNEL static void
+xfade_mix_gain (gfloat * out, const gfloat * in, gfloat gain, gsize n)
+{
+  v8sf vo, vi;
+  v8sf vg = { gain, gain, gain, gain, gain, gain, gain, gain };
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    memcpy (&vo, out + i, sizeof (v8sf));
+    memcpy (&vi, in + i, sizeof (v8sf));
+    vo += vi * vg;
+    memcpy (out + i, &vo, sizeof (v8sf));
+  }
+  for (; i < n; i++)
+    out[i] += in[i] * gain;
+}
+
+/* the gain starts at gain and goes up by step on every frame */
+XFADE_KERNEL static void
+xfade_mix_ramp (gfloat * out, const gfloat * in, gfloat gain, gfloat step,
+    guint frames, guint channels)
+{
+  v8sf vo, vi, vg, vs;
+  gsize i, n = (gsize) frames * channels;
+  guint f, c, j;
+
+  /* odd channel counts don't fit in a vector evenly */
+  if (8 % channels) {
+    for (f = 0; f < frames; f++, gain += step) {
+      for (c = 0; c < channels; c++)
+        out[f * channels + c] += in[f * channels + c] * gain;
+    }
+    return;
+  }
+
+  for (j = 0; j < 8; j++) {
+    vg[j] = gain + step * (j / channels);
+    vs[j] = step * (8 / channels);
+  }
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    memcpy (&vo, out + i, sizeof (v8sf));
+    memcpy (&vi, in + i, sizeof (v8sf));
+    vo += vi * vg;
+    memcpy (out + i, &vo, sizeof (v8sf));
+    vg += vs;
+  }
+  for (; i < n; i++)
+    out[i] += in[i] * (gain + step * (i / channels));
+}
+
+/*
+ * Element
+ */
+
+typedef struct
+{
+  GstAudioAggregator parent;
+} XFadeMixer;
+
+typedef struct
+{
+  GstAudioAggregatorClass parent_class;
+} XFadeMixerClass;
+
+GType xfade_mixer_get_type (void);
+G_DEFINE_TYPE (XFadeMixer, xfade_mixer, GST_TYPE_AUDIO_AGGREGATOR);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (XFADE_CAPS));
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS (XFADE_CAPS));
+
+static gboolean
+xfade_mixer_aggregate_one_buffer (GstAudioAggregator * aagg,
+    GstAudioAggregatorPad * aaggpad, GstBuffer * inbuf, guint in_offset,
+    GstBuffer * outbuf, guint out_offset, guint num_frames)
+{
+  XFadeMixerPad *pad = XFADE_MIXER_PAD (aaggpad);
+  GstAggregatorPad *aggpad = GST_AGGREGATOR_PAD (aaggpad);
+  struct xfade fades[XFADE_MAX_FADES];
+  GstMapInfo inmap, outmap;
+  GstClockTime ts, end, seg_start, seg_end, edge;
+  const gfloat *in;
+  gfloat *out;
+  gfloat gain, next_gain;
+  gdouble volume;
+  guint num_fades, pos, frames, i;
+  gint rate, channels;
+  gsize n;
+
+  rate = GST_AUDIO_INFO_RATE (&aaggpad->info);
+  channels = GST_AUDIO_INFO_CHANNELS (&aaggpad->info);
+
+  GST_OBJECT_LOCK (pad);
+  volume = pad->volume;
+  num_fades = pad->num_fades;
+  memcpy (fades, pad->fades, num_fades * sizeof (struct xfade));
+  GST_OBJECT_UNLOCK (pad);
+
+  if (volume < G_MINDOUBLE)
+    return FALSE;
+
+  /* the envelope is in stream time, like control bindings were */
+  ts = GST_BUFFER_PTS (inbuf);
+  if (GST_CLOCK_TIME_IS_VALID (ts)) {
+    ts += gst_util_uint64_scale_int (in_offset, GST_SECOND, rate);
+    ts = gst_segment_to_stream_time (&aggpad->segment, GST_FORMAT_TIME, ts);
+  }
+  if (!GST_CLOCK_TIME_IS_VALID (ts))
+    num_fades = 0;
+
+  gst_buffer_map (outbuf, &outmap, GST_MAP_READWRITE);
+  gst_buffer_map (inbuf, &inmap, GST_MAP_READ);
+
+  in = (const gfloat *) inmap.data + (gsize) in_offset * channels;
+  out = (gfloat *) outmap.data + (gsize) out_offset * channels;
+
+  end = num_fades ?
+      ts + gst_util_uint64_scale_int (num_frames, GST_SECOND, rate) : ts;
+
+  if (xfade_envelope_is_flat (fades, num_fades, ts, end)) {
+    /* the common case; nothing is fading in this buffer */
+    gfloat gain = volume * xfade_envelope (fades, num_fades, ts);
+
+    n = (gsize) num_frames * channels;
+    if (gain == 1.0f)
+      xfade_mix_add (out, in, n);
+    else if (gain > 0.0f)
+      xfade_mix_gain (out, in, gain, n);
+  } else {
+    /* ramp the gain linearly between points of the envelope, never
+     * across the start or end of a fade, where it bends */
+    gain = volume * xfade_envelope (fades, num_fades, ts);
+    for (pos = 0; pos < num_frames; pos += frames) {
+      frames = MIN (num_frames - pos, XFADE_RAMP_FRAMES);
+      seg_start = ts + gst_util_uint64_scale_int (pos, GST_SECOND, rate);
+      seg_end = ts + gst_util_uint64_scale_int (pos + frames, GST_SECOND,
+          rate);
+
+      for (i = 0; i < num_fades * 2; i++) {
+        edge = (i & 1) ? fades[i / 2].end : fades[i / 2].start;
+        if (edge > seg_start && edge < seg_end)
+          frames = MIN (frames, gst_util_uint64_scale_int_ceil (edge - ts,
+                  rate, GST_SECOND) - pos);
+      }
+      seg_end = ts + gst_util_uint64_scale_int (pos + frames, GST_SECOND,
+          rate);
+
+      next_gain = volume * xfade_envelope (fades, num_fades, seg_end);
+      xfade_mix_ramp (out, in, gain, (next_gain - gain) / frames, frames,
+          channels);
+
+      n = (gsize) frames * channels;
+      in += n;
+      out += n;
+      gain = next_gain;
+    }
+  }
+
+  gst_buffer_unmap (inbuf, &inmap);
+  gst_buffer_unmap (outbuf, &outmap);
+
+  return TRUE;
+}
+
+static void
+xfade_mixer_class_init (XFadeMixerClass * klass)
+{
+  GstElementClass *element_class = (GstElementClass *) klass;
+  GstAudioAggregatorClass *aagg_class = (GstAudioAggregatorClass *) klass;
+  guint i;
+  gdouble x;
+
+  gst_element_class_add_static_pad_template_with_gtype (element_class,
+      &src_template, GST_TYPE_AUDIO_AGGREGATOR_PAD);
+  gst_element_class_add_static_pad_template_with_gtype (element_class,
+      &sink_template, XFADE_TYPE_MIXER_PAD);
+  gst_element_class_set_static_metadata (element_class, "Crossfade mixer",
+      "Generic/Audio", "Mixes F32 audio streams, applying fades",
+      "agent <agent@local>");
+
+  aagg_class->aggregate_one_buffer = xfade_mixer_aggregate_one_buffer;
+
+  for (i = 0; i <= XFADE_LUT_SIZE; i++) {
+    x = (gdouble) i / XFADE_LUT_SIZE;
+    xfade_lut[XFADE_SHAPE_LINEAR][i] = x;
+    xfade_lut[XFADE_SHAPE_EQUAL_POWER][i] = sin (x * G_PI_2);
+    xfade_lut[XFADE_SHAPE_S_CURVE][i] = (1.0 - cos (x * G_PI)) / 2.0;
+  }
+}
+
+static void
+xfade_mixer_init (XFadeMixer * self)
+{
+}
+
+gboolean
+xfade_mixer_register (void)
+{
+  return gst_element_register (NULL, "xfademixer", GST_RANK_NONE,
+      xfade_mixer_get_type ());
+}
+
+gboolean
+xfade_shape_from_string (const gchar * str, XFadeShape * shape)
+{
+  if (!g_strcmp0 (str, "linear"))
+    *shape = XFADE_SHAPE_LINEAR;
+  else if (!g_strcmp0 (str, "equal-power"))
+    *shape = XFADE_SHAPE_EQUAL_POWER;
+  else if (!g_strcmp0 (str, "s-curve"))
+    *shape = XFADE_SHAPE_S_CURVE;
+  else
+    return FALSE;
+
+  return TRUE;
+}
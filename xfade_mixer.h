@@ -0,0 +1,49 @@
+/*
+ * Audio Scheduler - An audio clip scheduler for use in radio broadcasting
+ * Crossfading mixer element
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XFADE_MIXER_H__
+#define __XFADE_MIXER_H__
+
+#include <gst/gst.h>
+
+/* how the level moves between the two ends of a fade */
+typedef enum
+{
+  XFADE_SHAPE_LINEAR = 0,
+  XFADE_SHAPE_EQUAL_POWER,    /* constant power when two fades overlap */
+  XFADE_SHAPE_S_CURVE,        /* slow start and end, raised cosine */
+} XFadeShape;
+
+/* the most channels the mixer accepts */
+#define XFADE_MAX_CHANNELS 64
+
+/* registers the "xfademixer" element with the application */
+gboolean xfade_mixer_register (void);
+
+/* the mixer's sink pads also have a "volume" property, which the fade
+ * level multiplies; positions are in the pad's stream time */
+void xfade_mixer_pad_set_fade (GstPad * pad, GstClockTime start,
+    gdouble start_level, GstClockTime end, gdouble end_level,
+    XFadeShape shape);
+void xfade_mixer_pad_clear_fades (GstPad * pad);
+
+gboolean xfade_shape_from_string (const gchar * str, XFadeShape * shape);
+
+#endif /* __XFADE_MIXER_H__ */